@@ -0,0 +1,805 @@
+#include "bench.h"
+#include "datafile/objectdata.h"
+#include "datafile/slk.h"
+#include "image/bptc.h"
+#include "image/dxt.h"
+#include "image/image.h"
+#include "ngdp/blte.h"
+#include "ngdp/ngdp.h"
+#include "rmpq/archive.h"
+#include "utils/logger.h"
+#include "utils/parallel.h"
+#include "utils/path.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <unordered_map>
+
+namespace {
+
+class Timer {
+public:
+  Timer()
+    : start_(std::chrono::high_resolution_clock::now())
+  {}
+  double elapsed() const {
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start_).count();
+  }
+private:
+  std::chrono::high_resolution_clock::time_point start_;
+};
+
+std::vector<std::pair<istring, File>> load_files(FileLoader& loader, std::set<istring> const& names, char const* ext) {
+  std::vector<std::pair<istring, File>> files;
+  for (auto const& name : names) {
+    if (istring(path::ext(name)) == ext) {
+      File file = loader.load(name.c_str());
+      if (file) {
+        files.emplace_back(name, MemoryFile::from(file));
+      }
+    }
+  }
+  return files;
+}
+
+// Object modification file (war3map.w3u) that changes random units of the base data and adds
+// new ones derived from them, each with a number of random fields of the metadata
+File make_w3u(std::mt19937& random, MetaData const& meta, ObjectData const& base, uint32 changed, uint32 added) {
+  std::vector<uint32> fields;
+  for (size_t row = 0; row < meta.rows(); ++row) {
+    char const* id = meta.getString((int) row, MetaData::ID);
+    if (id && strlen(id) == 4) {
+      fields.push_back(idFromString(id));
+    }
+  }
+  MemoryFile file;
+  file.write32(2);
+  for (int tbl = 0; tbl < 2; ++tbl) {
+    uint32 count = (tbl ? added : changed);
+    file.write32(count);
+    for (uint32 i = 0; i < count; ++i) {
+      uint32 oldid = base.unit(random() % base.numUnits())->id();
+      uint32 newid = (tbl ? idFromString(fmtstring("X%03u", i)) : 0);
+      uint32 mods = 10 + random() % 40;
+      file.write32(oldid, true);
+      file.write32(newid, true);
+      file.write32(mods);
+      for (uint32 j = 0; j < mods; ++j) {
+        uint32 type = random() % 3;
+        file.write32(fields[random() % fields.size()], true);
+        if (type == 0) {
+          file.write32(0);
+          file.write32(random() % 1000);
+        } else if (type == 1) {
+          file.write32(1);
+          file.write<float>(float(random() % 10000) / 100.0f);
+        } else {
+          file.write32(3);
+          std::string value = fmtstring("Generated string %u", (uint32) random());
+          file.write(value.c_str(), value.size() + 1);
+        }
+        file.write32(tbl ? newid : oldid, true);
+      }
+    }
+  }
+  file.seek(0);
+  return file;
+}
+
+}
+
+void benchmark_slk(FileLoader& loader, std::set<istring> const& names) {
+  static const int passes = 10;
+  auto files = load_files(loader, names, ".slk");
+
+  size_t bytes = 0;
+  double timeLines = 0, timeSingle = 0;
+  for (auto& file : files) {
+    bytes += (size_t) file.second.size();
+
+    Timer t0;
+    for (int i = 0; i < passes; ++i) {
+      SLKFile::fromLines(file.second);
+    }
+    timeLines += t0.elapsed();
+
+    Timer t1;
+    for (int i = 0; i < passes; ++i) {
+      SLKFile slk(file.second);
+    }
+    timeSingle += t1.elapsed();
+
+    if (!SLKFile(file.second).same(SLKFile::fromLines(file.second))) {
+      Logger::log("SLK mismatch: %s", file.first.c_str());
+    }
+  }
+
+  double mb = double(bytes) * passes / 1048576.0;
+  Logger::log("SLK: %u files, %.1f MB", (uint32) files.size(), double(bytes) / 1048576.0);
+  Logger::log("  line parser:   %.1f ms/pass (%.1f MB/s)", timeLines / passes, mb * 1000.0 / timeLines);
+  Logger::log("  single pass:   %.1f ms/pass (%.1f MB/s)", timeSingle / passes, mb * 1000.0 / timeSingle);
+}
+
+// Applies the war3map.w3u of every map in the build, and a generated one, to the base unit
+// data with ObjectData::readOBJ, reading through ByteReader and through File
+void benchmark_w3u(FileLoader& loader, std::set<istring> const& names) {
+  static const int passes = 10;
+  MetaData meta(loader.load("Units\\UnitMetaData.slk"));
+  File baseData = MemoryFile::from(loader.load("Units\\UnitData.slk"));
+  ObjectData base;
+  if (!meta.valid() || !baseData || !base.readSLK(baseData) || !base.numUnits()) {
+    return;
+  }
+
+  std::vector<File> files;
+  for (auto const& name : names) {
+    istring ext = path::ext(name);
+    if (ext != ".w3x" && ext != ".w3m") continue;
+    File map = loader.load(name.c_str());
+    if (!map) continue;
+    mpq::Archive archive(map);
+    File file = archive.load("war3map.w3u");
+    if (file) {
+      files.push_back(MemoryFile::from(file));
+    }
+  }
+  std::mt19937 random(28);
+  files.push_back(make_w3u(random, meta, base, 500, 1000));
+  size_t bytes = 0;
+  for (File& file : files) {
+    bytes += (size_t) file.size();
+  }
+
+  size_t mismatch = 0;
+  double time[2] = {0, 0};
+  for (File& file : files) {
+    MemoryFile dump[2];
+    for (int reader = 0; reader < 2; ++reader) {
+      for (int i = 0; i < passes; ++i) {
+        ObjectData data;
+        data.readSLK(baseData);
+        file.seek(0);
+        Timer timer;
+        if (reader) {
+          data.readOBJ(file, &meta, false);
+        } else {
+          data.readOBJFile(file, &meta, false);
+        }
+        time[reader] += timer.elapsed();
+        if (!i) {
+          data.dump(dump[reader]);
+        }
+      }
+    }
+    if (dump[0].size() != dump[1].size() || memcmp(dump[0].data(), dump[1].data(), (size_t) dump[0].size())) {
+      ++mismatch;
+    }
+  }
+
+  double mb = double(bytes) * passes / 1048576.0;
+  Logger::log("w3u: %u files (1 generated), %.1f KB", (uint32) files.size(), double(bytes) / 1024.0);
+  Logger::log("  File:          %.2f ms/pass (%.1f MB/s)", time[0] / passes, mb * 1000.0 / time[0]);
+  Logger::log("  ByteReader:    %.2f ms/pass (%.1f MB/s)", time[1] / passes, mb * 1000.0 / time[1]);
+  if (mismatch) {
+    Logger::log("w3u: %u files parsed differently", (uint32) mismatch);
+  }
+}
+
+void benchmark_resolve(CompositeLoader& loader, std::set<istring> const& names) {
+  // every name plus a variant with a different extension, so that roughly half of the lookups miss
+  std::vector<std::string> paths;
+  for (auto const& name : names) {
+    paths.push_back(name);
+    paths.push_back(path::path(name) / path::title(name) + ".dds");
+  }
+
+  auto before = loader.stats();
+  size_t found[2] = {0, 0};
+  double time[2];
+  for (int pass = 0; pass < 2; ++pass) {
+    Timer t;
+    for (auto const& path : paths) {
+      std::string key = path;
+      if (loader.resolve(key)) {
+        ++found[pass];
+      }
+    }
+    time[pass] = t.elapsed();
+  }
+  auto after = loader.stats();
+
+  if (found[0] != found[1]) {
+    Logger::log("resolve: result mismatch (%u vs %u)", (uint32) found[0], (uint32) found[1]);
+  }
+  Logger::log("resolve: %u paths, %u found", (uint32) paths.size(), (uint32) found[0]);
+  Logger::log("  cold:          %.1f ms", time[0]);
+  Logger::log("  cached:        %.1f ms", time[1]);
+  Logger::log("  cache:         %u hits, %u known misses",
+    (uint32) (after.hits - before.hits), (uint32) (after.negativeHits - before.negativeHits));
+}
+
+// Decodes every DXT compressed texture (BLP2 and DDS) with the scalar and the vector block
+// decoders, which must produce the same pixels
+void benchmark_dxt(FileLoader& loader, std::set<istring> const& names) {
+  static const int passes = 5;
+  std::vector<std::pair<istring, File>> files;
+  for (char const* ext : {".blp", ".dds"}) {
+    for (auto& file : load_files(loader, names, ext)) {
+      uint32 magic = file.second.read32();
+      if (magic == '2PLB' || magic == ' SDD') {
+        files.push_back(file);
+      }
+    }
+  }
+
+  size_t pixels = 0, mismatch = 0;
+  double time[2] = {0, 0};
+  for (auto& file : files) {
+    Image images[2];
+    for (int simd = 0; simd < 2; ++simd) {
+      DXT::setSimd(simd != 0);
+      Timer timer;
+      for (int i = 0; i < passes; ++i) {
+        images[simd] = Image(file.second);
+      }
+      time[simd] += timer.elapsed();
+    }
+    size_t count = size_t(images[0].width()) * images[0].height();
+    pixels += count;
+    if (images[0].width() != images[1].width() || images[0].height() != images[1].height() ||
+        memcmp(images[0].bits(), images[1].bits(), count * sizeof(Image::color_t))) {
+      Logger::log("DXT mismatch: %s", file.first.c_str());
+      ++mismatch;
+    }
+  }
+  DXT::setSimd(true);
+
+  double mpix = double(pixels) * passes / 1000000.0;
+  Logger::log("DXT: %u textures, %.1f Mpixels", (uint32) files.size(), double(pixels) / 1000000.0);
+  Logger::log("  scalar:        %.1f ms/pass (%.1f Mpix/s)", time[0] / passes, mpix * 1000.0 / time[0]);
+  Logger::log("  vector:        %.1f ms/pass (%.1f Mpix/s)", time[1] / passes, mpix * 1000.0 / time[1]);
+  if (mismatch) {
+    Logger::log("DXT: %u mismatched textures", (uint32) mismatch);
+  }
+}
+
+namespace {
+
+// writes a chunk with its length and CRC
+void png_chunk(File& file, char const* type, std::vector<uint8> const& data) {
+  std::vector<uint8> body(type, type + 4);
+  body.insert(body.end(), data.begin(), data.end());
+  file.write32((uint32) data.size(), true);
+  file.write(body.data(), body.size());
+  file.write32(crc32(body.data(), (uint32) body.size()), true);
+}
+
+// PNG with random or smooth samples of the given type, each row with a random filter, and the
+// compressed data split over a number of IDAT chunks
+File make_png(std::mt19937& random, uint32 width, uint32 height, uint8 colorType, uint8 depth,
+              bool interlace, bool smooth, bool transparency, uint32 chunks) {
+  static const uint32 channels[7] = {1, 0, 3, 1, 2, 0, 4};
+  uint32 count = channels[colorType];
+  uint32 maxValue = (1U << depth) - 1;
+  uint32 palette = (colorType == 3 ? 1 + random() % (maxValue + 1) : 0);
+  std::vector<uint32> samples(width * height * count);
+  for (uint32 y = 0; y < height; ++y) {
+    for (uint32 x = 0; x < width; ++x) {
+      for (uint32 c = 0; c < count; ++c) {
+        uint32& value = samples[(y * width + x) * count + c];
+        if (colorType == 3) {
+          value = (smooth ? (x + y) % palette : random() % palette);
+        } else if (smooth) {
+          int noisy = int((x * 7 + y * 3 + c * 50) % (maxValue + 1)) + int(random() % 5) - 2;
+          value = (uint32) std::min<int>(maxValue, std::max(noisy, 0));
+        } else {
+          value = random() % (maxValue + 1);
+        }
+      }
+    }
+  }
+
+  // Adam7 passes as (x, y, dx, dy)
+  static const uint32 adam7[7][4] = {{0, 0, 8, 8}, {4, 0, 8, 8}, {0, 4, 4, 8}, {2, 0, 4, 4}, {0, 2, 2, 4}, {1, 0, 2, 2}, {0, 1, 1, 2}};
+  static const uint32 single[1][4] = {{0, 0, 1, 1}};
+  uint32 bpp = std::max<uint32>(1, count * depth / 8);
+  std::vector<uint8> raw;
+  for (uint32 pass = 0; pass < (interlace ? 7U : 1U); ++pass) {
+    uint32 const* step = (interlace ? adam7[pass] : single[0]);
+    std::vector<uint8> prev, row;
+    for (uint32 y = step[1]; y < height; y += step[3]) {
+      row.clear();
+      uint32 bits = 0, used = 0;
+      for (uint32 x = step[0]; x < width; x += step[2]) {
+        for (uint32 c = 0; c < count; ++c) {
+          uint32 value = samples[(y * width + x) * count + c];
+          if (depth >= 8) {
+            for (int shift = depth - 8; shift >= 0; shift -= 8) {
+              row.push_back(uint8(value >> shift));
+            }
+          } else {
+            bits = (bits << depth) | value;
+            used += depth;
+            if (used == 8) {
+              row.push_back(uint8(bits));
+              bits = used = 0;
+            }
+          }
+        }
+      }
+      if (row.empty() && !used) break;
+      if (used) row.push_back(uint8(bits << (8 - used)));
+      if (prev.empty()) prev.assign(row.size(), 0);
+      uint8 filter = uint8(random() % 5);
+      raw.push_back(filter);
+      for (size_t i = 0; i < row.size(); ++i) {
+        int a = (i >= bpp ? row[i - bpp] : 0), b = prev[i], c = (i >= bpp ? prev[i - bpp] : 0);
+        int predictor = 0;
+        if (filter == 1) predictor = a;
+        if (filter == 2) predictor = b;
+        if (filter == 3) predictor = (a + b) / 2;
+        if (filter == 4) {
+          int pa = std::abs(b - c), pb = std::abs(a - c), pc = std::abs(a + b - 2 * c);
+          predictor = (pa <= pb && pa <= pc ? a : (pb <= pc ? b : c));
+        }
+        raw.push_back(uint8(row[i] - predictor));
+      }
+      prev = row;
+    }
+  }
+
+  MemoryFile file;
+  static const uint8 signature[8] = {0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A};
+  file.write(signature, sizeof signature);
+  std::vector<uint8> header(13);
+  for (int i = 0; i < 4; ++i) {
+    header[i] = uint8(width >> (24 - i * 8));
+    header[4 + i] = uint8(height >> (24 - i * 8));
+  }
+  header[8] = depth;
+  header[9] = colorType;
+  header[12] = (interlace ? 1 : 0);
+  png_chunk(file, "IHDR", header);
+  std::vector<uint8> extra;
+  if (colorType == 3) {
+    std::vector<uint8> colors(palette * 3);
+    for (auto& byte : colors) byte = (uint8) random();
+    png_chunk(file, "PLTE", colors);
+    extra.resize(random() % (palette + 1));
+    for (auto& byte : extra) byte = (uint8) random();
+  } else if (colorType == 0 || colorType == 2) {
+    for (uint32 c = 0; c < count; ++c) {
+      uint32 key = random() % (maxValue + 1);
+      extra.push_back(uint8(key >> 8));
+      extra.push_back(uint8(key));
+    }
+  }
+  if (transparency && !extra.empty()) {
+    png_chunk(file, "tRNS", extra);
+  }
+  uint32 size = (uint32) raw.size() + (uint32) raw.size() / 10 + 64;
+  std::vector<uint8> compressed(size);
+  gzdeflate(raw.data(), (uint32) raw.size(), compressed.data(), &size);
+  compressed.resize(size);
+  uint32 part = size / chunks + 1;
+  for (uint32 pos = 0; pos < size; pos += part) {
+    png_chunk(file, "IDAT", std::vector<uint8>(compressed.begin() + pos, compressed.begin() + std::min(size, pos + part)));
+  }
+  png_chunk(file, "IEND", std::vector<uint8>());
+  file.seek(0);
+  return file;
+}
+
+// Small PNGs that cover every color type and bit depth, with and without interlacing and
+// transparency, for comparing decoders on layouts the build's images do not use
+std::vector<std::pair<istring, File>> png_corpus() {
+  static const uint8 formats[][2] = {
+    {0, 1}, {0, 2}, {0, 4}, {0, 8}, {0, 16}, {2, 8}, {2, 16}, {3, 1}, {3, 2}, {3, 4}, {3, 8}, {4, 8}, {4, 16}, {6, 8}, {6, 16},
+  };
+  static const uint32 sizes[][2] = {{1, 1}, {3, 2}, {17, 9}, {33, 40}, {64, 5}, {256, 256}};
+  static const uint32 chunks[] = {1, 3, 50};
+  std::mt19937 random(7);
+  std::vector<std::pair<istring, File>> files;
+  for (auto const& format : formats) {
+    for (int interlace = 0; interlace < 2; ++interlace) {
+      for (auto const& size : sizes) {
+        for (int smooth = 0; smooth < 2; ++smooth) {
+          bool transparency = (random() % 5 < 2);
+          uint32 parts = chunks[random() % 3];
+          files.emplace_back(fmtstring("corpus/type%u_%ubit_%ux%u%s%s.png", format[0], format[1], size[0], size[1],
+              interlace ? "_interlaced" : "", smooth ? "_smooth" : ""),
+            make_png(random, size[0], size[1], format[0], format[1], interlace != 0, smooth != 0, transparency, parts));
+        }
+      }
+    }
+  }
+  return files;
+}
+
+}
+
+namespace ImagePrivate {
+  bool imReadPNGReference(Image& image, File& file);
+}
+
+// Decodes PNGs the way icons and loading screens are re-read from the image cache: the
+// command button and loading screen textures are written with the current PNG settings, and
+// the .png files of the build are added as they are, along with a generated corpus of every
+// PNG layout. Each pass decodes them with the previous decoder (pngreference.cpp) and with
+// the scalar and vector row filters, which must all give the same pixels, then with the
+// vector filters on every core at once.
+void benchmark_png(FileLoader& loader, std::set<istring> const& names) {
+  static const int passes = 5;
+  std::vector<std::pair<istring, File>> files = png_corpus();
+  size_t generated = files.size();
+  for (char const* ext : {".blp", ".dds"}) {
+    for (auto& file : load_files(loader, names, ext)) {
+      if (file.first.find("commandbuttons") == istring::npos && file.first.find("loadingscreen") == istring::npos) {
+        continue;
+      }
+      Image image(file.second);
+      MemoryFile png;
+      if (image && image.write(png)) {
+        files.emplace_back(file.first, png);
+      }
+    }
+  }
+  for (auto& file : load_files(loader, names, ".png")) {
+    files.push_back(file);
+  }
+
+  size_t pixels = 0, mismatch = 0;
+  double time[4] = {0, 0, 0, 0};
+  for (auto& file : files) {
+    Image images[3];
+    {
+      Timer timer;
+      for (int i = 0; i < passes; ++i) {
+        images[0] = Image();
+        File input = file.second;
+        ImagePrivate::imReadPNGReference(images[0], input);
+      }
+      time[0] += timer.elapsed();
+    }
+    for (int simd = 0; simd < 2; ++simd) {
+      setPNGSimd(simd != 0);
+      Timer timer;
+      for (int i = 0; i < passes; ++i) {
+        images[1 + simd] = Image(file.second, ImageFormat::PNG);
+      }
+      time[1 + simd] += timer.elapsed();
+    }
+    size_t count = size_t(images[0].width()) * images[0].height();
+    pixels += count;
+    for (int i = 1; i < 3; ++i) {
+      if (!images[0] || images[0].width() != images[i].width() || images[0].height() != images[i].height() ||
+          memcmp(images[0].bits(), images[i].bits(), count * sizeof(Image::color_t))) {
+        Logger::log("PNG mismatch: %s (%s)", file.first.c_str(), i == 1 ? "scalar" : "vector");
+        ++mismatch;
+      }
+    }
+  }
+
+  Timer timer;
+  for (int i = 0; i < passes; ++i) {
+    parallel_for(files.size(), [&](size_t index) {
+      Image image(files[index].second.subfile(0, files[index].second.size()), ImageFormat::PNG);
+    });
+  }
+  time[3] = timer.elapsed();
+
+  double mpix = double(pixels) * passes / 1000000.0;
+  Logger::log("PNG: %u images (%u generated), %.1f Mpixels", (uint32) files.size(), (uint32) generated, double(pixels) / 1000000.0);
+  Logger::log("  previous:      %.1f ms/pass (%.1f Mpix/s)", time[0] / passes, mpix * 1000.0 / time[0]);
+  Logger::log("  scalar:        %.1f ms/pass (%.1f Mpix/s)", time[1] / passes, mpix * 1000.0 / time[1]);
+  Logger::log("  vector:        %.1f ms/pass (%.1f Mpix/s)", time[2] / passes, mpix * 1000.0 / time[2]);
+  Logger::log("  all threads:   %.1f ms/pass (%.1f Mpix/s)", time[3] / passes, mpix * 1000.0 / time[3]);
+  if (mismatch) {
+    Logger::log("PNG: %u failed or mismatched decodes", (uint32) mismatch);
+  }
+}
+
+// Shrinks the command button icons to the icon sheet size with the old LinScaler and with the
+// scalar and vector resampling kernels, which must all produce the same pixels
+void benchmark_resample(FileLoader& loader, std::set<istring> const& names) {
+  static const int passes = 5;
+  static const int size = 16;
+  std::vector<Image> images;
+  for (auto& file : load_files(loader, names, ".blp")) {
+    if (file.first.find("commandbuttons") == istring::npos) continue;
+    Image image(file.second);
+    if (image) images.push_back(image);
+  }
+
+  typedef decltype(ImageFilter::Lanczos3) Filter;
+  size_t mismatch = 0;
+  double time[3] = {0, 0, 0};
+  for (auto& image : images) {
+    Image result[3];
+    Timer timer;
+    for (int i = 0; i < passes; ++i) {
+      Image rows(size, image.height()), cols(size, size);
+      ImagePrivate::scaleRows<Color::Default, Filter>(image, rows, double(size) / image.width(), ImageFilter::Lanczos3);
+      ImagePrivate::scaleColumns<Color::Default, Filter>(rows, cols, double(size) / image.height(), ImageFilter::Lanczos3);
+      result[0] = cols;
+    }
+    time[0] += timer.elapsed();
+    for (int simd = 0; simd < 2; ++simd) {
+      setResampleSimd(simd != 0);
+      Timer timer;
+      for (int i = 0; i < passes; ++i) {
+        result[1 + simd] = image.resize(size, size);
+      }
+      time[1 + simd] += timer.elapsed();
+    }
+    for (int i = 1; i < 3; ++i) {
+      if (memcmp(result[0].bits(), result[i].bits(), size * size * sizeof(Image::color_t))) {
+        ++mismatch;
+        break;
+      }
+    }
+  }
+  setResampleSimd(true);
+
+  Logger::log("Resample: %u icons to %dx%d", (uint32) images.size(), size, size);
+  Logger::log("  LinScaler:     %.1f ms/pass", time[0] / passes);
+  Logger::log("  scalar:        %.1f ms/pass", time[1] / passes);
+  Logger::log("  vector:        %.1f ms/pass", time[2] / passes);
+  if (mismatch) {
+    Logger::log("Resample: %u mismatched icons", (uint32) mismatch);
+  }
+}
+
+// Composes icon sheets the way ImageStorage does, from the command button icons as they are
+// and faded to half alpha, with the scalar and the vector blending kernels
+void benchmark_blend(FileLoader& loader, std::set<istring> const& names) {
+  static const int passes = 5;
+  static const int size = 64, columns = 16;
+  std::vector<Image> icons[2];
+  for (auto& file : load_files(loader, names, ".blp")) {
+    if (file.first.find("commandbuttons") == istring::npos) continue;
+    Image image(file.second);
+    if (!image) continue;
+    image = image.resize(size, size);
+    icons[0].push_back(image);
+    image.modulate(Image::color_t(255, 255, 255, 128));
+    icons[1].push_back(image);
+  }
+  if (icons[0].empty()) return;
+
+  int rows = (int) (icons[0].size() + columns - 1) / columns;
+  double time[2][2] = {{0, 0}, {0, 0}};
+  size_t mismatch = 0;
+  for (int faded = 0; faded < 2; ++faded) {
+    Image sheets[2];
+    for (int simd = 0; simd < 2; ++simd) {
+      setBlendSimd(simd != 0);
+      Timer timer;
+      for (int i = 0; i < passes; ++i) {
+        sheets[simd] = Image(size * columns, size * rows, Image::color_t(32, 32, 32));
+        for (size_t j = 0; j < icons[faded].size(); ++j) {
+          sheets[simd].blt(int(j % columns) * size, int(j / columns) * size, icons[faded][j]);
+        }
+      }
+      time[faded][simd] = timer.elapsed();
+    }
+    if (memcmp(sheets[0].bits(), sheets[1].bits(), sheets[0].size())) {
+      ++mismatch;
+    }
+  }
+  setBlendSimd(true);
+
+  double mpix = double(icons[0].size()) * size * size * passes / 1000000.0;
+  Logger::log("Blend: %u icons, %dx%d", (uint32) icons[0].size(), size, size);
+  Logger::log("  opaque scalar: %.2f ms/pass (%.1f Mpix/s)", time[0][0] / passes, mpix * 1000.0 / time[0][0]);
+  Logger::log("  opaque vector: %.2f ms/pass (%.1f Mpix/s)", time[0][1] / passes, mpix * 1000.0 / time[0][1]);
+  Logger::log("  faded scalar:  %.2f ms/pass (%.1f Mpix/s)", time[1][0] / passes, mpix * 1000.0 / time[1][0]);
+  Logger::log("  faded vector:  %.2f ms/pass (%.1f Mpix/s)", time[1][1] / passes, mpix * 1000.0 / time[1][1]);
+  if (mismatch) {
+    Logger::log("Blend: scalar and vector sheets differ");
+  }
+}
+
+// Decodes every BC6H and BC7 DDS texture on one thread and with the block rows spread over
+// all cores
+void benchmark_bptc(FileLoader& loader, std::set<istring> const& names) {
+  static const int passes = 5;
+  std::vector<std::pair<istring, File>> files;
+  for (auto& file : load_files(loader, names, ".dds")) {
+    // fourcc of the pixel format, then the DXGI format of the DX10 header
+    file.second.seek(84);
+    if (file.second.read32() != '01XD') continue;
+    file.second.seek(128);
+    uint32 format = file.second.read32();
+    if (format >= 94 && format <= 99) {
+      files.push_back(file);
+    }
+  }
+
+  size_t pixels = 0, mismatch = 0;
+  double time[2] = {0, 0};
+  for (auto& file : files) {
+    Image images[2];
+    for (int parallel = 0; parallel < 2; ++parallel) {
+      BPTC::setParallel(parallel != 0);
+      Timer timer;
+      for (int i = 0; i < passes; ++i) {
+        images[parallel] = Image(file.second);
+      }
+      time[parallel] += timer.elapsed();
+    }
+    size_t count = size_t(images[0].width()) * images[0].height();
+    pixels += count;
+    if (!images[0] || images[0].width() != images[1].width() || images[0].height() != images[1].height() ||
+        memcmp(images[0].bits(), images[1].bits(), count * sizeof(Image::color_t))) {
+      Logger::log("BPTC mismatch: %s", file.first.c_str());
+      ++mismatch;
+    }
+  }
+  BPTC::setParallel(true);
+
+  double mpix = double(pixels) * passes / 1000000.0;
+  Logger::log("BPTC: %u textures, %.1f Mpixels", (uint32) files.size(), double(pixels) / 1000000.0);
+  Logger::log("  one thread:    %.1f ms/pass (%.1f Mpix/s)", time[0] / passes, mpix * 1000.0 / time[0]);
+  Logger::log("  all threads:   %.1f ms/pass (%.1f Mpix/s)", time[1] / passes, mpix * 1000.0 / time[1]);
+  if (mismatch) {
+    Logger::log("BPTC: %u failed or mismatched textures", (uint32) mismatch);
+  }
+}
+
+namespace {
+
+// Bytes and blocks allocated through a CountingAllocator
+struct AllocStats {
+  size_t bytes = 0;
+  size_t count = 0;
+};
+
+// Allocator that tallies the memory a container holds, for comparisons with flat tables
+template<class T>
+class CountingAllocator {
+public:
+  typedef T value_type;
+
+  explicit CountingAllocator(AllocStats* stats)
+    : stats(stats)
+  {}
+  template<class U>
+  CountingAllocator(CountingAllocator<U> const& other)
+    : stats(other.stats)
+  {}
+
+  T* allocate(size_t n) {
+    stats->bytes += n * sizeof(T);
+    stats->count++;
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+  void deallocate(T* ptr, size_t n) {
+    stats->bytes -= n * sizeof(T);
+    stats->count--;
+    ::operator delete(ptr);
+  }
+
+  template<class U>
+  bool operator==(CountingAllocator<U> const& rhs) const {
+    return stats == rhs.stats;
+  }
+  template<class U>
+  bool operator!=(CountingAllocator<U> const& rhs) const {
+    return stats != rhs.stats;
+  }
+
+  AllocStats* stats;
+};
+
+}
+
+// Compares ArchiveIndex lookups with the unordered_map of full keys it replaced, built the
+// old way from the archive .index files. Every key is looked up, plus as many misses, half
+// of them next to real keys, and all results are checked against the map.
+void benchmark_index(NGDP::ArchiveIndex const& index) {
+  typedef NGDP::ArchiveIndex::Location Location;
+  typedef NGDP::Hash_container Key;
+  if (!index.size()) {
+    Logger::log("index: no table");
+    return;
+  }
+
+  AllocStats mapMemory;
+  typedef CountingAllocator<std::pair<Key const, Location>> Allocator;
+  std::unordered_map<Key, Location, Key::hash, Key::equal, Allocator> map(0, Key::hash(), Key::equal(), Allocator(&mapMemory));
+  NGDP::Hash nilHash;
+  memset(nilHash, 0, sizeof(NGDP::Hash));
+  for (size_t i = 0; i < index.archives().size(); ++i) {
+    File file = index.loadIndex(i);
+    if (!file) {
+      Logger::log("index: failed to load %s.index", index.archives()[i].c_str());
+      return;
+    }
+    size_t size = (size_t) file.size();
+    for (size_t block = 0; block + 4096 <= size; block += 4096) {
+      file.seek(block);
+      for (size_t pos = 0; pos + 24 <= 4096; pos += 24) {
+        Key key;
+        file.read(key._, sizeof(NGDP::Hash));
+        if (!memcmp(key._, nilHash, sizeof(NGDP::Hash))) {
+          block = size;
+          break;
+        }
+        Location& location = map[key];
+        location.archive = (uint16) i;
+        location.size = file.read32(true);
+        location.offset = file.read32(true);
+      }
+    }
+  }
+
+  std::vector<Key> keys;
+  keys.reserve(map.size() * 2);
+  for (auto const& kv : map) {
+    keys.push_back(kv.first);
+  }
+  std::mt19937 random(1);
+  for (size_t i = 0, count = map.size(); i < count; ++i) {
+    Key key = keys[i];
+    if (i & 1) {
+      for (auto& byte : key._) byte = (uint8) random();
+    } else {
+      key._[NGDP::ArchiveIndex::KEY_SIZE - 1] ^= 0x80;
+    }
+    keys.push_back(key);
+  }
+  std::shuffle(keys.begin(), keys.end(), random);
+
+  size_t found[2] = {0, 0}, mismatch = 0;
+  double time[2];
+  {
+    Timer timer;
+    for (auto const& key : keys) {
+      Location location;
+      found[0] += index.locate(key._, location);
+    }
+    time[0] = timer.elapsed();
+  }
+  {
+    Timer timer;
+    for (auto const& key : keys) {
+      found[1] += map.count(key);
+    }
+    time[1] = timer.elapsed();
+  }
+  for (auto const& key : keys) {
+    Location location;
+    bool hit = index.locate(key._, location);
+    auto it = map.find(key);
+    if (hit != (it != map.end()) || (hit && (location.archive != it->second.archive ||
+        location.offset != it->second.offset || location.size != it->second.size))) {
+      ++mismatch;
+    }
+  }
+
+  Logger::log("index: %u keys in %u archives, %u lookups", (uint32) map.size(), (uint32) index.archives().size(), (uint32) keys.size());
+  Logger::log("  sorted table:  %.1f ms, %.1f MB mapped, %u found", time[0], double(index.memory()) / 1048576.0, (uint32) found[0]);
+  Logger::log("  unordered_map: %.1f ms, %.1f MB in %u allocations, %u found", time[1],
+    double(mapMemory.bytes) / 1048576.0, (uint32) mapMemory.count, (uint32) found[1]);
+  if (mismatch || index.size() != map.size()) {
+    Logger::log("index: %u mismatched lookups, %u keys in the table", (uint32) mismatch, (uint32) index.size());
+  }
+}
+
+void report_blte() {
+  for (auto const& kv : NGDP::GetBLTEStats()) {
+    auto const& stats = kv.second;
+    Logger::log("BLTE '%c': %u chunks, %.1f MB -> %.1f MB, %.1f ms (%.1f MB/s)", kv.first, (uint32) stats.chunks,
+      double(stats.csize) / 1048576.0, double(stats.usize) / 1048576.0, stats.time,
+      double(stats.usize) / 1048576.0 * 1000.0 / std::max(stats.time, 0.001));
+  }
+}
+
+void report_cdn(NGDP::CdnPool const& cdn) {
+  for (auto const& host : cdn.stats()) {
+    Logger::log("CDN %s: %u requests, %u failed, %.1f MB, %.1f ms (%.1f MB/s), latency %.1f ms", host.host.c_str(),
+      (uint32) host.requests, (uint32) host.failures, double(host.bytes) / 1048576.0, host.time,
+      double(host.bytes) / 1048576.0 * 1000.0 / std::max(host.time, 0.001), host.latency);
+  }
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "utils/file.h"
+#include "utils/common.h"
+#include "ngdp/ngdp.h"
+#include <set>
+
+// Timing and validation passes over the files of a loaded build, run from main() when
+// RUN_BENCHMARKS is set. Results go to the log.
+
+void benchmark_slk(FileLoader& loader, std::set<istring> const& names);
+void benchmark_w3u(FileLoader& loader, std::set<istring> const& names);
+void benchmark_resolve(CompositeLoader& loader, std::set<istring> const& names);
+void benchmark_dxt(FileLoader& loader, std::set<istring> const& names);
+void benchmark_bptc(FileLoader& loader, std::set<istring> const& names);
+void benchmark_png(FileLoader& loader, std::set<istring> const& names);
+void benchmark_resample(FileLoader& loader, std::set<istring> const& names);
+void benchmark_blend(FileLoader& loader, std::set<istring> const& names);
+void benchmark_index(NGDP::ArchiveIndex const& index);
+void report_blte();
+void report_cdn(NGDP::CdnPool const& cdn);
@@ -23,10 +23,15 @@ call emcc image\image.cpp -o emcc/image.bc --std=c++11 -O3 -DNO_SYSTEM -DZ_SOLO
 call emcc image\imageblp.cpp -o emcc/imageblp.bc --std=c++11 -O3 -DNO_SYSTEM -DZ_SOLO -I.
 call emcc image\imageblp2.cpp -o emcc/imageblp2.bc --std=c++11 -O3 -DNO_SYSTEM -DZ_SOLO -I.
 call emcc image\imagedds.cpp -o emcc/imagedds.bc --std=c++11 -O3 -DNO_SYSTEM -DZ_SOLO -I.
+call emcc image\dxt.cpp -o emcc/dxt.bc --std=c++11 -O3 -DNO_SYSTEM -DZ_SOLO -I.
+call emcc image\bptc.cpp -o emcc/bptc.bc --std=c++11 -O3 -DNO_SYSTEM -DZ_SOLO -I.
 call emcc image\imagegif.cpp -o emcc/imagegif.bc --std=c++11 -O3 -DNO_SYSTEM -DZ_SOLO -I.
 call emcc image\imagejpg.cpp -o emcc/imagejpg.bc --std=c++11 -O3 -DNO_SYSTEM -DZ_SOLO -I.
+call emcc image\jpegdecoder.cpp -o emcc/jpegdecoder.bc --std=c++11 -O3 -DNO_SYSTEM -DZ_SOLO -I.
 call emcc image\imagepng.cpp -o emcc/imagepng.bc --std=c++11 -O3 -DNO_SYSTEM -DZ_SOLO -I.
 call emcc image\imagetga.cpp -o emcc/imagetga.bc --std=c++11 -O3 -DNO_SYSTEM -DZ_SOLO -I.
+call emcc image\resample.cpp -o emcc/resample.bc --std=c++11 -O3 -DNO_SYSTEM -DZ_SOLO -I.
+call emcc image\blend.cpp -o emcc/blend.bc --std=c++11 -O3 -DNO_SYSTEM -DZ_SOLO -I.
 call emcc jpeg\source\jcapimin.c -o emcc/jcapimin.bc -O3 -DNO_SYSTEM -DZ_SOLO -I.
 call emcc jpeg\source\jcapistd.c -o emcc/jcapistd.bc -O3 -DNO_SYSTEM -DZ_SOLO -I.
 call emcc jpeg\source\jccoefct.c -o emcc/jccoefct.bc -O3 -DNO_SYSTEM -DZ_SOLO -I.
@@ -96,4 +101,4 @@ call emcc webmain.cpp -o emcc/webmain.bc --std=c++11 -O3 -DNO_SYSTEM -DZ_SOLO -I
 call emcc webarc.cpp -o emcc/webarc.bc --std=c++11 -O3 -DNO_SYSTEM -DZ_SOLO -I.
 
 call emcc emcc/adler32.bc emcc/compress1.bc emcc/crc321.bc emcc/deflate.bc emcc/infback.bc emcc/inffast.bc emcc/inflate.bc emcc/inftrees.bc emcc/trees.bc emcc/uncompr.bc emcc/zutil.bc emcc/checksum.bc emcc/common1.bc emcc/file.bc emcc/path.bc emcc/strlib.bc emcc/hash.bc emcc/game.bc emcc/id.bc emcc/metadata.bc emcc/objectdata.bc emcc/slk.bc emcc/unitdata.bc emcc/westrings.bc emcc/wtsdata.bc emcc/adpcm.bc emcc/archive.bc emcc/common.bc emcc/compress.bc emcc/huff.bc emcc/locale.bc emcc/crc32.bc emcc/explode.bc emcc/implode.bc emcc/json.bc emcc/utf8.bc emcc/parse.bc emcc/search.bc emcc/webmain.bc -o MapParser.js -s EXPORT_NAME="MapParser" -O3 -s WASM=1 -s MODULARIZE=1 -s EXPORTED_FUNCTIONS="['_malloc', '_free']" --post-js ./module-post.js -s ALLOW_MEMORY_GROWTH=1 -s TOTAL_MEMORY=134217728 -s DISABLE_EXCEPTION_CATCHING=0
-call emcc emcc/adler32.bc emcc/compress1.bc emcc/crc321.bc emcc/deflate.bc emcc/infback.bc emcc/inffast.bc emcc/inflate.bc emcc/inftrees.bc emcc/trees.bc emcc/uncompr.bc emcc/zutil.bc emcc/checksum.bc emcc/common1.bc emcc/file.bc emcc/path.bc emcc/strlib.bc emcc/hash.bc emcc/webarc.bc emcc/image.bc emcc/imageblp.bc emcc/imageblp2.bc emcc/imagedds.bc emcc/imagegif.bc emcc/imagejpg.bc emcc/imagepng.bc emcc/imagetga.bc emcc/jcapimin.bc emcc/jcapistd.bc emcc/jccoefct.bc emcc/jccolor.bc emcc/jcdctmgr.bc emcc/jchuff.bc emcc/jcinit.bc emcc/jcmainct.bc emcc/jcmarker.bc emcc/jcmaster.bc emcc/jcomapi.bc emcc/jcparam.bc emcc/jcphuff.bc emcc/jcprepct.bc emcc/jcsample.bc emcc/jctrans.bc emcc/jdapimin.bc emcc/jdapistd.bc emcc/jdatadst.bc emcc/jdatasrc.bc emcc/jdcoefct.bc emcc/jdcolor.bc emcc/jddctmgr.bc emcc/jdhuff.bc emcc/jdinput.bc emcc/jdmainct.bc emcc/jdmarker.bc emcc/jdmaster.bc emcc/jdmerge.bc emcc/jdphuff.bc emcc/jdpostct.bc emcc/jdsample.bc emcc/jdtrans.bc emcc/jerror.bc emcc/jfdctflt.bc emcc/jfdctfst.bc emcc/jfdctint.bc emcc/jidctflt.bc emcc/jidctfst.bc emcc/jidctint.bc emcc/jidctred.bc emcc/jmemmgr.bc emcc/jmemnobs.bc emcc/jquant1.bc emcc/jquant2.bc emcc/jutils.bc emcc/jass.bc emcc/detect.bc emcc/common.bc -o ArchiveLoader.js -s EXPORT_NAME="ArchiveLoader" -O3 -s WASM=1 -s MODULARIZE=1 -s EXPORTED_FUNCTIONS="['_malloc', '_free']" --post-js ./module-post.js -s ALLOW_MEMORY_GROWTH=1 -s TOTAL_MEMORY=33554432
+call emcc emcc/adler32.bc emcc/compress1.bc emcc/crc321.bc emcc/deflate.bc emcc/infback.bc emcc/inffast.bc emcc/inflate.bc emcc/inftrees.bc emcc/trees.bc emcc/uncompr.bc emcc/zutil.bc emcc/checksum.bc emcc/common1.bc emcc/file.bc emcc/path.bc emcc/strlib.bc emcc/hash.bc emcc/webarc.bc emcc/image.bc emcc/imageblp.bc emcc/imageblp2.bc emcc/imagedds.bc emcc/dxt.bc emcc/bptc.bc emcc/imagegif.bc emcc/imagejpg.bc emcc/jpegdecoder.bc emcc/imagepng.bc emcc/imagetga.bc emcc/resample.bc emcc/blend.bc emcc/jcapimin.bc emcc/jcapistd.bc emcc/jccoefct.bc emcc/jccolor.bc emcc/jcdctmgr.bc emcc/jchuff.bc emcc/jcinit.bc emcc/jcmainct.bc emcc/jcmarker.bc emcc/jcmaster.bc emcc/jcomapi.bc emcc/jcparam.bc emcc/jcphuff.bc emcc/jcprepct.bc emcc/jcsample.bc emcc/jctrans.bc emcc/jdapimin.bc emcc/jdapistd.bc emcc/jdatadst.bc emcc/jdatasrc.bc emcc/jdcoefct.bc emcc/jdcolor.bc emcc/jddctmgr.bc emcc/jdhuff.bc emcc/jdinput.bc emcc/jdmainct.bc emcc/jdmarker.bc emcc/jdmaster.bc emcc/jdmerge.bc emcc/jdphuff.bc emcc/jdpostct.bc emcc/jdsample.bc emcc/jdtrans.bc emcc/jerror.bc emcc/jfdctflt.bc emcc/jfdctfst.bc emcc/jfdctint.bc emcc/jidctflt.bc emcc/jidctfst.bc emcc/jidctint.bc emcc/jidctred.bc emcc/jmemmgr.bc emcc/jmemnobs.bc emcc/jquant1.bc emcc/jquant2.bc emcc/jutils.bc emcc/jass.bc emcc/detect.bc emcc/common.bc -o ArchiveLoader.js -s EXPORT_NAME="ArchiveLoader" -O3 -s WASM=1 -s MODULARIZE=1 -s EXPORTED_FUNCTIONS="['_malloc', '_free']" --post-js ./module-post.js -s ALLOW_MEMORY_GROWTH=1 -s TOTAL_MEMORY=33554432
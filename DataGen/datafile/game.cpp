@@ -1,9 +1,137 @@
 #include "game.h"
 
-void GameData::load(FileLoader& loader, int flags)
+namespace {
+
+char const* const unitSLK[] = {
+  "Units\\UnitAbilities.slk",
+  "Units\\UnitBalance.slk",
+  "Units\\UnitData.slk",
+  "Units\\unitUI.slk",
+  "Units\\UnitWeapons.slk",
+};
+char const* const unitINI[] = {
+  "Units\\UndeadUnitStrings.txt",
+  "Units\\UndeadUnitFunc.txt",
+  "Units\\OrcUnitStrings.txt",
+  "Units\\OrcUnitFunc.txt",
+  "Units\\NightElfUnitStrings.txt",
+  "Units\\NightElfUnitFunc.txt",
+  "Units\\NeutralUnitStrings.txt",
+  "Units\\NeutralUnitFunc.txt",
+  "Units\\HumanUnitStrings.txt",
+  "Units\\HumanUnitFunc.txt",
+  "Units\\CampaignUnitStrings.txt",
+  "Units\\CampaignUnitFunc.txt",
+};
+char const* const itemINI[] = {
+  "Units\\ItemFunc.txt",
+  "Units\\ItemStrings.txt",
+};
+char const* const abilityINI[] = {
+  "Units\\UndeadAbilityFunc.txt",
+  "Units\\UndeadAbilityStrings.txt",
+  "Units\\CampaignAbilityFunc.txt",
+  "Units\\CampaignAbilityStrings.txt",
+  "Units\\CommonAbilityFunc.txt",
+  "Units\\CommonAbilityStrings.txt",
+  "Units\\HumanAbilityFunc.txt",
+  "Units\\HumanAbilityStrings.txt",
+  "Units\\ItemAbilityFunc.txt",
+  "Units\\ItemAbilityStrings.txt",
+  "Units\\NeutralAbilityFunc.txt",
+  "Units\\NeutralAbilityStrings.txt",
+  "Units\\NightElfAbilityFunc.txt",
+  "Units\\NightElfAbilityStrings.txt",
+  "Units\\OrcAbilityFunc.txt",
+  "Units\\OrcAbilityStrings.txt",
+};
+char const* const upgradeINI[] = {
+  "Units\\NightElfUpgradeFunc.txt",
+  "Units\\NightElfUpgradeStrings.txt",
+  "Units\\OrcUpgradeFunc.txt",
+  "Units\\OrcUpgradeStrings.txt",
+  "Units\\UndeadUpgradeFunc.txt",
+  "Units\\UndeadUpgradeStrings.txt",
+  "Units\\CampaignUpgradeFunc.txt",
+  "Units\\NeutralUpgradeFunc.txt",
+  "Units\\CampaignUpgradeStrings.txt",
+  "Units\\NeutralUpgradeStrings.txt",
+  "Units\\HumanUpgradeFunc.txt",
+  "Units\\HumanUpgradeStrings.txt",
+};
+
+template<size_t N>
+void addFiles(std::vector<std::string>& list, char const* const (&files)[N]) {
+  list.insert(list.end(), files, files + N);
+}
+
+}
+
+std::vector<std::string> GameData::files(int flags) {
+  std::vector<std::string> list;
+  if ((flags & LOAD_ALL) == 0) return list;
+
+  list.push_back("war3map.wts");
+  if (flags & (LOAD_DESTRUCTABLES | LOAD_DOODADS)) {
+    list.push_back("UI\\WorldEditGameStrings.txt");
+    if (!(flags & LOAD_NO_WEONLY)) {
+      list.push_back("UI\\WorldEditStrings.txt");
+    }
+  }
+  if (flags & LOAD_UNITS) {
+    addFiles(list, unitSLK);
+    addFiles(list, unitINI);
+    list.push_back("Units\\UnitMetaData.slk");
+    list.push_back("war3map.w3u");
+  }
+  if (flags & LOAD_ITEMS) {
+    list.push_back("Units\\ItemData.slk");
+    addFiles(list, itemINI);
+    list.push_back("Units\\UnitMetaData.slk");
+    list.push_back("war3map.w3t");
+  }
+  if (flags & LOAD_DESTRUCTABLES) {
+    list.push_back("Units\\DestructableData.slk");
+    list.push_back("Units\\DestructableMetaData.slk");
+    list.push_back("war3map.w3b");
+  }
+  if (flags & LOAD_DOODADS) {
+    list.push_back("Doodads\\Doodads.slk");
+    list.push_back("Doodads\\DoodadMetaData.slk");
+    list.push_back("war3map.w3d");
+  }
+  if (flags & LOAD_ABILITIES) {
+    list.push_back("Units\\AbilityData.slk");
+  }
+  if (flags & LOAD_BUFFS) {
+    list.push_back("Units\\AbilityBuffData.slk");
+  }
+  if (flags & (LOAD_ABILITIES | LOAD_BUFFS)) {
+    addFiles(list, abilityINI);
+  }
+  if (flags & LOAD_ABILITIES) {
+    list.push_back("Units\\AbilityMetaData.slk");
+    list.push_back("war3map.w3a");
+  }
+  if (flags & LOAD_BUFFS) {
+    list.push_back("Units\\AbilityBuffMetaData.slk");
+    list.push_back("war3map.w3h");
+  }
+  if (flags & LOAD_UPGRADES) {
+    list.push_back("Units\\UpgradeData.slk");
+    addFiles(list, upgradeINI);
+    list.push_back("Units\\UpgradeMetaData.slk");
+    list.push_back("war3map.w3q");
+  }
+  return list;
+}
+
+void GameData::load(FileLoader& source, int flags)
 {
   if ((flags & LOAD_ALL) == 0) return;
 
+  PrefetchLoader loader(source, files(flags));
+
   wts = WTSData(loader.load("war3map.wts"));
 
   if (flags & (LOAD_DESTRUCTABLES | LOAD_DOODADS)) {
@@ -23,23 +151,12 @@ void GameData::load(FileLoader& loader, int flags)
       dst = data[UNITS] = std::make_shared<ObjectData>();
     }
 
-    dst->readSLK(loader.load("Units\\UnitAbilities.slk"));
-    dst->readSLK(loader.load("Units\\UnitBalance.slk"));
-    dst->readSLK(loader.load("Units\\UnitData.slk"));
-    dst->readSLK(loader.load("Units\\unitUI.slk"));
-    dst->readSLK(loader.load("Units\\UnitWeapons.slk"));
-    dst->readINI(loader.load("Units\\UndeadUnitStrings.txt"));
-    dst->readINI(loader.load("Units\\UndeadUnitFunc.txt"));
-    dst->readINI(loader.load("Units\\OrcUnitStrings.txt"));
-    dst->readINI(loader.load("Units\\OrcUnitFunc.txt"));
-    dst->readINI(loader.load("Units\\NightElfUnitStrings.txt"));
-    dst->readINI(loader.load("Units\\NightElfUnitFunc.txt"));
-    dst->readINI(loader.load("Units\\NeutralUnitStrings.txt"));
-    dst->readINI(loader.load("Units\\NeutralUnitFunc.txt"));
-    dst->readINI(loader.load("Units\\HumanUnitStrings.txt"));
-    dst->readINI(loader.load("Units\\HumanUnitFunc.txt"));
-    dst->readINI(loader.load("Units\\CampaignUnitStrings.txt"));
-    dst->readINI(loader.load("Units\\CampaignUnitFunc.txt"));
+    for (char const* name : unitSLK) {
+      dst->readSLK(loader.load(name));
+    }
+    for (char const* name : unitINI) {
+      dst->readINI(loader.load(name));
+    }
 
     metaData[UNITS] = std::make_shared<MetaData>(loader.load("Units\\UnitMetaData.slk"));
     dst->readOBJ(loader.load("war3map.w3u"), metaData[UNITS].get(), false, &wts);
@@ -59,8 +176,9 @@ void GameData::load(FileLoader& loader, int flags)
     }
 
     dst->readSLK(loader.load("Units\\ItemData.slk"));
-    dst->readINI(loader.load("Units\\ItemFunc.txt"));
-    dst->readINI(loader.load("Units\\ItemStrings.txt"));
+    for (char const* name : itemINI) {
+      dst->readINI(loader.load(name));
+    }
 
     if (!metaData[ITEMS]) {
       metaData[ITEMS] = std::make_shared<MetaData>(loader.load("Units\\UnitMetaData.slk"));
@@ -132,22 +250,9 @@ void GameData::load(FileLoader& loader, int flags)
     }
 
     for (auto& dst : dstList) {
-      dst->readINI(loader.load("Units\\UndeadAbilityFunc.txt"), true);
-      dst->readINI(loader.load("Units\\UndeadAbilityStrings.txt"), true);
-      dst->readINI(loader.load("Units\\CampaignAbilityFunc.txt"), true);
-      dst->readINI(loader.load("Units\\CampaignAbilityStrings.txt"), true);
-      dst->readINI(loader.load("Units\\CommonAbilityFunc.txt"), true);
-      dst->readINI(loader.load("Units\\CommonAbilityStrings.txt"), true);
-      dst->readINI(loader.load("Units\\HumanAbilityFunc.txt"), true);
-      dst->readINI(loader.load("Units\\HumanAbilityStrings.txt"), true);
-      dst->readINI(loader.load("Units\\ItemAbilityFunc.txt"), true);
-      dst->readINI(loader.load("Units\\ItemAbilityStrings.txt"), true);
-      dst->readINI(loader.load("Units\\NeutralAbilityFunc.txt"), true);
-      dst->readINI(loader.load("Units\\NeutralAbilityStrings.txt"), true);
-      dst->readINI(loader.load("Units\\NightElfAbilityFunc.txt"), true);
-      dst->readINI(loader.load("Units\\NightElfAbilityStrings.txt"), true);
-      dst->readINI(loader.load("Units\\OrcAbilityFunc.txt"), true);
-      dst->readINI(loader.load("Units\\OrcAbilityStrings.txt"), true);
+      for (char const* name : abilityINI) {
+        dst->readINI(loader.load(name), true);
+      }
     }
 
     if (abilities) {
@@ -173,18 +278,9 @@ void GameData::load(FileLoader& loader, int flags)
     }
 
     dst->readSLK(loader.load("Units\\UpgradeData.slk"));
-    dst->readINI(loader.load("Units\\NightElfUpgradeFunc.txt"));
-    dst->readINI(loader.load("Units\\NightElfUpgradeStrings.txt"));
-    dst->readINI(loader.load("Units\\OrcUpgradeFunc.txt"));
-    dst->readINI(loader.load("Units\\OrcUpgradeStrings.txt"));
-    dst->readINI(loader.load("Units\\UndeadUpgradeFunc.txt"));
-    dst->readINI(loader.load("Units\\UndeadUpgradeStrings.txt"));
-    dst->readINI(loader.load("Units\\CampaignUpgradeFunc.txt"));
-    dst->readINI(loader.load("Units\\NeutralUpgradeFunc.txt"));
-    dst->readINI(loader.load("Units\\CampaignUpgradeStrings.txt"));
-    dst->readINI(loader.load("Units\\NeutralUpgradeStrings.txt"));
-    dst->readINI(loader.load("Units\\HumanUpgradeFunc.txt"));
-    dst->readINI(loader.load("Units\\HumanUpgradeStrings.txt"));
+    for (char const* name : upgradeINI) {
+      dst->readINI(loader.load(name));
+    }
     metaData[UPGRADES] = std::make_shared<MetaData>(loader.load("Units\\UpgradeMetaData.slk"));
     dst->readOBJ(loader.load("war3map.w3q"), metaData[UPGRADES].get(), true, &wts);
 
@@ -6,6 +6,9 @@ class GameData {
 public:
   void load(FileLoader& loader, int flags);
 
+  // files read by load() for the given flags
+  static std::vector<std::string> files(int flags);
+
   enum Type {
     UNITS,
     ITEMS,
@@ -73,42 +73,97 @@ bool ObjectData::readINI(File file, bool split) {
 
   UnitData* cur = NULL;
   bool ok = true;
-  std::string line;
-  while (ok && file.getline(line))
+  LineReader reader(file);
+  StringView line;
+  std::string value;
+  while (ok && reader.getline(line))
   {
     line = trim(line);
     if (line.size() > 0 && line[0] == '[') {
       if (line.size() <= 5 || line[5] != ']') {
         return true; // or false?
       } else {
-        cur = getUnitById(line.c_str() + 1);
+        cur = getUnitById(line.data() + 1);
       }
     } else if (cur && line.size() > 0 && line[0] != '/') {
       size_t eq = line.find('=');
-      if (eq != std::string::npos) {
-        setUnitData(cur, line.substr(0, eq), translate_(line.c_str() + eq + 1));
+      if (eq != StringView::npos) {
+        value.assign(line.data() + eq + 1, line.size() - eq - 1);
+        setUnitData(cur, line.substr(0, eq).str(), translate_(value.c_str()));
       }
     }
   }
   return true;
 }
 
+namespace {
+
+// Reads through the File calls themselves, the way readOBJ did before ByteReader
+class FileReader {
+public:
+  FileReader(File file)
+    : file_(file)
+    , end_(file.size())
+  {}
+
+  size_t left() {
+    return (size_t) (end_ - file_.tell());
+  }
+  void seek(size_t pos) {
+    file_.seek(pos, SEEK_SET);
+  }
+  template<class T>
+  T read() {
+    return file_.read<T>();
+  }
+  uint32 read32(bool big = false) {
+    return file_.read32(big);
+  }
+  StringView readString() {
+    string_.clear();
+    while (int chr = file_.getc()) {
+      if (chr == EOF) break;
+      string_.push_back((char) chr);
+    }
+    return StringView(string_.data(), string_.size());
+  }
+
+private:
+  File file_;
+  uint64 end_;
+  std::string string_;
+};
+
+}
+
 bool ObjectData::readOBJ(File file, MetaData* meta, bool ext, WTSData* wts) {
   if (!file || !meta || !meta->valid()) {
     return false;
   }
+  ByteReader reader(file);
+  return readOBJ_(reader, meta, ext, wts);
+}
 
-  uint64 end = file.size();
-  file.seek(4, SEEK_SET);
-  for (int tbl = 0; tbl < 2 && end - file.tell() >= 4; tbl++) {
-    uint32 count = file.read32();
+bool ObjectData::readOBJFile(File file, MetaData* meta, bool ext, WTSData* wts) {
+  if (!file || !meta || !meta->valid()) {
+    return false;
+  }
+  FileReader reader(file);
+  return readOBJ_(reader, meta, ext, wts);
+}
+
+template<class Reader>
+bool ObjectData::readOBJ_(Reader& reader, MetaData* meta, bool ext, WTSData* wts) {
+  reader.seek(4);
+  for (int tbl = 0; tbl < 2 && reader.left() >= 4; tbl++) {
+    uint32 count = reader.read32();
     if (count > 5000) {
       return false;
     }
-    for (uint32 i = 0; i < count && end - file.tell() >= 12; i++) {
-      uint32 oldid = file.read32(true);
-      uint32 newid = file.read32(true);
-      uint32 count = file.read32();
+    for (uint32 i = 0; i < count && reader.left() >= 12; i++) {
+      uint32 oldid = reader.read32(true);
+      uint32 newid = reader.read32(true);
+      uint32 count = reader.read32();
       if (count > 500) {
         return false;
       }
@@ -122,9 +177,9 @@ bool ObjectData::readOBJ(File file, MetaData* meta, bool ext, WTSData* wts) {
           unit = units_[it->second].get();
         }
       }
-      for (uint32 j = 0; j < count && end - file.tell() >= 8; j++) {
-        uint32 modid = file.read32(true);
-        uint32 type = file.read32();
+      for (uint32 j = 0; j < count && reader.left() >= 8; j++) {
+        uint32 modid = reader.read32(true);
+        uint32 type = reader.read32();
         int index;
         char const* mod_c = meta->value(modid, &index);
         if (!mod_c || type > 3) {
@@ -132,8 +187,8 @@ bool ObjectData::readOBJ(File file, MetaData* meta, bool ext, WTSData* wts) {
         }
         std::string mod = mod_c;
         if (ext) {
-          uint32 level = file.read32();
-          uint32 data = file.read32();
+          uint32 level = reader.read32();
+          uint32 data = reader.read32();
           if (mod == "Data") {
             mod.push_back(char('A' + data - 1));
           }
@@ -147,12 +202,10 @@ bool ObjectData::readOBJ(File file, MetaData* meta, bool ext, WTSData* wts) {
         }
         std::string value;
         if (type == 0) {
-          value = std::to_string(file.read32());
+          value = std::to_string(reader.read32());
         } else if (type == 3) {
-          while (int chr = file.getc()) {
-            if (chr == EOF) break;
-            value.push_back((char)chr);
-          }
+          StringView str = reader.readString();
+          value.assign(str.data(), str.size());
           if (wts && !strncmp(value.c_str(), "TRIGSTR_", 8)) {
             char const* rep = wts->get(atoi(value.c_str() + 8));
             if (rep) {
@@ -160,12 +213,12 @@ bool ObjectData::readOBJ(File file, MetaData* meta, bool ext, WTSData* wts) {
             }
           }
         } else {
-          value = fmtstring("%.2f", file.read<float>());
+          value = fmtstring("%.2f", reader.template read<float>());
         }
         if (unit) {
           setUnitData(unit, mod, translate_(value.c_str()), index);
         }
-        uint32 suf = file.read32(true);
+        uint32 suf = reader.read32(true);
         if (suf != 0 && suf != newid && suf != oldid) {
           //return false;
         }
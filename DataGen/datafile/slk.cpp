@@ -49,6 +49,108 @@ SLKFile::SLKFile(File file)
 
   if (!file) return;
 
+  // Single pass over a private copy of the file: values are terminated in place and
+  // referenced by offset, so nothing is copied per cell. Cells are collected in file
+  // order and laid out once the dimensions from the B record are known.
+  size_t size = (size_t) file.size();
+  buffer_.resize(size + 2, 0);
+  file.seek(0, SEEK_SET);
+  size = file.read(&buffer_[1], size);
+
+  struct Cell {
+    int x;
+    int y;
+    size_t pos;
+  };
+  std::vector<Cell> cells;
+
+  char* base = &buffer_[0];
+  char* ptr = base + 1;
+  char* end = ptr + size;
+  int curx = 0;
+  int cury = 0;
+  while (ptr < end) {
+    char* line = ptr;
+    while (ptr < end && *ptr != '\r' && *ptr != '\n') {
+      ++ptr;
+    }
+    char* eol = ptr;
+    if (ptr < end && *ptr++ == '\r' && ptr < end && *ptr == '\n') {
+      ++ptr;
+    }
+    while (line < eol && isspace((unsigned char) *line)) ++line;
+    while (eol > line && isspace((unsigned char) eol[-1])) --eol;
+    *eol = 0;
+
+    char* cur = line;
+    while (*cur && *cur != ';') {
+      ++cur;
+    }
+    char type = (cur - line == 1 ? *line : 0);
+    if (type != 'B' && type != 'C' && type != 'F') {
+      continue;
+    }
+
+    char delim = *cur;
+    while (delim == ';') {
+      char field = *++cur;
+      if (!field) break;
+      char* val = ++cur;
+      char* valEnd;
+      if (*cur == '"') {
+        val = ++cur;
+        while (*cur && *cur != '"') ++cur;
+        valEnd = cur;
+        while (*cur && *cur != ';') ++cur;
+      } else {
+        while (*cur && *cur != ';') ++cur;
+        valEnd = cur;
+      }
+      delim = *cur;
+      *valEnd = 0;
+
+      if (type == 'B') {
+        if (field == 'X') {
+          width_ = atoi(val);
+        } else if (field == 'Y') {
+          height_ = atoi(val);
+        }
+      } else if (field == 'X') {
+        curx = atoi(val) - 1;
+      } else if (field == 'Y') {
+        cury = atoi(val) - 1;
+      } else if (field == 'K' && type == 'C') {
+        Cell cell;
+        cell.x = curx;
+        cell.y = cury;
+        cell.pos = val - base;
+        cells.push_back(cell);
+      }
+    }
+  }
+
+  if (!width_ || !height_) {
+    buffer_.resize(1);
+    return;
+  }
+
+  table_.resize(width_ * height_, 0);
+  for (auto const& cell : cells) {
+    if (cell.x >= 0 && cell.x < (int)width_ && cell.y >= 0 && cell.y < (int)height_) {
+      if (cell.y == 0) {
+        cols_[buffer_.data() + cell.pos] = cell.x;
+      }
+      table_[cell.x + cell.y * width_] = cell.pos;
+    }
+  }
+}
+
+SLKFile SLKFile::fromLines(File file) {
+  SLKFile slk;
+  slk.buffer_.push_back(0);
+
+  if (!file) return slk;
+
   std::string line;
   SLKEntry e;
 
@@ -59,20 +161,20 @@ SLKFile::SLKFile(File file)
     if (e.val == "B") {
       while ((cur = SLKReadEntry(cur, e))) {
         if (e.type == 'X') {
-          width_ = stoi(e.val);
+          slk.width_ = stoi(e.val);
         } else if (e.type == 'Y') {
-          height_ = stoi(e.val);
+          slk.height_ = stoi(e.val);
         }
       }
     }
   }
 
-  if (!width_ || !height_) {
-    return;
+  if (!slk.width_ || !slk.height_) {
+    return slk;
   }
 
   file.seek(0, SEEK_SET);
-  table_.resize(width_ * height_, 0);
+  slk.table_.resize(slk.width_ * slk.height_, 0);
   int curx = 0;
   int cury = 0;
   while (file.getline(line)) {
@@ -85,13 +187,13 @@ SLKFile::SLKFile(File file)
         } else if (e.type == 'Y') {
           cury = stoi(e.val) - 1;
         } else if (e.type == 'K') {
-          if (curx >= 0 && curx < (int)width_ && cury >= 0 && cury < (int)height_) {
+          if (curx >= 0 && curx < (int)slk.width_ && cury >= 0 && cury < (int)slk.height_) {
             if (cury == 0) {
-              cols_[e.val] = curx;
+              slk.cols_[e.val] = curx;
             }
-            table_[curx + cury * width_] = buffer_.size();
-            buffer_.append(e.val);
-            buffer_.push_back(0);
+            slk.table_[curx + cury * slk.width_] = slk.buffer_.size();
+            slk.buffer_.append(e.val);
+            slk.buffer_.push_back(0);
           }
         }
       }
@@ -105,6 +207,7 @@ SLKFile::SLKFile(File file)
       }
     }
   }
+  return slk;
 }
 
 void SLKFile::csv(File out) const {
@@ -136,3 +239,18 @@ void SLKFile::csv(File out) const {
     out.putc('\n');
   }
 }
+
+bool SLKFile::same(SLKFile const& rhs) const {
+  if (width_ != rhs.width_ || height_ != rhs.height_ || cols_ != rhs.cols_) {
+    return false;
+  }
+  for (size_t i = 0; i < table_.size(); ++i) {
+    if ((table_[i] != 0) != (rhs.table_[i] != 0)) {
+      return false;
+    }
+    if (strcmp(buffer_.data() + table_[i], rhs.buffer_.data() + rhs.table_[i])) {
+      return false;
+    }
+  }
+  return true;
+}
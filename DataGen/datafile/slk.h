@@ -7,6 +7,10 @@ class SLKFile {
 public:
   SLKFile(File file);
 
+  // original line-based parser, kept as a reference for validating SLKFile(File)
+  static SLKFile fromLines(File file);
+  bool same(SLKFile const& rhs) const;
+
   bool valid() const
   {
     return height_ > 0;
@@ -41,6 +45,11 @@ public:
   void csv(File out) const;
 
 private:
+  SLKFile()
+    : width_(0)
+    , height_(0)
+  {}
+
   std::unordered_map<std::string, int> cols_;
   std::string buffer_;
   std::vector<size_t> table_;
@@ -9,15 +9,15 @@ void WEStrings::merge(File file) {
     file.seek(0, SEEK_SET);
   }
 
-  std::string line;
-  while (file.getline(line)) {
+  LineReader reader(file);
+  StringView line;
+  while (reader.getline(line)) {
     line = trim(line);
     size_t eq = line.find('=');
-    if (eq != std::string::npos) {
-      std::string left = line.substr(0, eq);
-      std::string right = line.substr(eq + 1);
-      strings_[left] = buffer_.size();
-      buffer_.append(right);
+    if (eq != StringView::npos) {
+      StringView right = line.substr(eq + 1);
+      strings_[line.substr(0, eq).str()] = buffer_.size();
+      buffer_.append(right.data(), right.size());
       buffer_.push_back(0);
     }
   }
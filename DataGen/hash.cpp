@@ -1,4 +1,5 @@
 #include "hash.h"
+#include "utils/parallel.h"
 
 File& HashArchive::create(char const* name, bool compression) {
   uint64 id = pathHash(name);
@@ -15,3 +16,14 @@ void HashArchive::add(char const* name, File file, bool compression) {
   }
   Archive::add(id, file, compression);
 }
+
+std::vector<std::future<File>> HashArchive::loadMany(std::vector<std::string> const& paths) {
+  // entries are independent, so the batch can be decompressed in parallel
+  return splitBatch(run_async([this, paths]() {
+    std::vector<File> files(paths.size());
+    parallel_for(paths.size(), [&](size_t i) {
+      files[i] = open(paths[i].c_str());
+    });
+    return files;
+  }), paths.size());
+}
@@ -35,6 +35,10 @@ public:
   File load(char const* path) {
     return open(path);
   }
+  std::vector<std::future<File>> loadMany(std::vector<std::string> const& paths) override;
+  FileLoader* resolve(std::string& path) override {
+    return has(path.c_str()) ? this : nullptr;
+  }
 
   using Archive::add;
   void add(char const* name, File file, bool compression = false);
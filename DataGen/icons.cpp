@@ -1,29 +1,44 @@
 #include "icons.h"
-#include "rmpq/common.h"
-#include "hash.h"
+#include "utils/common.h"
+#include "utils/parallel.h"
 
 void ImageStorage::add(uint64 hash, Image image) {
-  hashes_.push_back(hash);
-  image = image.resize(width_, height_);
-  if (!current_) {
-    current_ = Image(width_ * cols_, height_ * rows_);
-    x_ = 0;
-    y_ = 0;
-  }
-  current_.blt(x_ * width_, y_ * height_, image);
-  x_ += 1;
-  if (x_ >= cols_) {
-    x_ = 0;
-    y_ += 1;
-  }
-  if (y_ >= rows_) {
-    flush();
+  // every cell is resampled once, straight from the decoded image, and only the cells are kept
+  std::vector<Image> cells;
+  for (uint32 size : sizes_) {
+    cells.push_back(image.resize(size, size));
   }
+  images_.emplace_back(hash, std::move(cells));
 }
 
-void ImageStorage::flush() {
-  if (current_) {
-    current_.write(fmtstring("icons%u.png", id_++));
-    current_ = Image();
+void ImageStorage::write(File table) {
+  // the first image added under a hash wins
+  std::stable_sort(images_.begin(), images_.end(), [](Icon const& lhs, Icon const& rhs) {
+    return lhs.first < rhs.first;
+  });
+  images_.erase(std::unique(images_.begin(), images_.end(), [](Icon const& lhs, Icon const& rhs) {
+    return lhs.first == rhs.first;
+  }), images_.end());
+
+  IconTable icons(sizes_, columns_, rows_);
+  std::vector<IconTable::Cell> cells;
+  for (auto const& image : images_) {
+    cells.push_back(icons.add(image.first));
   }
+
+  size_t perSheet = columns_ * rows_;
+  size_t sheets = (images_.size() + perSheet - 1) / perSheet;
+  parallel_for(sheets * sizes_.size(), [&](size_t task) {
+    size_t sheet = task / sizes_.size();
+    size_t level = task % sizes_.size();
+    int size = sizes_[level];
+    Image result(size * columns_, size * rows_);
+    for (size_t i = sheet * perSheet; i < images_.size() && i < (sheet + 1) * perSheet; ++i) {
+      result.blt(cells[i].column * size, cells[i].row * size, images_[i].second[level]);
+    }
+    result.write(fmtstring("icons%u_%d.png", (uint32) sheet, size));
+  });
+
+  icons.write(table);
+  images_.clear();
 }
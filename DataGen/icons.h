@@ -1,34 +1,36 @@
 #pragma once
 
 #include "image/image.h"
+#include "icontable.h"
 
+// Packs icons into sheets of columns x rows square cells, one set of sheets for every cell
+// size, written as icons<sheet>_<size>.png along with the table that locates them (see
+// IconTable). The cells are assigned in order of path hash once all icons are added, so
+// the output does not depend on the order they were found in.
 class ImageStorage {
 public:
-  ImageStorage(int width, int height, int rows, int cols)
-    : width_(width)
-    , height_(height)
+  ImageStorage(std::vector<uint32> const& sizes, uint32 columns, uint32 rows)
+    : sizes_(sizes)
+    , columns_(columns)
     , rows_(rows)
-    , cols_(cols)
   {}
-  ~ImageStorage() {
-    flush();
-  }
 
   void add(uint64 hash, Image image);
 
-  void flush();
+  // writes the sheets, several at a time, and the table
+  void write(File table);
 
-  void writeHashes(File file) {
-    file.write(hashes_.data(), hashes_.size() * sizeof(uint64));
+  // decodes mipmapped textures at the smallest level that still covers the largest cell
+  ImageDecodeOptions options() const {
+    uint32 size = *std::max_element(sizes_.begin(), sizes_.end());
+    return ImageDecodeOptions(size, size);
   }
 
 private:
-  int width_;
-  int height_;
-  int rows_;
-  int cols_;
-  uint32 id_ = 1000;
-  Image current_;
-  int x_, y_;
-  std::vector<uint64> hashes_;
+  std::vector<uint32> sizes_;
+  uint32 columns_;
+  uint32 rows_;
+  // path hash and the cells of an icon, one for every size
+  typedef std::pair<uint64, std::vector<Image>> Icon;
+  std::vector<Icon> images_;
 };
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "utils/file.h"
+#include <algorithm>
+#include <vector>
+
+// Locates icons in the sheets written by ImageStorage (images.dat). Icons are placed in order of
+// their path hash, and every cell size uses the same layout, so a cell is given in cells rather
+// than pixels. The file holds
+//   uint32 signature ('ICO2'), count, columns, rows, number of cell sizes, cell sizes
+//   uint64 hashes[count], in ascending order
+//   uint32 cells[count], sheet << 16 | row << 8 | column
+// Kept apart from icons.h so the map parser can read it without the image code.
+class IconTable {
+public:
+  static const uint32 signature = '2OCI';
+
+  struct Cell {
+    uint32 sheet;
+    uint32 column;
+    uint32 row;
+  };
+
+  IconTable()
+    : columns_(0)
+    , rows_(0)
+  {}
+  IconTable(std::vector<uint32> const& sizes, uint32 columns, uint32 rows)
+    : columns_(columns)
+    , rows_(rows)
+    , sizes_(sizes)
+  {}
+  explicit IconTable(File file)
+    : columns_(0)
+    , rows_(0)
+  {
+    read(file);
+  }
+
+  bool read(File file) {
+    hashes_.clear();
+    cells_.clear();
+    sizes_.clear();
+    if (!file || file.read32() != signature) return false;
+    uint32 count = file.read32();
+    columns_ = file.read32();
+    rows_ = file.read32();
+    uint32 sizes = file.read32();
+    if (sizes > 16 || uint64(count) * 12 > file.size()) {
+      return false;
+    }
+    sizes_.resize(sizes);
+    hashes_.resize(count);
+    cells_.resize(count);
+    file.read(sizes_.data(), sizes_.size() * sizeof(uint32));
+    file.read(hashes_.data(), count * sizeof(uint64));
+    return file.read(cells_.data(), count * sizeof(uint32)) == count * sizeof(uint32);
+  }
+  void write(File file) const {
+    file.write32(signature);
+    file.write32(static_cast<uint32>(hashes_.size()));
+    file.write32(columns_);
+    file.write32(rows_);
+    file.write32(static_cast<uint32>(sizes_.size()));
+    file.write(sizes_.data(), sizes_.size() * sizeof(uint32));
+    file.write(hashes_.data(), hashes_.size() * sizeof(uint64));
+    file.write(cells_.data(), cells_.size() * sizeof(uint32));
+  }
+
+  // the next cell in order; hashes must be added in ascending order
+  Cell add(uint64 hash) {
+    uint32 index = static_cast<uint32>(hashes_.size());
+    uint32 perSheet = columns_ * rows_;
+    Cell cell = {index / perSheet, index % columns_, index % perSheet / columns_};
+    hashes_.push_back(hash);
+    cells_.push_back((cell.sheet << 16) | (cell.row << 8) | cell.column);
+    return cell;
+  }
+
+  bool find(uint64 hash, Cell* cell = nullptr) const {
+    auto it = std::lower_bound(hashes_.begin(), hashes_.end(), hash);
+    if (it == hashes_.end() || *it != hash) return false;
+    if (cell) {
+      uint32 value = cells_[it - hashes_.begin()];
+      cell->sheet = value >> 16;
+      cell->row = (value >> 8) & 0xFF;
+      cell->column = value & 0xFF;
+    }
+    return true;
+  }
+
+  size_t size() const {
+    return hashes_.size();
+  }
+  uint32 columns() const {
+    return columns_;
+  }
+  uint32 rows() const {
+    return rows_;
+  }
+  std::vector<uint32> const& sizes() const {
+    return sizes_;
+  }
+
+private:
+  uint32 columns_;
+  uint32 rows_;
+  std::vector<uint32> sizes_;
+  std::vector<uint64> hashes_;
+  std::vector<uint32> cells_;
+};
@@ -0,0 +1,203 @@
+#include "image.h"
+#include "utils/simd.h"
+
+namespace ImagePrivate {
+
+  namespace {
+
+    bool useSimd = true;
+
+    // x / 255 rounded down, exact for x <= 255 * 255
+    inline uint32 div255(uint32 x) {
+      x += 1;
+      return (x + (x >> 8)) >> 8;
+    }
+
+    // Color::blend and Color::modulate for one ARGB8888 pixel
+    inline uint32 blend_pixel(uint32 dst, uint32 src) {
+      uint32 alpha = src >> 24;
+      if (alpha == 255) return src;
+      if (alpha == 0) return dst;
+      uint32 result = 0;
+      for (int shift = 0; shift < 32; shift += 8) {
+        result |= div255(((dst >> shift) & 0xFF) * (255 - alpha) + ((src >> shift) & 0xFF) * alpha) << shift;
+      }
+      return result;
+    }
+    inline uint32 modulate_pixel(uint32 lhs, uint32 rhs) {
+      uint32 result = 0;
+      for (int shift = 0; shift < 32; shift += 8) {
+        result |= div255(((lhs >> shift) & 0xFF) * ((rhs >> shift) & 0xFF)) << shift;
+      }
+      return result;
+    }
+
+    bool is_opaque(uint32 const* src, int count) {
+      uint32 all = 0xFF000000;
+      for (int i = 0; i < count; ++i) {
+        all &= src[i];
+      }
+      return all == 0xFF000000;
+    }
+
+    void blend_scalar(uint32* dst, uint32 const* src, int count) {
+      for (int i = 0; i < count; ++i) {
+        dst[i] = blend_pixel(dst[i], src[i]);
+      }
+    }
+    void modulate_scalar(uint32* dst, uint32 color, int count) {
+      for (int i = 0; i < count; ++i) {
+        dst[i] = modulate_pixel(dst[i], color);
+      }
+    }
+
+    // The vector kernels work on four pixels at a time, widened to 16 bits per channel; the
+    // products stay below 65536, so the same division by 255 is exact there too. Blocks of four
+    // opaque or four transparent source pixels are copied or skipped.
+
+#ifdef SIMD_X86
+    SIMD_TARGET("ssse3")
+    inline __m128i div255_ssse3(__m128i x) {
+      x = _mm_add_epi16(x, _mm_set1_epi16(1));
+      return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+    }
+    SIMD_TARGET("ssse3")
+    inline __m128i mix_ssse3(__m128i dst, __m128i src, __m128i alpha) {
+      __m128i inverse = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+      return div255_ssse3(_mm_add_epi16(_mm_mullo_epi16(dst, inverse), _mm_mullo_epi16(src, alpha)));
+    }
+
+    SIMD_TARGET("ssse3")
+    void blend_ssse3(uint32* dst, uint32 const* src, int count) {
+      __m128i const zero = _mm_setzero_si128();
+      __m128i const alphaMask = _mm_set1_epi32(int(0xFF000000));
+      __m128i const alphaLo = _mm_setr_epi8(3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1);
+      __m128i const alphaHi = _mm_setr_epi8(11, -1, 11, -1, 11, -1, 11, -1, 15, -1, 15, -1, 15, -1, 15, -1);
+      int i = 0;
+      for (; i + 4 <= count; i += 4) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + i));
+        __m128i alpha = _mm_and_si128(s, alphaMask);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, alphaMask)) == 0xFFFF) {
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), s);
+          continue;
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, zero)) == 0xFFFF) {
+          continue;
+        }
+        __m128i d = _mm_loadu_si128(reinterpret_cast<__m128i const*>(dst + i));
+        __m128i lo = mix_ssse3(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero), _mm_shuffle_epi8(s, alphaLo));
+        __m128i hi = mix_ssse3(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero), _mm_shuffle_epi8(s, alphaHi));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+      }
+      blend_scalar(dst + i, src + i, count - i);
+    }
+
+    SIMD_TARGET("ssse3")
+    void modulate_ssse3(uint32* dst, uint32 color, int count) {
+      __m128i const zero = _mm_setzero_si128();
+      __m128i const factor = _mm_unpacklo_epi8(_mm_set1_epi32(int(color)), zero);
+      int i = 0;
+      for (; i + 4 <= count; i += 4) {
+        __m128i d = _mm_loadu_si128(reinterpret_cast<__m128i const*>(dst + i));
+        __m128i lo = div255_ssse3(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), factor));
+        __m128i hi = div255_ssse3(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), factor));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+      }
+      modulate_scalar(dst + i, color, count - i);
+    }
+#endif
+
+#ifdef SIMD_WASM
+    inline v128_t div255_wasm(v128_t x) {
+      x = wasm_i16x8_add(x, wasm_i16x8_splat(1));
+      return wasm_u16x8_shr(wasm_i16x8_add(x, wasm_u16x8_shr(x, 8)), 8);
+    }
+    inline v128_t mix_wasm(v128_t dst, v128_t src, v128_t alpha) {
+      v128_t inverse = wasm_i16x8_sub(wasm_i16x8_splat(255), alpha);
+      return div255_wasm(wasm_i16x8_add(wasm_i16x8_mul(dst, inverse), wasm_i16x8_mul(src, alpha)));
+    }
+
+    void blend_wasm(uint32* dst, uint32 const* src, int count) {
+      v128_t const zero = wasm_i32x4_splat(0);
+      v128_t const alphaMask = wasm_i32x4_splat(int(0xFF000000));
+      v128_t const alphaLo = wasm_i8x16_make(3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1);
+      v128_t const alphaHi = wasm_i8x16_make(11, -1, 11, -1, 11, -1, 11, -1, 15, -1, 15, -1, 15, -1, 15, -1);
+      int i = 0;
+      for (; i + 4 <= count; i += 4) {
+        v128_t s = wasm_v128_load(src + i);
+        v128_t alpha = wasm_v128_and(s, alphaMask);
+        if (wasm_i32x4_all_true(wasm_i32x4_eq(alpha, alphaMask))) {
+          wasm_v128_store(dst + i, s);
+          continue;
+        }
+        if (wasm_i32x4_all_true(wasm_i32x4_eq(alpha, zero))) {
+          continue;
+        }
+        v128_t d = wasm_v128_load(dst + i);
+        v128_t lo = mix_wasm(wasm_u16x8_extend_low_u8x16(d), wasm_u16x8_extend_low_u8x16(s), wasm_i8x16_swizzle(s, alphaLo));
+        v128_t hi = mix_wasm(wasm_u16x8_extend_high_u8x16(d), wasm_u16x8_extend_high_u8x16(s), wasm_i8x16_swizzle(s, alphaHi));
+        wasm_v128_store(dst + i, wasm_u8x16_narrow_i16x8(lo, hi));
+      }
+      blend_scalar(dst + i, src + i, count - i);
+    }
+
+    void modulate_wasm(uint32* dst, uint32 color, int count) {
+      v128_t const factor = wasm_u16x8_extend_low_u8x16(wasm_i32x4_splat(int(color)));
+      int i = 0;
+      for (; i + 4 <= count; i += 4) {
+        v128_t d = wasm_v128_load(dst + i);
+        v128_t lo = div255_wasm(wasm_i16x8_mul(wasm_u16x8_extend_low_u8x16(d), factor));
+        v128_t hi = div255_wasm(wasm_i16x8_mul(wasm_u16x8_extend_high_u8x16(d), factor));
+        wasm_v128_store(dst + i, wasm_u8x16_narrow_i16x8(lo, hi));
+      }
+      modulate_scalar(dst + i, color, count - i);
+    }
+#endif
+
+  }
+
+  void blendRow(Color::Default* dst, Color::Default const* src, int count) {
+    uint32* out = reinterpret_cast<uint32*>(dst);
+    uint32 const* in = reinterpret_cast<uint32 const*>(src);
+    // most sprites and every icon are fully opaque
+    if (is_opaque(in, count)) {
+      memcpy(out, in, sizeof(uint32) * count);
+      return;
+    }
+#ifdef SIMD_X86
+    if (useSimd && Simd::hasSSSE3()) {
+      blend_ssse3(out, in, count);
+      return;
+    }
+#endif
+#ifdef SIMD_WASM
+    if (useSimd) {
+      blend_wasm(out, in, count);
+      return;
+    }
+#endif
+    blend_scalar(out, in, count);
+  }
+
+  void modulateRow(Color::Default* dst, Color::Default color, int count) {
+    uint32* out = reinterpret_cast<uint32*>(dst);
+#ifdef SIMD_X86
+    if (useSimd && Simd::hasSSSE3()) {
+      modulate_ssse3(out, color, count);
+      return;
+    }
+#endif
+#ifdef SIMD_WASM
+    if (useSimd) {
+      modulate_wasm(out, color, count);
+      return;
+    }
+#endif
+    modulate_scalar(out, color, count);
+  }
+
+}
+
+void setBlendSimd(bool enabled) {
+  ImagePrivate::useSimd = enabled;
+}
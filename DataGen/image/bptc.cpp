@@ -0,0 +1,476 @@
+#include "bptc.h"
+#include "utils/parallel.h"
+
+namespace BPTC {
+
+  namespace {
+
+    bool useThreads = true;
+    // images with fewer blocks are decoded on the calling thread
+    const size_t PARALLEL_BLOCKS = 4096;
+
+    // subset of each texel (bit i) for the two-subset partitions
+    const uint16 partitions2[64] = {
+      0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80,
+      0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8, 0xFF00, 0xFFF0, 0xF000,
+      0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE,
+      0x088C, 0x3110, 0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C,
+      0xAAAA, 0xF0F0, 0x5A5A, 0x33CC, 0x3C3C, 0x55AA, 0x9696, 0xA55A,
+      0x73CE, 0x13C8, 0x324C, 0x3BDC, 0x6996, 0xC33C, 0x9966, 0x0660,
+      0x0272, 0x04E4, 0x4E40, 0x2720, 0xC936, 0x936C, 0x39C6, 0x639C,
+      0x9336, 0x9CC6, 0x817E, 0xE718, 0xCCF0, 0x0FCC, 0x7744, 0xEE22,
+    };
+    // subset of each texel (bits 2i, 2i+1) for the three-subset partitions
+    const uint32 partitions3[64] = {
+      0xAA685050, 0x6A5A5040, 0x5A5A4200, 0x5450A0A8,
+      0xA5A50000, 0xA0A05050, 0x5555A0A0, 0x5A5A5050,
+      0xAA550000, 0xAA555500, 0xAAAA5500, 0x90909090,
+      0x94949494, 0xA4A4A4A4, 0xA9A59450, 0x2A0A4250,
+      0xA5945040, 0x0A425054, 0xA5A5A500, 0x55A0A0A0,
+      0xA8A85454, 0x6A6A4040, 0xA4A45000, 0x1A1A0500,
+      0x0050A4A4, 0xAAA59090, 0x14696914, 0x69691400,
+      0xA08585A0, 0xAA821414, 0x50A4A450, 0x6A5A0200,
+      0xA9A58000, 0x5090A0A8, 0xA8A09050, 0x24242424,
+      0x00AA5500, 0x24924924, 0x24499224, 0x50A50A50,
+      0x500AA550, 0xAAAA4444, 0x66660000, 0xA5A0A5A0,
+      0x50A050A0, 0x69286928, 0x44AAAA44, 0x66666600,
+      0xAA444444, 0x54A854A8, 0x95809580, 0x96969600,
+      0xA85454A8, 0x80959580, 0xAA141414, 0x96960000,
+      0xAAAA1414, 0xA05050A0, 0xA0A5A5A0, 0x96000000,
+      0x40804080, 0xA9A8A9A8, 0xAAAAAA44, 0x2A4A5254,
+    };
+    // texels whose index is stored with one bit less: subset 1 of two, subsets 1 and 2 of three
+    const uint8 anchors2[64] = {
+      15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+      15, 2, 8, 2, 2, 8, 8, 15, 2, 8, 2, 2, 8, 8, 2, 2,
+      15, 15, 6, 8, 2, 8, 15, 15, 2, 8, 2, 2, 2, 15, 15, 6,
+      6, 2, 6, 8, 15, 15, 2, 2, 15, 15, 15, 15, 15, 2, 2, 15,
+    };
+    const uint8 anchors3a[64] = {
+      3, 3, 15, 15, 8, 3, 15, 15, 8, 8, 6, 6, 6, 5, 3, 3,
+      3, 3, 8, 15, 3, 3, 6, 10, 5, 8, 8, 6, 8, 5, 15, 15,
+      8, 15, 3, 5, 6, 10, 8, 15, 15, 3, 15, 5, 15, 15, 15, 15,
+      3, 15, 5, 5, 5, 8, 5, 10, 5, 10, 8, 13, 15, 12, 3, 3,
+    };
+    const uint8 anchors3b[64] = {
+      15, 8, 8, 3, 15, 15, 3, 8, 15, 15, 15, 15, 15, 15, 15, 8,
+      15, 8, 15, 3, 15, 8, 15, 8, 3, 15, 6, 10, 15, 15, 10, 8,
+      15, 3, 15, 10, 10, 8, 9, 10, 6, 15, 8, 15, 3, 6, 6, 8,
+      15, 3, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 3, 15, 15, 8,
+    };
+
+    const uint8 weights2[4] = {0, 21, 43, 64};
+    const uint8 weights3[8] = {0, 9, 18, 27, 37, 46, 55, 64};
+    const uint8 weights4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+    uint8 const* weights(int bits) {
+      return bits == 2 ? weights2 : bits == 3 ? weights3 : weights4;
+    }
+
+    // Reads a block from its least significant bit
+    class BitReader {
+    public:
+      BitReader(uint8 const* block) {
+        memcpy(&lo_, block, 8);
+        memcpy(&hi_, block + 8, 8);
+      }
+      uint32 read(int count) {
+        if (!count) return 0;
+        uint32 result = uint32(lo_ & ((1ULL << count) - 1));
+        lo_ = (lo_ >> count) | (hi_ << (64 - count));
+        hi_ >>= count;
+        return result;
+      }
+    private:
+      uint64 lo_, hi_;
+    };
+
+    inline uint32 pack(uint32 r, uint32 g, uint32 b, uint32 a) {
+      return (a << 24) | (r << 16) | (g << 8) | b;
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////////////
+    // BC7
+
+    struct ModeBC7 {
+      uint8 subsets;
+      uint8 partitionBits;
+      uint8 rotationBits;
+      uint8 selectorBits;
+      uint8 colorBits;
+      uint8 alphaBits;
+      uint8 endpointPBits; // one bit per endpoint
+      uint8 sharedPBits;   // one bit per subset
+      uint8 indexBits;
+      uint8 indexBits2;
+    };
+    const ModeBC7 modesBC7[8] = {
+      {3, 4, 0, 0, 4, 0, 1, 0, 3, 0},
+      {2, 6, 0, 0, 6, 0, 0, 1, 3, 0},
+      {3, 6, 0, 0, 5, 0, 0, 0, 2, 0},
+      {2, 6, 0, 0, 7, 0, 1, 0, 2, 0},
+      {1, 0, 2, 1, 5, 6, 0, 0, 2, 3},
+      {1, 0, 2, 0, 7, 8, 0, 0, 2, 2},
+      {1, 0, 0, 0, 7, 7, 1, 0, 4, 0},
+      {2, 6, 0, 0, 5, 5, 1, 0, 2, 0},
+    };
+
+    // indices of all texels; anchors are one bit shorter
+    void readIndices(BitReader& bits, int count, uint32 anchor1, uint32 anchor2, uint8* indices) {
+      for (uint32 i = 0; i < 16; ++i) {
+        bool anchor = (i == 0 || i == anchor1 || i == anchor2);
+        indices[i] = uint8(bits.read(anchor ? count - 1 : count));
+      }
+    }
+
+    void blockBC7(uint8 const* block, uint32* dst, size_t pitch) {
+      if (!block[0]) {
+        // reserved mode
+        for (int y = 0; y < 4; ++y, dst += pitch) {
+          memset(dst, 0, 4 * sizeof(uint32));
+        }
+        return;
+      }
+      int mode = 0;
+      while (!(block[0] & (1 << mode))) ++mode;
+      ModeBC7 const& m = modesBC7[mode];
+      BitReader bits(block);
+      bits.read(mode + 1);
+      uint32 partition = bits.read(m.partitionBits);
+      uint32 rotation = bits.read(m.rotationBits);
+      uint32 selector = bits.read(m.selectorBits);
+
+      int endpoints = m.subsets * 2;
+      uint32 ep[6][4];
+      for (int c = 0; c < 3; ++c) {
+        for (int e = 0; e < endpoints; ++e) {
+          ep[e][c] = bits.read(m.colorBits);
+        }
+      }
+      for (int e = 0; e < endpoints; ++e) {
+        ep[e][3] = bits.read(m.alphaBits);
+      }
+      int colorBits = m.colorBits;
+      int alphaBits = m.alphaBits;
+      if (m.endpointPBits || m.sharedPBits) {
+        uint32 pbits[6];
+        for (int i = 0; i < (m.endpointPBits ? endpoints : m.subsets); ++i) {
+          pbits[i] = bits.read(1);
+        }
+        for (int e = 0; e < endpoints; ++e) {
+          uint32 pbit = pbits[m.endpointPBits ? e : e / 2];
+          for (int c = 0; c < (alphaBits ? 4 : 3); ++c) {
+            ep[e][c] = (ep[e][c] << 1) | pbit;
+          }
+        }
+        ++colorBits;
+        if (alphaBits) ++alphaBits;
+      }
+      for (int e = 0; e < endpoints; ++e) {
+        for (int c = 0; c < 3; ++c) {
+          uint32 v = ep[e][c] << (8 - colorBits);
+          ep[e][c] = v | (v >> colorBits);
+        }
+        if (alphaBits) {
+          uint32 v = ep[e][3] << (8 - alphaBits);
+          ep[e][3] = v | (v >> alphaBits);
+        } else {
+          ep[e][3] = 255;
+        }
+      }
+
+      uint32 anchor1 = 0, anchor2 = 0;
+      if (m.subsets == 2) {
+        anchor1 = anchors2[partition];
+      } else if (m.subsets == 3) {
+        anchor1 = anchors3a[partition];
+        anchor2 = anchors3b[partition];
+      }
+      uint8 indices[16], indices2[16];
+      readIndices(bits, m.indexBits, anchor1, anchor2, indices);
+      if (!m.indexBits2) {
+        // every texel is one of (1 << indexBits) colors per subset
+        uint8 const* w = weights(m.indexBits);
+        uint32 palette[3][16];
+        for (int s = 0; s < m.subsets; ++s) {
+          uint32 const* e0 = ep[s * 2];
+          uint32 const* e1 = ep[s * 2 + 1];
+          for (int k = 0; k < (1 << m.indexBits); ++k) {
+            uint32 weight = w[k];
+            uint32 rgba[4];
+            for (int c = 0; c < 4; ++c) {
+              rgba[c] = ((64 - weight) * e0[c] + weight * e1[c] + 32) >> 6;
+            }
+            palette[s][k] = pack(rgba[0], rgba[1], rgba[2], rgba[3]);
+          }
+        }
+        uint32 subsets = (m.subsets == 2 ? partitions2[partition] : m.subsets == 3 ? partitions3[partition] : 0);
+        int subsetBits = (m.subsets == 3 ? 2 : 1);
+        for (uint32 i = 0; i < 16; ++i) {
+          uint32 subset = (subsets >> (i * subsetBits)) & (m.subsets == 3 ? 3 : 1);
+          dst[(i >> 2) * pitch + (i & 3)] = palette[subset][indices[i]];
+        }
+        return;
+      }
+
+      // modes 4 and 5: one subset with separate color and alpha indices
+      readIndices(bits, m.indexBits2, 0, 0, indices2);
+      uint8 const* colorWeights = weights(m.indexBits);
+      uint8 const* alphaWeights = weights(m.indexBits2);
+      uint8 const* colorIndices = indices;
+      uint8 const* alphaIndices = indices2;
+      if (selector) {
+        std::swap(colorWeights, alphaWeights);
+        std::swap(colorIndices, alphaIndices);
+      }
+      uint32 const* e0 = ep[0];
+      uint32 const* e1 = ep[1];
+      for (uint32 i = 0; i < 16; ++i) {
+        uint32 cw = colorWeights[colorIndices[i]];
+        uint32 aw = alphaWeights[alphaIndices[i]];
+        uint32 rgba[4];
+        for (int c = 0; c < 3; ++c) {
+          rgba[c] = ((64 - cw) * e0[c] + cw * e1[c] + 32) >> 6;
+        }
+        rgba[3] = ((64 - aw) * e0[3] + aw * e1[3] + 32) >> 6;
+        if (rotation) {
+          std::swap(rgba[3], rgba[rotation - 1]);
+        }
+        dst[(i >> 2) * pitch + (i & 3)] = pack(rgba[0], rgba[1], rgba[2], rgba[3]);
+      }
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////////////
+    // BC6H
+
+    // Endpoint bits of each mode in the order they are stored, following the tables in the
+    // D3D11 specification: r0..r3 are the red components of endpoints W, X, Y and Z, and
+    // r0[10:15] means bits 15 down to 10.
+    struct ModeBC6 {
+      uint8 code;
+      uint8 regions;
+      bool transformed;
+      uint8 precision;
+      uint8 deltaBits[3];
+      char const* layout;
+    };
+    const ModeBC6 modesBC6[14] = {
+      {0x00, 2, true, 10, {5, 5, 5}, "g2[4] b2[4] b3[4] r0[9:0] g0[9:0] b0[9:0] r1[4:0] g3[4] g2[3:0] g1[4:0] b3[0] g3[3:0] b1[4:0] b3[1] b2[3:0] r2[4:0] b3[2] r3[4:0] b3[3]"},
+      {0x01, 2, true, 7, {6, 6, 6}, "g2[5] g3[4] g3[5] r0[6:0] b3[0] b3[1] b2[4] g0[6:0] b2[5] b3[2] g2[4] b0[6:0] b3[3] b3[5] b3[4] r1[5:0] g2[3:0] g1[5:0] g3[3:0] b1[5:0] b2[3:0] r2[5:0] r3[5:0]"},
+      {0x02, 2, true, 11, {5, 4, 4}, "r0[9:0] g0[9:0] b0[9:0] r1[4:0] r0[10] g2[3:0] g1[3:0] g0[10] b3[0] g3[3:0] b1[3:0] b0[10] b3[1] b2[3:0] r2[4:0] b3[2] r3[4:0] b3[3]"},
+      {0x06, 2, true, 11, {4, 5, 4}, "r0[9:0] g0[9:0] b0[9:0] r1[3:0] r0[10] g3[4] g2[3:0] g1[4:0] g0[10] g3[3:0] b1[3:0] b0[10] b3[1] b2[3:0] r2[3:0] b3[0] b3[2] r3[3:0] g2[4] b3[3]"},
+      {0x0A, 2, true, 11, {4, 4, 5}, "r0[9:0] g0[9:0] b0[9:0] r1[3:0] r0[10] b2[4] g2[3:0] g1[3:0] g0[10] b3[0] g3[3:0] b1[4:0] b0[10] b2[3:0] r2[3:0] b3[1] b3[2] r3[3:0] b3[4] b3[3]"},
+      {0x0E, 2, true, 9, {5, 5, 5}, "r0[8:0] b2[4] g0[8:0] g2[4] b0[8:0] b3[4] r1[4:0] g3[4] g2[3:0] g1[4:0] b3[0] g3[3:0] b1[4:0] b3[1] b2[3:0] r2[4:0] b3[2] r3[4:0] b3[3]"},
+      {0x12, 2, true, 8, {6, 5, 5}, "r0[7:0] g3[4] b2[4] g0[7:0] b3[2] g2[4] b0[7:0] b3[3] b3[4] r1[5:0] g2[3:0] g1[4:0] b3[0] g3[3:0] b1[4:0] b3[1] b2[3:0] r2[5:0] r3[5:0]"},
+      {0x16, 2, true, 8, {5, 6, 5}, "r0[7:0] b3[0] b2[4] g0[7:0] g2[5] g2[4] b0[7:0] g3[5] b3[4] r1[4:0] g3[4] g2[3:0] g1[5:0] g3[3:0] b1[4:0] b3[1] b2[3:0] r2[4:0] b3[2] r3[4:0] b3[3]"},
+      {0x1A, 2, true, 8, {5, 5, 6}, "r0[7:0] b3[1] b2[4] g0[7:0] b2[5] g2[4] b0[7:0] b3[5] b3[4] r1[4:0] g3[4] g2[3:0] g1[4:0] b3[0] g3[3:0] b1[5:0] b2[3:0] r2[4:0] b3[2] r3[4:0] b3[3]"},
+      {0x1E, 2, false, 6, {6, 6, 6}, "r0[5:0] g3[4] b3[0] b3[1] b2[4] g0[5:0] g2[5] b2[5] b3[2] g2[4] b0[5:0] g3[5] b3[3] b3[5] b3[4] r1[5:0] g2[3:0] g1[5:0] g3[3:0] b1[5:0] b2[3:0] r2[5:0] r3[5:0]"},
+      {0x03, 1, false, 10, {10, 10, 10}, "r0[9:0] g0[9:0] b0[9:0] r1[9:0] g1[9:0] b1[9:0]"},
+      {0x07, 1, true, 11, {9, 9, 9}, "r0[9:0] g0[9:0] b0[9:0] r1[8:0] r0[10] g1[8:0] g0[10] b1[8:0] b0[10]"},
+      {0x0B, 1, true, 12, {8, 8, 8}, "r0[9:0] g0[9:0] b0[9:0] r1[7:0] r0[10:11] g1[7:0] g0[10:11] b1[7:0] b0[10:11]"},
+      {0x0F, 1, true, 16, {4, 4, 4}, "r0[9:0] g0[9:0] b0[9:0] r1[3:0] r0[10:15] g1[3:0] g0[10:15] b1[3:0] b0[10:15]"},
+    };
+
+    // A run of bits of one endpoint component, stored lowest bit first
+    struct Run {
+      uint8 value; // endpoint * 3 + component
+      uint8 shift;
+      uint8 count;
+    };
+    struct LayoutBC6 {
+      ModeBC6 const* mode = nullptr;
+      std::vector<Run> runs;
+    };
+
+    struct ModesBC6 {
+      LayoutBC6 layouts[32];
+
+      ModesBC6() {
+        for (ModeBC6 const& mode : modesBC6) {
+          LayoutBC6& layout = layouts[mode.code];
+          layout.mode = &mode;
+          for (char const* ptr = mode.layout; *ptr;) {
+            while (*ptr == ' ') ++ptr;
+            int component = (*ptr == 'r' ? 0 : *ptr == 'g' ? 1 : 2);
+            int endpoint = ptr[1] - '0';
+            ptr += 3;
+            int first = (int) strtol(ptr, (char**) &ptr, 10);
+            int last = first;
+            if (*ptr == ':') {
+              last = (int) strtol(ptr + 1, (char**) &ptr, 10);
+            }
+            ++ptr;
+            uint8 value = uint8(endpoint * 3 + component);
+            if (last <= first) {
+              layout.runs.push_back(Run{value, uint8(last), uint8(first - last + 1)});
+            } else {
+              for (int bit = last; bit >= first; --bit) {
+                layout.runs.push_back(Run{value, uint8(bit), 1});
+              }
+            }
+          }
+        }
+      }
+    };
+    ModesBC6 const& modesBC6Layouts() {
+      static ModesBC6 modes;
+      return modes;
+    }
+
+    inline int signExtend(int value, int bits) {
+      return (value ^ (1 << (bits - 1))) - (1 << (bits - 1));
+    }
+
+    int unquantize(int value, int bits, bool isSigned) {
+      if (!isSigned) {
+        if (bits >= 15) return value;
+        if (value == 0) return 0;
+        if (value == (1 << bits) - 1) return 0xFFFF;
+        return ((value << 16) + 0x8000) >> bits;
+      }
+      if (bits >= 16) return value;
+      bool negative = (value < 0);
+      if (negative) value = -value;
+      int result;
+      if (value == 0) {
+        result = 0;
+      } else if (value >= (1 << (bits - 1)) - 1) {
+        result = 0x7FFF;
+      } else {
+        result = ((value << 15) + 0x4000) >> (bits - 1);
+      }
+      return negative ? -result : result;
+    }
+
+    // Interpolated value as a half float, converted to 8 bits the same way as the 16-bit
+    // float DDS formats: negative values are 0 and values from 1.0 up are 255.
+    inline uint32 finish(int value, bool isSigned) {
+      uint32 half;
+      if (isSigned) {
+        half = (value < 0 ? 0x8000 | (((-value) * 31) >> 5) : (value * 31) >> 5);
+      } else {
+        half = (value * 31) >> 6;
+      }
+      if (half & 0x8000) return 0;
+      uint32 e = half >> 10;
+      if (e >= 15) return 255;
+      return (0x400 + (half & 0x3FF)) >> (17 - e);
+    }
+
+    void blockBC6(uint8 const* block, uint32* dst, size_t pitch, bool isSigned) {
+      BitReader bits(block);
+      uint32 code = bits.read(2);
+      if (code > 1) code |= bits.read(3) << 2;
+      LayoutBC6 const& layout = modesBC6Layouts().layouts[code];
+      ModeBC6 const* mode = layout.mode;
+      if (!mode) {
+        // reserved mode
+        for (int y = 0; y < 4; ++y, dst += pitch) {
+          for (int x = 0; x < 4; ++x) {
+            dst[x] = 0xFF000000;
+          }
+        }
+        return;
+      }
+
+      int ep[12] = {0};
+      for (Run const& run : layout.runs) {
+        ep[run.value] |= int(bits.read(run.count)) << run.shift;
+      }
+      int endpoints = mode->regions * 2;
+      int precision = mode->precision;
+      int mask = (1 << precision) - 1;
+      for (int c = 0; c < 3; ++c) {
+        if (isSigned) ep[c] = signExtend(ep[c], precision);
+        for (int e = 1; e < endpoints; ++e) {
+          int& v = ep[e * 3 + c];
+          if (mode->transformed) {
+            v = (ep[c] + signExtend(v, mode->deltaBits[c])) & mask;
+          }
+          if (isSigned) v = signExtend(v, precision);
+        }
+      }
+      for (int i = 0; i < endpoints * 3; ++i) {
+        ep[i] = unquantize(ep[i], precision, isSigned);
+      }
+
+      uint32 partition = 0, anchor = 0;
+      int indexBits = 4;
+      if (mode->regions == 2) {
+        partition = bits.read(5);
+        anchor = anchors2[partition];
+        indexBits = 3;
+      }
+      uint8 indices[16];
+      readIndices(bits, indexBits, anchor, 0, indices);
+      uint8 const* w = weights(indexBits);
+
+      for (uint32 i = 0; i < 16; ++i) {
+        uint32 region = (mode->regions == 2 ? (partitions2[partition] >> i) & 1 : 0);
+        int const* e0 = ep + region * 6;
+        int const* e1 = e0 + 3;
+        int weight = w[indices[i]];
+        uint32 rgb[3];
+        for (int c = 0; c < 3; ++c) {
+          rgb[c] = finish(((64 - weight) * e0[c] + weight * e1[c] + 32) >> 6, isSigned);
+        }
+        dst[(i >> 2) * pitch + (i & 3)] = pack(rgb[0], rgb[1], rgb[2], 255);
+      }
+    }
+
+    //////////////////////////////////////////////////////////////////////////////////////////
+
+    template<class Block>
+    void decodeImage(uint8 const* data, int width, int height, uint32* bits, Block block) {
+      size_t const blocksX = (width + 3) / 4;
+      size_t const blocksY = (height + 3) / 4;
+      auto row = [&](size_t by) {
+        uint8 const* src = data + by * blocksX * 16;
+        uint32* dst = bits + by * 4 * width;
+        int rows = std::min(height - int(by) * 4, 4);
+        uint32 temp[16];
+        for (size_t bx = 0; bx < blocksX; ++bx, src += 16) {
+          int cols = std::min(width - int(bx) * 4, 4);
+          if (rows == 4 && cols == 4) {
+            block(src, dst + bx * 4, width);
+          } else {
+            // blocks that overhang an edge are decoded separately and cropped
+            block(src, temp, 4);
+            for (int y = 0; y < rows; ++y) {
+              memcpy(dst + y * width + bx * 4, temp + y * 4, cols * sizeof(uint32));
+            }
+          }
+        }
+      };
+      if (useThreads && blocksX * blocksY >= PARALLEL_BLOCKS) {
+        parallel_for(blocksY, row);
+      } else {
+        for (size_t by = 0; by < blocksY; ++by) {
+          row(by);
+        }
+      }
+    }
+
+  }
+
+  size_t size(int width, int height) {
+    return size_t((width + 3) / 4) * ((height + 3) / 4) * 16;
+  }
+
+  void decode(Format format, uint8 const* data, int width, int height, Image::color_t* bits) {
+    uint32* dst = reinterpret_cast<uint32*>(bits);
+    if (format == BC7) {
+      decodeImage(data, width, height, dst, blockBC7);
+    } else {
+      bool isSigned = (format == BC6H_SF16);
+      modesBC6Layouts();
+      decodeImage(data, width, height, dst, [isSigned](uint8 const* block, uint32* out, size_t pitch) {
+        blockBC6(block, out, pitch, isSigned);
+      });
+    }
+  }
+
+  void setParallel(bool enabled) {
+    useThreads = enabled;
+  }
+
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "image.h"
+
+// Decoders for BPTC blocks: BC7, and BC6H converted to 8 bits per channel. Both use 16-byte
+// blocks of 4x4 texels stored row by row; blocks that overhang the right or bottom edge are
+// cropped. Large images are decoded on several threads.
+namespace BPTC {
+
+  enum Format {
+    BC6H_UF16,
+    BC6H_SF16,
+    BC7,
+  };
+
+  // bytes taken by a width x height image
+  size_t size(int width, int height);
+
+  void decode(Format format, uint8 const* data, int width, int height, Image::color_t* bits);
+
+  // Threads can be turned off to measure single-threaded throughput
+  void setParallel(bool enabled);
+
+}
@@ -0,0 +1,393 @@
+#include "dxt.h"
+#include "utils/simd.h"
+
+namespace DXT {
+
+  namespace {
+
+    bool useSimd = true;
+
+    template<class T>
+    T load(uint8 const* ptr) {
+      T value;
+      memcpy(&value, ptr, sizeof value);
+      return value;
+    }
+
+    // 565 endpoint converted the way Color::XRGB<0, 5, 6, 5> converts to Image::color_t
+    uint32 expand(uint16 color) {
+      uint32 r = ((color >> 11) & 31) * 255 / 31;
+      uint32 g = ((color >> 5) & 63) * 255 / 63;
+      uint32 b = (color & 31) * 255 / 31;
+      return 0xFF000000 | (r << 16) | (g << 8) | b;
+    }
+
+    // Color::mix on packed colors
+    uint32 mix(uint32 a, uint32 ka, uint32 b, uint32 kb) {
+      uint32 result = 0;
+      for (int shift = 0; shift < 32; shift += 8) {
+        result |= ((((a >> shift) & 0xFF) * ka + ((b >> shift) & 0xFF) * kb) / (ka + kb)) << shift;
+      }
+      return result;
+    }
+
+    // DXT3 and DXT5 blocks always use the four color mode
+    void colors(uint8 const* block, bool threeColor, uint32* c) {
+      uint16 p = load<uint16>(block);
+      uint16 q = load<uint16>(block + 2);
+      c[0] = expand(p);
+      c[1] = expand(q);
+      if (p > q || !threeColor) {
+        c[2] = mix(c[0], 2, c[1], 1);
+        c[3] = mix(c[0], 1, c[1], 2);
+      } else {
+        c[2] = mix(c[0], 1, c[1], 1);
+        c[3] = 0;
+      }
+    }
+
+    void alphas(uint8 const* block, uint8* a) {
+      uint32 a0 = block[0];
+      uint32 a1 = block[1];
+      a[0] = a0;
+      a[1] = a1;
+      if (a0 > a1) {
+        for (uint32 i = 1; i < 7; ++i) {
+          a[i + 1] = (a0 * (7 - i) + a1 * i) / 7;
+        }
+      } else {
+        for (uint32 i = 1; i < 5; ++i) {
+          a[i + 1] = (a0 * (5 - i) + a1 * i) / 5;
+        }
+        a[6] = 0;
+        a[7] = 255;
+      }
+    }
+
+    uint64 alphaIndices(uint8 const* block) {
+      uint64 amap = 0;
+      memcpy(&amap, block + 2, 6);
+      return amap;
+    }
+
+    // DXT3 alpha of one row as four bytes
+    uint32 explicitAlpha(uint64 alpha, int row) {
+      uint32 v = uint32(alpha >> (16 * row)) & 0xFFFF;
+      uint32 x = (v & 0xF) | ((v & 0xF0) << 4) | ((v & 0xF00) << 8) | ((v & 0xF000) << 12);
+      return x * 17;
+    }
+
+    template<Format F>
+    void blockScalar(uint8 const* block, uint32* dst, size_t pitch) {
+      uint32 c[4];
+      uint8 a[8];
+      uint64 alpha = 0;
+      if (F == DXT3) {
+        alpha = load<uint64>(block);
+        block += 8;
+      } else if (F == DXT5) {
+        alphas(block, a);
+        alpha = alphaIndices(block);
+        block += 8;
+      }
+      colors(block, F == DXT1, c);
+      uint32 lookup = load<uint32>(block + 4);
+      for (int y = 0; y < 4; ++y, dst += pitch) {
+        for (int x = 0; x < 4; ++x) {
+          uint32 color = c[lookup & 3];
+          lookup >>= 2;
+          if (F == DXT3) {
+            color = (color & 0x00FFFFFF) | (uint32(alpha & 15) * 17 << 24);
+            alpha >>= 4;
+          } else if (F == DXT5) {
+            color = (color & 0x00FFFFFF) | (uint32(a[alpha & 7]) << 24);
+            alpha >>= 3;
+          }
+          dst[x] = color;
+        }
+      }
+    }
+
+    template<Format F>
+    void rowScalar(uint8 const* data, int count, uint32* dst, size_t pitch) {
+      for (int i = 0; i < count; ++i) {
+        blockScalar<F>(data, dst, pitch);
+        data += (F == DXT1 ? 8 : 16);
+        dst += 4;
+      }
+    }
+
+#ifdef SIMD_X86
+    // pshufb masks picking four palette entries from one byte of 2-bit indices
+    struct ColorMasks {
+      __m128i masks[256];
+      ColorMasks() {
+        for (int i = 0; i < 256; ++i) {
+          uint8 mask[16];
+          for (int x = 0; x < 4; ++x) {
+            for (int b = 0; b < 4; ++b) {
+              mask[x * 4 + b] = uint8(((i >> (2 * x)) & 3) * 4 + b);
+            }
+          }
+          masks[i] = _mm_loadu_si128(reinterpret_cast<__m128i const*>(mask));
+        }
+      }
+    };
+    ColorMasks const& colorMasks() {
+      static ColorMasks masks;
+      return masks;
+    }
+
+    // Builds the four colors of a block as packed pixels. Division by 3 is done as
+    // (x * 0xAAAB) >> 17, which is exact for every sum that can occur here.
+    SIMD_TARGET("ssse3")
+    inline __m128i paletteSSSE3(uint8 const* block, bool threeColor) {
+      uint16 p = load<uint16>(block);
+      uint16 q = load<uint16>(block + 2);
+      __m128i zero = _mm_setzero_si128();
+      __m128i ends = _mm_unpacklo_epi8(_mm_setr_epi32(expand(p), expand(q), 0, 0), zero);
+      __m128i swapped = _mm_shuffle_epi32(ends, 0x4E);
+      __m128i mixed;
+      if (threeColor && p <= q) {
+        mixed = _mm_unpacklo_epi64(_mm_srli_epi16(_mm_add_epi16(ends, swapped), 1), zero);
+      } else {
+        __m128i sum = _mm_add_epi16(_mm_add_epi16(ends, ends), swapped);
+        mixed = _mm_srli_epi16(_mm_mulhi_epu16(sum, _mm_set1_epi16(short(0xAAAB))), 1);
+      }
+      return _mm_packus_epi16(ends, mixed);
+    }
+
+    // DXT5 alpha values in the low 8 bytes, divided by 7 or 5 with multipliers that are exact
+    // for the weighted sums involved
+    SIMD_TARGET("ssse3")
+    inline __m128i alphasSSSE3(uint8 const* block) {
+      int a0 = block[0];
+      int a1 = block[1];
+      __m128i x0 = _mm_set1_epi16(short(a0));
+      __m128i x1 = _mm_set1_epi16(short(a1));
+      __m128i table;
+      if (a0 > a1) {
+        __m128i sum = _mm_add_epi16(_mm_mullo_epi16(x0, _mm_setr_epi16(7, 0, 6, 5, 4, 3, 2, 1)),
+                                    _mm_mullo_epi16(x1, _mm_setr_epi16(0, 7, 1, 2, 3, 4, 5, 6)));
+        table = _mm_mulhi_epu16(sum, _mm_set1_epi16(0x2493));
+      } else {
+        __m128i sum = _mm_add_epi16(_mm_mullo_epi16(x0, _mm_setr_epi16(5, 0, 4, 3, 2, 1, 0, 0)),
+                                    _mm_mullo_epi16(x1, _mm_setr_epi16(0, 5, 1, 2, 3, 4, 0, 0)));
+        table = _mm_or_si128(_mm_mulhi_epu16(sum, _mm_set1_epi16(0x3334)), _mm_setr_epi16(0, 0, 0, 0, 0, 0, 0, 255));
+      }
+      return _mm_packus_epi16(table, _mm_setzero_si128());
+    }
+
+    // 3-bit alpha indices of one row, spread into byte 3 of each pixel; the other bytes
+    // select nothing
+    inline uint32 alphaRow(uint64 alpha, int row) {
+      uint32 bits = uint32(alpha >> (12 * row));
+      return (bits & 7) | ((bits << 5) & 0x700) | ((bits << 10) & 0x70000) | ((bits << 15) & 0x7000000);
+    }
+
+    // Each block row is four palette lookups with pshufb. Alpha values are moved to byte 3
+    // of each pixel with another shuffle; for DXT5 that shuffle reads the 8-entry table.
+    template<Format F>
+    SIMD_TARGET("ssse3")
+    void rowSSSE3(uint8 const* data, int count, uint32* dst, size_t pitch) {
+      __m128i const* masks = colorMasks().masks;
+      __m128i const rgb = _mm_set1_epi32(0x00FFFFFF);
+      __m128i const spread = _mm_setr_epi8(-128, -128, -128, 0, -128, -128, -128, 1, -128, -128, -128, 2, -128, -128, -128, 3);
+      __m128i const other = _mm_set1_epi32(0x00808080);
+      for (int i = 0; i < count; ++i, dst += 4) {
+        uint8 const* block = data;
+        data += (F == DXT1 ? 8 : 16);
+        __m128i table = _mm_setzero_si128();
+        uint64 alpha = 0;
+        if (F == DXT3) {
+          alpha = load<uint64>(block);
+          block += 8;
+        } else if (F == DXT5) {
+          table = alphasSSSE3(block);
+          alpha = alphaIndices(block);
+          block += 8;
+        }
+        __m128i palette = paletteSSSE3(block, F == DXT1);
+        uint32 lookup = load<uint32>(block + 4);
+        uint32* out = dst;
+        for (int y = 0; y < 4; ++y, out += pitch) {
+          __m128i pixels = _mm_shuffle_epi8(palette, masks[(lookup >> (8 * y)) & 0xFF]);
+          if (F == DXT3) {
+            __m128i av = _mm_shuffle_epi8(_mm_cvtsi32_si128(explicitAlpha(alpha, y)), spread);
+            pixels = _mm_or_si128(_mm_and_si128(pixels, rgb), av);
+          } else if (F == DXT5) {
+            __m128i select = _mm_or_si128(_mm_shuffle_epi8(_mm_cvtsi32_si128(alphaRow(alpha, y)), spread), other);
+            pixels = _mm_or_si128(_mm_and_si128(pixels, rgb), _mm_shuffle_epi8(table, select));
+          }
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(out), pixels);
+        }
+      }
+    }
+
+    // Two adjacent blocks per iteration, one in each 128-bit lane, so that every row of the
+    // pair is a single 32-byte store
+    template<Format F>
+    SIMD_TARGET("avx2")
+    void rowAVX2(uint8 const* data, int count, uint32* dst, size_t pitch) {
+      size_t const blockSize = (F == DXT1 ? 8 : 16);
+      __m128i const* masks = colorMasks().masks;
+      __m256i const rgb = _mm256_set1_epi32(0x00FFFFFF);
+      __m256i const spread = _mm256_setr_epi8(-128, -128, -128, 0, -128, -128, -128, 1, -128, -128, -128, 2, -128, -128, -128, 3,
+                                              -128, -128, -128, 4, -128, -128, -128, 5, -128, -128, -128, 6, -128, -128, -128, 7);
+      __m256i const other = _mm256_set1_epi32(0x00808080);
+      int i = 0;
+      for (; i + 2 <= count; i += 2, dst += 8) {
+        uint8 const* block0 = data;
+        uint8 const* block1 = data + blockSize;
+        data += 2 * blockSize;
+        __m256i table = _mm256_setzero_si256();
+        uint64 alpha0 = 0, alpha1 = 0;
+        if (F == DXT3) {
+          alpha0 = load<uint64>(block0);
+          alpha1 = load<uint64>(block1);
+          block0 += 8;
+          block1 += 8;
+        } else if (F == DXT5) {
+          table = _mm256_inserti128_si256(_mm256_castsi128_si256(alphasSSSE3(block0)), alphasSSSE3(block1), 1);
+          alpha0 = alphaIndices(block0);
+          alpha1 = alphaIndices(block1);
+          block0 += 8;
+          block1 += 8;
+        }
+        __m256i palette = _mm256_inserti128_si256(_mm256_castsi128_si256(paletteSSSE3(block0, F == DXT1)),
+                                                  paletteSSSE3(block1, F == DXT1), 1);
+        uint32 lookup0 = load<uint32>(block0 + 4);
+        uint32 lookup1 = load<uint32>(block1 + 4);
+        uint32* out = dst;
+        for (int y = 0; y < 4; ++y, out += pitch) {
+          __m256i mask = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_load_si128(&masks[(lookup0 >> (8 * y)) & 0xFF])),
+                                                 _mm_load_si128(&masks[(lookup1 >> (8 * y)) & 0xFF]), 1);
+          __m256i pixels = _mm256_shuffle_epi8(palette, mask);
+          if (F == DXT3) {
+            // the alpha rows of both blocks are repeated in each lane; each half of spread picks its own
+            __m256i av = _mm256_set1_epi64x(int64(uint64(explicitAlpha(alpha0, y)) | (uint64(explicitAlpha(alpha1, y)) << 32)));
+            pixels = _mm256_or_si256(_mm256_and_si256(pixels, rgb), _mm256_shuffle_epi8(av, spread));
+          } else if (F == DXT5) {
+            __m256i index = _mm256_set1_epi64x(int64(uint64(alphaRow(alpha0, y)) | (uint64(alphaRow(alpha1, y)) << 32)));
+            __m256i select = _mm256_or_si256(_mm256_shuffle_epi8(index, spread), other);
+            pixels = _mm256_or_si256(_mm256_and_si256(pixels, rgb), _mm256_shuffle_epi8(table, select));
+          }
+          _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), pixels);
+        }
+      }
+      if (i < count) {
+        rowSSSE3<F>(data, count - i, dst, pitch);
+      }
+    }
+#endif
+
+#ifdef SIMD_WASM
+    // same as rowSSSE3; swizzle returns zero for out of range indices like pshufb does
+    template<Format F>
+    void rowWasm(uint8 const* data, int count, uint32* dst, size_t pitch) {
+      v128_t const rgb = wasm_i32x4_splat(0x00FFFFFF);
+      v128_t const spread = wasm_i8x16_make(-128, -128, -128, 0, -128, -128, -128, 1, -128, -128, -128, 2, -128, -128, -128, 3);
+      v128_t const other = wasm_i32x4_splat(0x00808080);
+      for (int i = 0; i < count; ++i, dst += 4) {
+        uint8 const* block = data;
+        data += (F == DXT1 ? 8 : 16);
+        uint32 c[4];
+        uint8 a[16] = {0};
+        uint64 alpha = 0;
+        if (F == DXT3) {
+          alpha = load<uint64>(block);
+          block += 8;
+        } else if (F == DXT5) {
+          alphas(block, a);
+          alpha = alphaIndices(block);
+          block += 8;
+        }
+        colors(block, F == DXT1, c);
+        v128_t palette = wasm_v128_load(c);
+        v128_t table = wasm_v128_load(a);
+        uint32 lookup = load<uint32>(block + 4);
+        uint32* out = dst;
+        for (int y = 0; y < 4; ++y, out += pitch) {
+          uint32 row = (lookup >> (8 * y)) & 0xFF;
+          v128_t mask = wasm_u32x4_make(row & 3, (row >> 2) & 3, (row >> 4) & 3, row >> 6);
+          mask = wasm_i32x4_add(wasm_i32x4_mul(mask, wasm_i32x4_splat(0x04040404)), wasm_i32x4_splat(0x03020100));
+          v128_t pixels = wasm_i8x16_swizzle(palette, mask);
+          if (F == DXT3) {
+            v128_t av = wasm_i8x16_swizzle(wasm_i32x4_make(explicitAlpha(alpha, y), 0, 0, 0), spread);
+            pixels = wasm_v128_or(wasm_v128_and(pixels, rgb), av);
+          } else if (F == DXT5) {
+            uint32 bits = uint32(alpha >> (12 * y));
+            uint32 index = (bits & 7) | ((bits << 5) & 0x700) | ((bits << 10) & 0x70000) | ((bits << 15) & 0x7000000);
+            v128_t select = wasm_v128_or(wasm_i8x16_swizzle(wasm_i32x4_make(index, 0, 0, 0), spread), other);
+            pixels = wasm_v128_or(wasm_v128_and(pixels, rgb), wasm_i8x16_swizzle(table, select));
+          }
+          wasm_v128_store(out, pixels);
+        }
+      }
+    }
+#endif
+
+    typedef void(*RowFunc)(uint8 const* data, int count, uint32* dst, size_t pitch);
+
+    template<Format F>
+    RowFunc rowFunc() {
+#ifdef SIMD_X86
+      if (useSimd && Simd::hasAVX2()) return rowAVX2<F>;
+      if (useSimd && Simd::hasSSSE3()) return rowSSSE3<F>;
+#endif
+#ifdef SIMD_WASM
+      if (useSimd) return rowWasm<F>;
+#endif
+      return rowScalar<F>;
+    }
+
+    template<Format F>
+    void decodeImage(uint8 const* data, int width, int height, uint32* bits) {
+      size_t const blockSize = (F == DXT1 ? 8 : 16);
+      int const full = width / 4;
+      int const blocks = (width + 3) / 4;
+      RowFunc row = rowFunc<F>();
+      uint32 temp[16];
+      for (int y = 0; y < height; y += 4, data += blocks * blockSize) {
+        uint32* dst = bits + size_t(y) * width;
+        int rows = std::min(height - y, 4);
+        if (rows == 4) {
+          row(data, full, dst, width);
+        }
+        // blocks that overhang an edge are decoded separately and cropped
+        for (int x = (rows == 4 ? full : 0); x < blocks; ++x) {
+          blockScalar<F>(data + x * blockSize, temp, 4);
+          int cols = std::min(width - x * 4, 4);
+          for (int cy = 0; cy < rows; ++cy) {
+            memcpy(dst + size_t(cy) * width + x * 4, temp + cy * 4, cols * sizeof(uint32));
+          }
+        }
+      }
+    }
+
+  }
+
+  size_t size(Format format, int width, int height) {
+    return size_t((width + 3) / 4) * ((height + 3) / 4) * (format == DXT1 ? 8 : 16);
+  }
+
+  void decode(Format format, uint8 const* data, int width, int height, Image::color_t* bits) {
+    uint32* dst = reinterpret_cast<uint32*>(bits);
+    switch (format) {
+    case DXT1:
+      decodeImage<DXT1>(data, width, height, dst);
+      break;
+    case DXT3:
+      decodeImage<DXT3>(data, width, height, dst);
+      break;
+    case DXT5:
+      decodeImage<DXT5>(data, width, height, dst);
+      break;
+    }
+  }
+
+  void setSimd(bool enabled) {
+    useSimd = enabled;
+  }
+
+}
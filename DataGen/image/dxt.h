@@ -0,0 +1,24 @@
+#pragma once
+
+#include "image.h"
+
+// Decoders for S3TC blocks (DXT1, DXT3 and DXT5, also known as BC1-BC3), shared by the BLP2
+// and DDS readers. Blocks are stored row by row, and blocks that overhang the right or bottom
+// edge of the image are cropped. The output matches the original per-texel decoders exactly.
+namespace DXT {
+
+  enum Format {
+    DXT1,
+    DXT3,
+    DXT5,
+  };
+
+  // bytes taken by a width x height image
+  size_t size(Format format, int width, int height);
+
+  void decode(Format format, uint8 const* data, int width, int height, Image::color_t* bits);
+
+  // The vector paths can be turned off to compare them with the scalar code
+  void setSimd(bool enabled);
+
+}
@@ -18,13 +18,13 @@ decltype(ImageFilter::Lanczos8) ImageFilter::Lanczos8;
 
 namespace ImagePrivate {
 
-  bool imReadPNG(Image& image, File& file);
-  bool imReadBLP2(Image& image, File& file);
-  bool imReadBLP(Image& image, File& file);
-  bool imReadTGA(Image& image, File& file);
-  bool imReadJPG(Image& image, File& file);
-  bool imReadGIF(Image& image, File& file);
-  bool imReadDDS(Image& image, File& file);
+  bool imReadPNG(Image& image, File& file, ImageDecodeOptions const& options);
+  bool imReadBLP2(Image& image, File& file, ImageDecodeOptions const& options);
+  bool imReadBLP(Image& image, File& file, ImageDecodeOptions const& options);
+  bool imReadTGA(Image& image, File& file, ImageDecodeOptions const& options);
+  bool imReadJPG(Image& image, File& file, ImageDecodeOptions const& options);
+  bool imReadGIF(Image& image, File& file, ImageDecodeOptions const& options);
+  bool imReadDDS(Image& image, File& file, ImageDecodeOptions const& options);
   bool imWritePNG(Image const& image, File& file, int gray);
   bool _imWritePNG(Image const& image, File& file) {
     return imWritePNG(image, file, 0);
@@ -36,7 +36,7 @@ namespace ImagePrivate {
     return imWritePNG(image, file, 2);
   }
 
-  typedef bool(*imReader)(Image& image, File& file);
+  typedef bool(*imReader)(Image& image, File& file, ImageDecodeOptions const& options);
   typedef bool(*imWriter)(Image const& image, File& file);
 
   imReader readers[ImageFormat::NumFormats] = {
@@ -82,14 +82,14 @@ namespace ImagePrivate {
     }
   }
 
-  Image imRead(File file, ImageFormat::Type format) {
+  Image imRead(File file, ImageFormat::Type format, ImageDecodeOptions const& options) {
     if (!file) return Image();
     Image image;
-    if (readers[format] && readers[format](image, file)) {
+    if (readers[format] && readers[format](image, file, options)) {
       return image;
     }
     for (auto reader : readers) {
-      if (reader && reader(image, file)) {
+      if (reader && reader(image, file, options)) {
         return image;
       }
     }
@@ -209,6 +209,57 @@ namespace ImageFormat {
   };
 }
 
+// Lets the readers of mipmapped formats (BLP, BLP2 and DDS) decode only the smallest mip level
+// that is still at least width x height, for callers that shrink the image anyway; JPEG data
+// is further reduced by the IDCT. Zero sizes and the other formats give the full image.
+struct ImageDecodeOptions {
+  int width;
+  int height;
+
+  explicit ImageDecodeOptions(int width = 0, int height = 0)
+    : width(width)
+    , height(height)
+  {}
+
+  // mip level to decode out of levels, for a full size of width x height
+  int level(int fullWidth, int fullHeight, int levels) const {
+    int result = 0;
+    if (width <= 0 && height <= 0) return 0;
+    while (result + 1 < levels && (fullWidth >> (result + 1)) >= width && (fullHeight >> (result + 1)) >= height) {
+      ++result;
+    }
+    return result;
+  }
+};
+
+// How hard the PNG writer tries to shrink its output: Fast uses the quickest deflate level,
+// Balanced the zlib default, and Max tries several filter and deflate strategies
+namespace PNGEffort {
+  enum Type {
+    Fast,
+    Balanced,
+    Max,
+  };
+}
+void setPNGEffort(PNGEffort::Type effort);
+// IDCT used for JPEG files and BLPs: Accurate is libjpeg's default integer transform, Fast the
+// quicker and less precise integer one, Float the floating point one
+namespace JPEGDCT {
+  enum Type {
+    Accurate,
+    Fast,
+    Float,
+  };
+}
+void setJPEGDCT(JPEGDCT::Type dct);
+// The vector PNG row filters of both the encoder and the decoder can be turned off to compare
+// them with the scalar code
+void setPNGSimd(bool enabled);
+// Same for the resampling kernels used by ImageBase::resize and scale
+void setResampleSimd(bool enabled);
+// Same for the blending kernels used by ImageBase::blt and modulate
+void setBlendSimd(bool enabled);
+
 struct ImageFilter {
   //enum Type {
   //  Box,
@@ -335,6 +386,25 @@ struct ImageFilter {
   } Lanczos8;
 };
 
+namespace ImagePrivate {
+  // Pixel rows for ImageBase::blt and modulate; Color::Default images use the vectorized
+  // kernels of blend.cpp, which give exactly the results of Color::blend and Color::modulate
+  template<class color_t>
+  void blendRow(color_t* dst, color_t const* src, int count) {
+    for (int i = 0; i < count; ++i) {
+      dst[i] = Color::blend(dst[i], src[i]);
+    }
+  }
+  template<class color_t>
+  void modulateRow(color_t* dst, color_t color, int count) {
+    for (int i = 0; i < count; ++i) {
+      dst[i] = Color::modulate(dst[i], color);
+    }
+  }
+  void blendRow(Color::Default* dst, Color::Default const* src, int count);
+  void modulateRow(Color::Default* dst, Color::Default color, int count);
+}
+
 template<typename color_type>
 class ImageBase {
 public:
@@ -471,6 +541,7 @@ public:
   }
 
   ImageBase(File file, ImageFormat::Type format = ImageFormat::Unknown);
+  ImageBase(File file, ImageDecodeOptions const& options, ImageFormat::Type format = ImageFormat::Unknown);
   bool write(File file, ImageFormat::Type format = ImageFormat::PNG);
   bool read(File file, ImageFormat::Type format = ImageFormat::Unknown);
 
@@ -484,26 +555,29 @@ public:
   ImageBase resize(int width, int height, Filter filter = ImageFilter::Lanczos3) const;
   template<typename Filter = decltype(ImageFilter::Lanczos3)>
   ImageBase scale(double horz, double vert, Filter filter = ImageFilter::Lanczos3) const;
+  // Draws a part of src at (x, y), alpha blended over the current pixels
   void blt(int x, int y, ImageBase const& src, int sx, int sy, int sw, int sh) {
-    int dx = x - sx, dy = y - sy;
-    int x0 = std::max(0, std::max(sx, -dx));
-    int y0 = std::max(0, std::max(sy, -dy));
-    int x1 = std::min(src.width(), std::min(sx + sw, data_->width_ - dx));
-    int y1 = std::min(src.height(), std::min(sy + sh, data_->height_ - dy));
-    if (y1 <= y0 || x1 <= x0) return;
-    splice();
-    for (int y = y0; y < y1; ++y) {
-      color_t const* psrc = src.bits() + y * src.width() + x0;
-      color_t* pdst = data_->bits_ + (y + dy) * data_->width_ + x0 + dx;
-      for (int cnt = x1 - x0; cnt--;) {
-        *pdst = Color::blend(*pdst, *psrc++);
-        ++pdst;
-      }
-    }
+    rows(x, y, src, sx, sy, sw, sh, [](color_t* dst, color_t const* src, int count) {
+      ImagePrivate::blendRow(dst, src, count);
+    });
   }
   void blt(int x, int y, ImageBase const& src) {
     blt(x, y, src, 0, 0, src.width(), src.height());
   }
+  // Same, replacing the current pixels
+  void copy(int x, int y, ImageBase const& src, int sx, int sy, int sw, int sh) {
+    rows(x, y, src, sx, sy, sw, sh, [](color_t* dst, color_t const* src, int count) {
+      memcpy(dst, src, sizeof(color_t) * count);
+    });
+  }
+  void copy(int x, int y, ImageBase const& src) {
+    copy(x, y, src, 0, 0, src.width(), src.height());
+  }
+  // Multiplies every pixel by color, channel by channel
+  void modulate(color_t color) {
+    splice();
+    ImagePrivate::modulateRow(data_->bits_, color, data_->width_ * data_->height_);
+  }
 
 private:
   struct Data {
@@ -521,6 +595,20 @@ private:
     color_t* bits_;
   };
   std::shared_ptr<Data> data_;
+  // clips a blt to both images and calls func(dst, src, count) for every row
+  template<class Func>
+  void rows(int x, int y, ImageBase const& src, int sx, int sy, int sw, int sh, Func func) {
+    int dx = x - sx, dy = y - sy;
+    int x0 = std::max(0, std::max(sx, -dx));
+    int y0 = std::max(0, std::max(sy, -dy));
+    int x1 = std::min(src.width(), std::min(sx + sw, data_->width_ - dx));
+    int y1 = std::min(src.height(), std::min(sy + sh, data_->height_ - dy));
+    if (y1 <= y0 || x1 <= x0) return;
+    splice();
+    for (int y = y0; y < y1; ++y) {
+      func(data_->bits_ + (y + dy) * data_->width_ + x0 + dx, src.bits() + y * src.width() + x0, x1 - x0);
+    }
+  }
   void splice() {
     if (data_.use_count() > 1) {
       auto tmp = std::make_shared<Data>(data_->width_, data_->height_);
@@ -535,7 +623,7 @@ typedef ImageBase<Color::Default> Image;
 namespace ImagePrivate {
   ImageFormat::Type getFormat(std::string const& name);
   bool imWrite(Image const& image, File file, ImageFormat::Type format);
-  Image imRead(File file, ImageFormat::Type format);
+  Image imRead(File file, ImageFormat::Type format, ImageDecodeOptions const& options = ImageDecodeOptions());
 
   template<typename color_t>
   class Accum {
@@ -607,12 +695,44 @@ namespace ImagePrivate {
     std::vector<double> factors;
     std::vector<std::pair<uint32, uint32>> pixels;
   };
+
+  // Vectorized resampling of 8-bit images, with kernels cached by size and filter; the
+  // results are identical to LinScaler's (resample.cpp)
+  void resampleRows(Image const& src, Image& dst, double scale, double radius, ImageFilter::Function filter);
+  void resampleColumns(Image const& src, Image& dst, double scale, double radius, ImageFilter::Function filter);
+
+  template<class color_t, class Filter>
+  void scaleRows(ImageBase<color_t> const& src, ImageBase<color_t>& dst, double scale, Filter) {
+    LinScaler<color_t, Filter> scaler(src.width(), dst.width(), scale);
+    for (int y = 0; y < src.height(); ++y) {
+      scaler.scale(src.bits() + y * src.width(), 1, dst.mutable_bits() + y * dst.width(), 1);
+    }
+  }
+  template<class color_t, class Filter>
+  void scaleColumns(ImageBase<color_t> const& src, ImageBase<color_t>& dst, double scale, Filter) {
+    LinScaler<color_t, Filter> scaler(src.height(), dst.height(), scale);
+    for (int x = 0; x < src.width(); ++x) {
+      scaler.scale(src.bits() + x, src.width(), dst.mutable_bits() + x, dst.width());
+    }
+  }
+  template<class Filter>
+  void scaleRows(Image const& src, Image& dst, double scale, Filter) {
+    resampleRows(src, dst, scale, Filter::radius(), Filter::value);
+  }
+  template<class Filter>
+  void scaleColumns(Image const& src, Image& dst, double scale, Filter) {
+    resampleColumns(src, dst, scale, Filter::radius(), Filter::value);
+  }
 }
 
 template<class color_t>
 ImageBase<color_t>::ImageBase(File file, ImageFormat::Type format)
   : ImageBase(ImagePrivate::imRead(file, format))
 {}
+template<class color_t>
+ImageBase<color_t>::ImageBase(File file, ImageDecodeOptions const& options, ImageFormat::Type format)
+  : ImageBase(ImagePrivate::imRead(file, format, options))
+{}
 #ifndef NO_SYSTEM
 template<class color_t>
 ImageBase<color_t>::ImageBase(std::string const& path, ImageFormat::Type format)
@@ -647,19 +767,13 @@ template<typename Filter>
 ImageBase<color_t> ImageBase<color_t>::resize(int width, int height, Filter filter) const {
   ImageBase<color_t> cur(*this);
   if (cur.width() != width) {
-    ImagePrivate::LinScaler<color_t, Filter> scaler(cur.width(), width, static_cast<double>(width) / static_cast<double>(cur.width()));
     ImageBase<color_t> next(width, cur.height());
-    for (int y = 0; y < cur.height(); ++y) {
-      scaler.scale(cur.bits() + y * cur.width(), 1, next.mutable_bits() + y * next.width(), 1);
-    }
+    ImagePrivate::scaleRows(cur, next, static_cast<double>(width) / static_cast<double>(cur.width()), filter);
     cur = next;
   }
   if (cur.height() != height) {
-    ImagePrivate::LinScaler<color_t, Filter> scaler(cur.height(), height, static_cast<double>(height) / static_cast<double>(cur.height()));
     ImageBase<color_t> next(cur.width(), height);
-    for (int x = 0; x < cur.width(); ++x) {
-      scaler.scale(cur.bits() + x, cur.width(), next.mutable_bits() + x, next.width());
-    }
+    ImagePrivate::scaleColumns(cur, next, static_cast<double>(height) / static_cast<double>(cur.height()), filter);
     cur = next;
   }
   return cur;
@@ -670,20 +784,14 @@ ImageBase<color_t> ImageBase<color_t>::scale(double horz, double vert, Filter fi
   ImageBase<color_t> cur(*this);
   if (horz != 1) {
     uint32 width = static_cast<int>(ceil(static_cast<double>(cur.width()) * horz));
-    ImagePrivate::LinScaler<color_t, Filter> scaler(cur.width(), width, horz);
     ImageBase<color_t> next(width, cur.height());
-    for (int y = 0; y < cur.height(); ++y) {
-      scaler.scale(cur.bits() + y * cur.width(), 1, next.mutable_bits() + y * next.width(), 1);
-    }
+    ImagePrivate::scaleRows(cur, next, horz, filter);
     cur = next;
   }
   if (vert != 1) {
     uint32 height = static_cast<int>(ceil(static_cast<double>(cur.height()) * vert));
-    ImagePrivate::LinScaler<color_t, Filter> scaler(cur.height(), height, vert);
     ImageBase<color_t> next(cur.width(), height);
-    for (int x = 0; x < cur.width(); ++x) {
-      scaler.scale(cur.bits() + x, cur.width(), next.mutable_bits() + x, next.width());
-    }
+    ImagePrivate::scaleColumns(cur, next, vert, filter);
     cur = next;
   }
   return cur;
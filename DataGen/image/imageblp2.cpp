@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include "image.h"
+#include "dxt.h"
 //#include <intrin.h>
 #include <vector>
 
@@ -58,110 +59,24 @@ namespace _blp2 {
     return true;
   }
 
-  typedef Color::XRGB<0, 5, 6, 5> FormatDXT;
-
   bool load_dxt1(uint8* src, uint32 length, Image::color_t* bits, BLP2Header const& hdr) {
     if (hdr.width < 4 || hdr.height < 4) return false;
     if (length != hdr.width * hdr.height / 2) return false;
-    for (uint32 y = 0; y < hdr.height; y += 4) {
-      for (uint32 x = 0; x < hdr.width; x += 4) {
-        FormatDXT p = *(uint16*)src;
-        FormatDXT q = *(uint16*)(src + 2);
-        uint32 lookup = *(uint32*)(src + 4);
-        src += 8;
-        Image::color_t c[4] = { p, q };
-        if (p > q) {
-          c[2] = Color::mix(c[0], 2, c[1], 1);
-          c[3] = Color::mix(c[0], 1, c[1], 2);
-        } else {
-          c[2] = Color::mix(c[0], 1, c[1], 1);
-          c[3] = 0;
-        }
-        for (uint32 cy = y; cy < y + 4; ++cy) {
-          Image::color_t* dst = bits + cy * hdr.width + x;
-          for (uint32 cx = x; cx < x + 4; ++cx) {
-            *dst++ = c[lookup & 3];
-            lookup >>= 2;
-          }
-        }
-      }
-    }
+    DXT::decode(DXT::DXT1, src, hdr.width, hdr.height, bits);
     return true;
   }
 
   bool load_dxt3(uint8* src, uint32 length, Image::color_t* bits, BLP2Header const& hdr) {
     if (hdr.width < 4 || hdr.height < 4) return false;
     if (length != hdr.width * hdr.height) return false;
-    for (uint32 y = 0; y < hdr.height; y += 4) {
-      for (uint32 x = 0; x < hdr.width; x += 4) {
-        uint64 alpha = *(uint64*)src;
-        FormatDXT p = *(uint16*)(src + 8);
-        FormatDXT q = *(uint16*)(src + 10);
-        uint32 lookup = *(uint32*)(src + 12);
-        Image::color_t c[4] = { p, q };
-        c[2] = Color::mix(c[0], 2, c[1], 1);
-        c[3] = Color::mix(c[0], 1, c[1], 2);
-        for (uint32 cy = y; cy < y + 4; ++cy) {
-          Image::color_t* dst = bits + cy * hdr.width + x;
-          for (uint32 cx = x; cx < x + 4; ++cx) {
-            *dst = c[lookup & 3];
-            dst->alpha = (alpha & 15) * 255 / 15;
-            dst++;
-            lookup >>= 2;
-            alpha >>= 4;
-          }
-        }
-      }
-    }
+    DXT::decode(DXT::DXT3, src, hdr.width, hdr.height, bits);
     return true;
   }
 
   bool load_dxt5(uint8* src, uint32 length, Image::color_t* bits, BLP2Header const& hdr) {
     if (hdr.width < 4 || hdr.height < 4) return false;
     if (length != hdr.width * hdr.height) return false;
-    for (uint32 y = 0; y < hdr.height; y += 4) {
-      for (uint32 x = 0; x < hdr.width; x += 4) {
-        uint32 a0 = *src++;
-        uint32 a1 = *src++;
-        uint64 amap = 0;
-        for (int i = 0; i < 48; i += 8) {
-          amap |= (static_cast<uint64>(*src++) << i);
-        }
-        FormatDXT p = *(uint16*)src;
-        FormatDXT q = *(uint16*)(src + 2);
-        uint32 lookup = *(uint32*)(src + 4);
-        src += 8;
-        Image::color_t c[4] = { p, q };
-        c[2] = Color::mix(c[0], 2, c[1], 1);
-        c[3] = Color::mix(c[0], 1, c[1], 2);
-        uint32 a[8] = { a0, a1 };
-        if (a0 > a1) {
-          a[2] = (a0 * 6 + a1 * 1) / 7;
-          a[3] = (a0 * 5 + a1 * 2) / 7;
-          a[4] = (a0 * 4 + a1 * 3) / 7;
-          a[5] = (a0 * 3 + a1 * 4) / 7;
-          a[6] = (a0 * 2 + a1 * 5) / 7;
-          a[7] = (a0 * 1 + a1 * 6) / 7;
-        } else {
-          a[2] = (a0 * 4 + a1 * 1) / 5;
-          a[3] = (a0 * 3 + a1 * 2) / 5;
-          a[4] = (a0 * 2 + a1 * 3) / 5;
-          a[5] = (a0 * 1 + a1 * 4) / 5;
-          a[6] = 0;
-          a[7] = 255;
-        }
-        for (uint32 cy = y; cy < y + 4; ++cy) {
-          Image::color_t* dst = bits + cy * hdr.width + x;
-          for (uint32 cx = x; cx < x + 4; ++cx) {
-            *dst = c[lookup & 3];
-            dst->alpha = a[amap & 7];
-            dst++;
-            lookup >>= 2;
-            amap >>= 3;
-          }
-        }
-      }
-    }
+    DXT::decode(DXT::DXT5, src, hdr.width, hdr.height, bits);
     return true;
   }
 
@@ -170,7 +85,7 @@ namespace _blp2 {
 using namespace _blp2;
 
 namespace ImagePrivate {
-  bool imReadBLP2(Image& image, File& file) {
+  bool imReadBLP2(Image& image, File& file, ImageDecodeOptions const& options) {
     BLP2Header hdr;
     file.seek(0, SEEK_SET);
     if (file.read(&hdr, sizeof hdr) != sizeof hdr) {
@@ -188,9 +103,21 @@ namespace ImagePrivate {
     if ((hdr.width & (hdr.width - 1)) != 0) return false;
     if ((hdr.height & (hdr.height - 1)) != 0) return false;
 
-    std::vector<uint8> src(hdr.lengths[0]);
-    file.seek(hdr.offsets[0], SEEK_SET);
-    if (file.read(&src[0], hdr.lengths[0]) != hdr.lengths[0]) {
+    // the loaders take the size of the decoded level from the header; compressed levels
+    // smaller than a block are not used
+    int levels = 0;
+    while (hdr.hasMips && levels < 16 && hdr.offsets[levels] && hdr.lengths[levels] &&
+        (hdr.encoding == 1 || ((hdr.width >> levels) >= 4 && (hdr.height >> levels) >= 4))) {
+      ++levels;
+    }
+    int level = options.level(hdr.width, hdr.height, std::max(levels, 1));
+    uint32 length = hdr.lengths[level];
+    hdr.width = std::max<uint32>(hdr.width >> level, 1);
+    hdr.height = std::max<uint32>(hdr.height >> level, 1);
+
+    std::vector<uint8> src(length);
+    file.seek(hdr.offsets[level], SEEK_SET);
+    if (!length || file.read(&src[0], length) != length) {
       return false;
     }
 
@@ -199,13 +126,13 @@ namespace ImagePrivate {
 
     bool result = false;
     if (hdr.encoding == 1) {
-      result = load_raw(&src[0], hdr.lengths[0], bits, hdr);
+      result = load_raw(&src[0], length, bits, hdr);
     } else if (hdr.alphaDepth <= 1) {
-      result = load_dxt1(&src[0], hdr.lengths[0], bits, hdr);
+      result = load_dxt1(&src[0], length, bits, hdr);
     } else if (hdr.alphaEncoding != 7) {
-      result = load_dxt3(&src[0], hdr.lengths[0], bits, hdr);
+      result = load_dxt3(&src[0], length, bits, hdr);
     } else {
-      result = load_dxt5(&src[0], hdr.lengths[0], bits, hdr);
+      result = load_dxt5(&src[0], length, bits, hdr);
     }
 
     return result;
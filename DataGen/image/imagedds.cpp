@@ -1,5 +1,7 @@
 #include <stdlib.h>
 #include "image.h"
+#include "dxt.h"
+#include "bptc.h"
 #include <vector>
 
 namespace _dds {
@@ -53,6 +55,37 @@ namespace _dds {
     uint32 dwReserved2;
   };
 
+  // follows DDS_HEADER when the fourcc is 'DX10'
+  struct DDS_HEADER_DXT10 {
+    uint32 dxgiFormat;
+    uint32 resourceDimension;
+    uint32 miscFlag;
+    uint32 arraySize;
+    uint32 miscFlags2;
+  };
+
+  enum {
+    DXGI_FORMAT_B8G8R8A8_UNORM = 87,
+    DXGI_FORMAT_B8G8R8A8_UNORM_SRGB = 91,
+    DXGI_FORMAT_BC1_TYPELESS = 70,
+    DXGI_FORMAT_BC1_UNORM = 71,
+    DXGI_FORMAT_BC1_UNORM_SRGB = 72,
+    DXGI_FORMAT_BC2_TYPELESS = 73,
+    DXGI_FORMAT_BC2_UNORM = 74,
+    DXGI_FORMAT_BC2_UNORM_SRGB = 75,
+    DXGI_FORMAT_BC3_TYPELESS = 76,
+    DXGI_FORMAT_BC3_UNORM = 77,
+    DXGI_FORMAT_BC3_UNORM_SRGB = 78,
+    DXGI_FORMAT_BC4_UNORM = 80,
+    DXGI_FORMAT_BC5_UNORM = 83,
+    DXGI_FORMAT_BC6H_TYPELESS = 94,
+    DXGI_FORMAT_BC6H_UF16 = 95,
+    DXGI_FORMAT_BC6H_SF16 = 96,
+    DXGI_FORMAT_BC7_TYPELESS = 97,
+    DXGI_FORMAT_BC7_UNORM = 98,
+    DXGI_FORMAT_BC7_UNORM_SRGB = 99,
+  };
+
   struct RGBInfo {
     uint32 redMask;
     uint32 redShift;
@@ -89,199 +122,52 @@ namespace _dds {
     }
   };
 
-  typedef Color::XRGB<0, 5, 6, 5> FormatDXT;
-  struct LoadDXT1 {
-    static size_t blocks(int width, int height) {
-      return ((width + 3) & -4) * ((height + 3) & -4) / 16;
-    }
-    static size_t size(int width, int height) {
-      return blocks(width, height) * 8;
-    }
-    static Image decode(int width, int height, uint8 const* data) {
-      Image image(width, height);
-      Image::color_t* bits = image.mutable_bits();
-      for (uint32 y = 0; y < height; y += 4) {
-        for (uint32 x = 0; x < width; x += 4) {
-          FormatDXT p = *(uint16*)data;
-          FormatDXT q = *(uint16*)(data + 2);
-          uint32 lookup = *(uint32*)(data + 4);
-          data += 8;
-          Image::color_t c[4] = { p, q };
-          if (p > q) {
-            c[2] = Color::mix(c[0], 2, c[1], 1);
-            c[3] = Color::mix(c[0], 1, c[1], 2);
-          } else {
-            c[2] = Color::mix(c[0], 1, c[1], 1);
-            c[3] = 0;
-          }
-          for (uint32 cy = y; cy < y + 4; ++cy) {
-            Image::color_t* dst = bits + cy * width + x;
-            for (uint32 cx = x; cx < x + 4; ++cx) {
-              *dst++ = c[lookup & 3];
-              lookup >>= 2;
-            }
-          }
-        }
-      }
-      return image;
-    }
-  };
-
-  struct LoadDXT3 {
-    static size_t blocks(int width, int height) {
-      return ((width + 3) & -4) * ((height + 3) & -4) / 16;
-    }
+  template<DXT::Format F>
+  struct LoadDXT {
     static size_t size(int width, int height) {
-      return blocks(width, height) * 16;
+      return DXT::size(F, width, height);
     }
     static Image decode(int width, int height, uint8 const* data) {
       Image image(width, height);
-      Image::color_t* bits = image.mutable_bits();
-      for (uint32 y = 0; y < height; y += 4) {
-        for (uint32 x = 0; x < width; x += 4) {
-          uint64 alpha = *(uint64*)data;
-          FormatDXT p = *(uint16*)(data + 8);
-          FormatDXT q = *(uint16*)(data + 10);
-          uint32 lookup = *(uint32*)(data + 12);
-          Image::color_t c[4] = { p, q };
-          c[2] = Color::mix(c[0], 2, c[1], 1);
-          c[3] = Color::mix(c[0], 1, c[1], 2);
-          data += 16;
-          for (uint32 cy = y; cy < y + 4; ++cy) {
-            Image::color_t* dst = bits + cy * width + x;
-            for (uint32 cx = x; cx < x + 4; ++cx) {
-              *dst = c[lookup & 3];
-              dst->alpha = (alpha & 15) * 255 / 15;
-              dst++;
-              lookup >>= 2;
-              alpha >>= 4;
-            }
-          }
-        }
-      }
+      DXT::decode(F, data, width, height, image.mutable_bits());
       return image;
     }
   };
+  typedef LoadDXT<DXT::DXT1> LoadDXT1;
+  typedef LoadDXT<DXT::DXT3> LoadDXT3;
+  typedef LoadDXT<DXT::DXT5> LoadDXT5;
 
+  // DXT5 with premultiplied alpha
   struct LoadDXT4 {
-    static size_t blocks(int width, int height) {
-      return ((width + 3) & -4) * ((height + 3) & -4) / 16;
-    }
     static size_t size(int width, int height) {
-      return blocks(width, height) * 16;
+      return DXT::size(DXT::DXT5, width, height);
     }
     static Image decode(int width, int height, uint8 const* data) {
-      Image image(width, height);
+      Image image = LoadDXT5::decode(width, height, data);
       Image::color_t* bits = image.mutable_bits();
-      for (uint32 y = 0; y < height; y += 4) {
-        for (uint32 x = 0; x < width; x += 4) {
-          uint32 a0 = *data++;
-          uint32 a1 = *data++;
-          uint64 amap = 0;
-          for (int i = 0; i < 48; i += 8) {
-            amap |= (static_cast<uint64>(*data++) << i);
-          }
-          FormatDXT p = *(uint16*)data;
-          FormatDXT q = *(uint16*)(data + 2);
-          uint32 lookup = *(uint32*)(data + 4);
-          data += 8;
-          Image::color_t c[4] = { p, q };
-          c[2] = Color::mix(c[0], 2, c[1], 1);
-          c[3] = Color::mix(c[0], 1, c[1], 2);
-          uint32 a[8] = { a0, a1 };
-          if (a0 > a1) {
-            a[2] = (a0 * 6 + a1 * 1) / 7;
-            a[3] = (a0 * 5 + a1 * 2) / 7;
-            a[4] = (a0 * 4 + a1 * 3) / 7;
-            a[5] = (a0 * 3 + a1 * 4) / 7;
-            a[6] = (a0 * 2 + a1 * 5) / 7;
-            a[7] = (a0 * 1 + a1 * 6) / 7;
-          } else {
-            a[2] = (a0 * 4 + a1 * 1) / 5;
-            a[3] = (a0 * 3 + a1 * 2) / 5;
-            a[4] = (a0 * 2 + a1 * 3) / 5;
-            a[5] = (a0 * 1 + a1 * 4) / 5;
-            a[6] = 0;
-            a[7] = 255;
-          }
-          for (uint32 cy = y; cy < y + 4; ++cy) {
-            Image::color_t* dst = bits + cy * width + x;
-            for (uint32 cx = x; cx < x + 4; ++cx) {
-              Image::color_t color = c[lookup & 3];
-              int alpha = a[amap & 7];
-              if (alpha) {
-                color = Image::color_t(
-                  color.red * 255 / alpha,
-                  color.green * 255 / alpha,
-                  color.blue * 255 / alpha
-                );
-              } else {
-                color.alpha = alpha;
-              }
-              *dst++ = color;
-              lookup >>= 2;
-              amap >>= 3;
-            }
-          }
+      for (int i = 0; i < width * height; ++i) {
+        Image::color_t& color = bits[i];
+        int alpha = color.alpha;
+        if (alpha) {
+          color = Image::color_t(
+            color.red * 255 / alpha,
+            color.green * 255 / alpha,
+            color.blue * 255 / alpha
+          );
         }
       }
       return image;
     }
   };
 
-  struct LoadDXT5 {
-    static size_t blocks(int width, int height) {
-      return ((width + 3) & -4) * ((height + 3) & -4) / 16;
-    }
+  template<BPTC::Format F>
+  struct LoadBPTC {
     static size_t size(int width, int height) {
-      return blocks(width, height) * 16;
+      return BPTC::size(width, height);
     }
     static Image decode(int width, int height, uint8 const* data) {
       Image image(width, height);
-      Image::color_t* bits = image.mutable_bits();
-      for (uint32 y = 0; y < height; y += 4) {
-        for (uint32 x = 0; x < width; x += 4) {
-          uint32 a0 = *data++;
-          uint32 a1 = *data++;
-          uint64 amap = 0;
-          for (int i = 0; i < 48; i += 8) {
-            amap |= (static_cast<uint64>(*data++) << i);
-          }
-          FormatDXT p = *(uint16*)data;
-          FormatDXT q = *(uint16*)(data + 2);
-          uint32 lookup = *(uint32*)(data + 4);
-          data += 8;
-          Image::color_t c[4] = { p, q };
-          c[2] = Color::mix(c[0], 2, c[1], 1);
-          c[3] = Color::mix(c[0], 1, c[1], 2);
-          uint32 a[8] = { a0, a1 };
-          if (a0 > a1) {
-            a[2] = (a0 * 6 + a1 * 1) / 7;
-            a[3] = (a0 * 5 + a1 * 2) / 7;
-            a[4] = (a0 * 4 + a1 * 3) / 7;
-            a[5] = (a0 * 3 + a1 * 4) / 7;
-            a[6] = (a0 * 2 + a1 * 5) / 7;
-            a[7] = (a0 * 1 + a1 * 6) / 7;
-          } else {
-            a[2] = (a0 * 4 + a1 * 1) / 5;
-            a[3] = (a0 * 3 + a1 * 2) / 5;
-            a[4] = (a0 * 2 + a1 * 3) / 5;
-            a[5] = (a0 * 1 + a1 * 4) / 5;
-            a[6] = 0;
-            a[7] = 255;
-          }
-          for (uint32 cy = y; cy < y + 4; ++cy) {
-            Image::color_t* dst = bits + cy * width + x;
-            for (uint32 cx = x; cx < x + 4; ++cx) {
-              *dst = c[lookup & 3];
-              dst->alpha = a[amap & 7];
-              dst++;
-              lookup >>= 2;
-              amap >>= 3;
-            }
-          }
-        }
-      }
+      BPTC::decode(F, data, width, height, image.mutable_bits());
       return image;
     }
   };
@@ -296,8 +182,8 @@ namespace _dds {
     static Image decode(int width, int height, uint8 const* data) {
       Image image(width, height);
       Image::color_t* bits = image.mutable_bits();
-      for (uint32 y = 0; y < height; y += 4) {
-        for (uint32 x = 0; x < width; x += 4) {
+      for (int y = 0; y < height; y += 4) {
+        for (int x = 0; x < width; x += 4) {
           uint32 a0 = *data++;
           uint32 a1 = *data++;
           uint64 amap = 0;
@@ -320,10 +206,10 @@ namespace _dds {
             a[6] = 0;
             a[7] = 255;
           }
-          for (uint32 cy = y; cy < y + 4; ++cy) {
+          for (int cy = y; cy < y + 4 && cy < height; ++cy) {
             Image::color_t* dst = bits + cy * width + x;
-            for (uint32 cx = x; cx < x + 4; ++cx) {
-              *dst++ = Image::color_t(a[amap & 7], a[amap & 7], a[amap & 7]);
+            for (int cx = x; cx < x + 4; ++cx) {
+              if (cx < width) *dst++ = Image::color_t(a[amap & 7], a[amap & 7], a[amap & 7]);
               amap >>= 3;
             }
           }
@@ -343,8 +229,8 @@ namespace _dds {
     static Image decode(int width, int height, uint8 const* data) {
       Image image(width, height);
       Image::color_t* bits = image.mutable_bits();
-      for (uint32 y = 0; y < height; y += 4) {
-        for (uint32 x = 0; x < width; x += 4) {
+      for (int y = 0; y < height; y += 4) {
+        for (int x = 0; x < width; x += 4) {
           uint32 a0 = *data++;
           uint32 a1 = *data++;
           uint64 amap = 0;
@@ -389,10 +275,10 @@ namespace _dds {
             b[6] = 0;
             b[7] = 255;
           }
-          for (uint32 cy = y; cy < y + 4; ++cy) {
+          for (int cy = y; cy < y + 4 && cy < height; ++cy) {
             Image::color_t* dst = bits + cy * width + x;
-            for (uint32 cx = x; cx < x + 4; ++cx) {
-              *dst++ = Image::color_t(a[amap & 7], b[bmap & 7], 0);
+            for (int cx = x; cx < x + 4; ++cx) {
+              if (cx < width) *dst++ = Image::color_t(a[amap & 7], b[bmap & 7], 0);
               amap >>= 3;
               bmap >>= 3;
             }
@@ -475,29 +361,59 @@ namespace _dds {
     }
   };
 
+  // mip levels follow the top level, each half the size of the previous one
   template<class Loader>
-  Image LoadProxy(File file, DDS_HEADER const& hdr) {
-    size_t size = Loader::size(hdr.dwWidth, hdr.dwHeight);
+  Image LoadProxy(File file, DDS_HEADER const& hdr, int level) {
+    int width = hdr.dwWidth, height = hdr.dwHeight;
+    for (; level > 0; --level) {
+      file.seek(Loader::size(width, height), SEEK_CUR);
+      width = std::max(width >> 1, 1);
+      height = std::max(height >> 1, 1);
+    }
+    size_t size = Loader::size(width, height);
     std::vector<uint8> data(size);
     if (file.read(data.data(), size) != size) return Image();
-    return Loader::decode(hdr.dwWidth, hdr.dwHeight, data.data());
+    return Loader::decode(width, height, data.data());
   }
 
   struct Loader {
     uint32 id;
-    Image(*load)(File file, DDS_HEADER const& hdr);
+    Image(*load)(File file, DDS_HEADER const& hdr, int level);
   };
   Loader base_loaders[] = {
     { 'DXT1', LoadProxy<LoadDXT1> },
+    { 'DXT3', LoadProxy<LoadDXT3> },
     { 'DXT4', LoadProxy<LoadDXT4> },
     { 'DXT5', LoadProxy<LoadDXT5> },
   };
+  // formats of DX10 headers, by DXGI_FORMAT
+  Loader dx10_loaders[] = {
+    { DXGI_FORMAT_B8G8R8A8_UNORM, LoadProxy<LoadRaw<Image::color_t>> },
+    { DXGI_FORMAT_B8G8R8A8_UNORM_SRGB, LoadProxy<LoadRaw<Image::color_t>> },
+    { DXGI_FORMAT_BC1_TYPELESS, LoadProxy<LoadDXT1> },
+    { DXGI_FORMAT_BC1_UNORM, LoadProxy<LoadDXT1> },
+    { DXGI_FORMAT_BC1_UNORM_SRGB, LoadProxy<LoadDXT1> },
+    { DXGI_FORMAT_BC2_TYPELESS, LoadProxy<LoadDXT3> },
+    { DXGI_FORMAT_BC2_UNORM, LoadProxy<LoadDXT3> },
+    { DXGI_FORMAT_BC2_UNORM_SRGB, LoadProxy<LoadDXT3> },
+    { DXGI_FORMAT_BC3_TYPELESS, LoadProxy<LoadDXT5> },
+    { DXGI_FORMAT_BC3_UNORM, LoadProxy<LoadDXT5> },
+    { DXGI_FORMAT_BC3_UNORM_SRGB, LoadProxy<LoadDXT5> },
+    { DXGI_FORMAT_BC4_UNORM, LoadProxy<LoadBC4> },
+    { DXGI_FORMAT_BC5_UNORM, LoadProxy<LoadBC5> },
+    { DXGI_FORMAT_BC6H_TYPELESS, LoadProxy<LoadBPTC<BPTC::BC6H_UF16>> },
+    { DXGI_FORMAT_BC6H_UF16, LoadProxy<LoadBPTC<BPTC::BC6H_UF16>> },
+    { DXGI_FORMAT_BC6H_SF16, LoadProxy<LoadBPTC<BPTC::BC6H_SF16>> },
+    { DXGI_FORMAT_BC7_TYPELESS, LoadProxy<LoadBPTC<BPTC::BC7>> },
+    { DXGI_FORMAT_BC7_UNORM, LoadProxy<LoadBPTC<BPTC::BC7>> },
+    { DXGI_FORMAT_BC7_UNORM_SRGB, LoadProxy<LoadBPTC<BPTC::BC7>> },
+  };
 }
 
 using namespace _dds;
 
 namespace ImagePrivate {
-  bool imReadDDS(Image& image, File& file) {
+  bool imReadDDS(Image& image, File& file, ImageDecodeOptions const& options) {
     file.seek(0, SEEK_SET);
     if (file.read32() != 0x20534444) return false;
     DDS_HEADER hdr;
@@ -511,14 +427,35 @@ namespace ImagePrivate {
     if (hdr.ddspf.dwFlags & DDPF_FOURCC) {
       flip(hdr.ddspf.dwFourCC);
       Loader const* loader = nullptr;
-      for (auto& ldr : base_loaders) {
-        if (ldr.id == hdr.ddspf.dwFourCC) {
-          loader = &ldr;
-          break;
+      if (hdr.ddspf.dwFourCC == 'DX10') {
+        DDS_HEADER_DXT10 hdr10;
+        if (file.read(&hdr10, sizeof hdr10) != sizeof hdr10) {
+          return false;
+        }
+        for (auto& ldr : dx10_loaders) {
+          if (ldr.id == hdr10.dxgiFormat) {
+            loader = &ldr;
+            break;
+          }
+        }
+      } else {
+        for (auto& ldr : base_loaders) {
+          if (ldr.id == hdr.ddspf.dwFourCC) {
+            loader = &ldr;
+            break;
+          }
         }
       }
       if (!loader) return false;
-      image = loader->load(file, hdr);
+      int levels = (hdr.dwFlags & DDSD_MIPMAPCOUNT ? std::min<int>(std::max<int>(hdr.dwMipMapCount, 1), 16) : 1);
+      int level = options.level(hdr.dwWidth, hdr.dwHeight, levels);
+      uint64 pos = file.tell();
+      image = loader->load(file, hdr, level);
+      if (!image && level) {
+        // the mip count may promise more than the file holds
+        file.seek(pos);
+        image = loader->load(file, hdr, 0);
+      }
       return image;
     } else if (hdr.ddspf.dwFlags & DDPF_RGB) {
       image = Image(hdr.dwWidth, hdr.dwHeight);
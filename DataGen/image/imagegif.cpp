@@ -97,7 +97,7 @@ struct GifDecoder {
 };
 
 namespace ImagePrivate {
-  bool imReadGIF(Image& image, File& file) {
+  bool imReadGIF(Image& image, File& file, ImageDecodeOptions const& options) {
     file.seek(0, SEEK_SET);
     GifHeader hdr;
     GifDecoder gif;
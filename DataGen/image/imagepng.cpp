@@ -1,6 +1,8 @@
 #include "image.h"
 #include <vector>
 #include "utils/common.h"
+#include "utils/simd.h"
+#include "zlib/zlib.h"
 
 namespace ImagePrivate {
 
@@ -8,14 +10,13 @@ namespace ImagePrivate {
 
     unsigned char const pngSignature[8] = { 0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A };
 
+    // data points either into the file, when it is held in memory, or into buffer
     struct PNGChunk {
       uint32 length;
       uint32 type;
-      uint8* data = nullptr;
+      uint8 const* data = nullptr;
       uint32 crc;
-      ~PNGChunk() {
-        delete[] data;
-      }
+      std::vector<uint8> buffer;
     };
 
 #pragma pack(push, 1)
@@ -30,34 +31,26 @@ namespace ImagePrivate {
     };
 #pragma	pack(pop)
 
+    // same CRC as zlib's, which pre- and post-inverts it (and resets it for a null buffer)
     uint32 update_crc(uint32 crc, void const* vbuf, uint32 length) {
-      static uint32 crc_table[256];
-      static bool table_computed = false;
-      uint8 const* buf = (uint8*)vbuf;
-      if (!table_computed) {
-        for (uint32 i = 0; i < 256; i++) {
-          uint32 c = i;
-          for (int k = 0; k < 8; k++) {
-            if (c & 1) c = 0xEDB88320L ^ (c >> 1);
-            else c = c >> 1;
-          }
-          crc_table[i] = c;
-        }
-        table_computed = true;
-      }
-      for (uint32 i = 0; i < length; i++) {
-        crc = crc_table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
-      }
-      return crc;
+      if (!length) return crc;
+      return ~uint32(crc32(~crc, static_cast<Bytef const*>(vbuf), length));
     }
     bool read_chunk(PNGChunk& ch, File& f) {
-      delete[] ch.data;
       ch.data = NULL;
       if (f.read(&ch.length, 4) != 4) return false;
       if (f.read(&ch.type, 4) != 4) return false;
       flip(ch.length);
-      ch.data = new uint8[ch.length];
-      if (f.read(ch.data, ch.length) != ch.length) return false;
+      uint8 const* mem = f.data();
+      uint64 pos = f.tell();
+      if (mem && pos + ch.length <= f.size()) {
+        ch.data = mem + pos;
+        f.seek(ch.length, SEEK_CUR);
+      } else {
+        if (ch.buffer.size() < ch.length) ch.buffer.resize(ch.length);
+        if (f.read(ch.buffer.data(), ch.length) != ch.length) return false;
+        ch.data = ch.buffer.data();
+      }
       if (f.read(&ch.crc, 4) != 4) return false;
       flip(ch.crc);
       uint32 crc = update_crc(0xFFFFFFFF, &ch.type, 4);
@@ -94,12 +87,6 @@ namespace ImagePrivate {
       default: return hdr.bitDepth;
       }
     }
-    uint32 get_image_size(uint32 width, uint32 height, PNGHeader const& hdr) {
-      uint32 bpp = bitsPerPixel(hdr);
-      uint32 bpl = (bpp * width + 7) / 8;
-      return height * (bpl + 1);
-    }
-
     uint8 paethPredictor(uint8 a, uint8 b, uint8 c) {
       int ia = int(a) & 0xFF;
       int ib = int(b) & 0xFF;
@@ -168,90 +155,9 @@ namespace ImagePrivate {
       }
     }
 
-    uint8 fix_sample(uint8 cur, uint8 a, uint8 b, uint8 c, uint8 filter) {
-      switch (filter) {
-      case 0: return cur;
-      case 1: return cur + a;
-      case 2: return cur + b;
-      case 3: return cur + (a + b) / 2;
-      case 4: return cur + paethPredictor(a, b, c);
-      default: return cur;
-      }
-    }
-
-    bool read_sub_image(uint32 width, uint32 height, Image::color_t* data,
-      uint8 const* src, PNGHeader const& hdr, PNGPalette const& pal) {
-      uint32 bpp = bitsPerPixel(hdr);
-      uint32 bpl = (bpp * width + 7) / 8;
-      bpp = (bpp + 7) / 8;
-
-      std::vector<uint8> prevLine(bpl, 0);
-      std::vector<uint8> curLine(bpl);
-
-      for (uint32 y = 0; y < height; y++) {
-        uint8 filter = *src++;
-        if (filter > 4) {
-          return false;
-        }
-        for (uint32 i = 0; i < bpl; i++) {
-          uint8 cur = src[i];
-          uint8 a = i < bpp ? 0 : curLine[i - bpp];
-          uint8 b = prevLine[i];
-          uint8 c = i < bpp ? 0 : prevLine[i - bpp];
-          curLine[i] = fix_sample(cur, a, b, c, filter);
-        }
-        BitStream buf(&curLine[0]);
-        for (uint32 x = 0; x < width; x++) {
-          Image::color_t cur = 0;
-          if (hdr.colorType == 0) {
-            uint32 gray = buf.read(hdr.bitDepth);
-            if (pal.useColorKey && gray == pal.colorKey[0]) {
-              cur = 0;
-            } else {
-              gray = fix_color(gray, hdr.bitDepth);
-              cur = Image::color_t(gray, gray, gray);
-            }
-          } else if (hdr.colorType == 2) {
-            uint32 red = buf.read(hdr.bitDepth);
-            uint32 green = buf.read(hdr.bitDepth);
-            uint32 blue = buf.read(hdr.bitDepth);
-            if (pal.useColorKey && red == pal.colorKey[0] &&
-              green == pal.colorKey[1] && blue == pal.colorKey[2]) {
-              cur = 0;
-            } else {
-              cur = Image::color_t(fix_color(red, hdr.bitDepth),
-                fix_color(green, hdr.bitDepth), fix_color(blue, hdr.bitDepth));
-            }
-          } else if (hdr.colorType == 3) {
-            uint32 index = buf.read(hdr.bitDepth);
-            if (index >= pal.size) {
-              return false;
-            }
-            cur = pal.rgba[index];
-          } else if (hdr.colorType == 4) {
-            uint32 gray = fix_color(buf.read(hdr.bitDepth), hdr.bitDepth);
-            uint32 alpha = fix_color(buf.read(hdr.bitDepth), hdr.bitDepth);
-            cur = Image::color_t(gray, gray, gray, alpha);
-          } else if (hdr.colorType == 6) {
-            uint32 red = fix_color(buf.read(hdr.bitDepth), hdr.bitDepth);
-            uint32 green = fix_color(buf.read(hdr.bitDepth), hdr.bitDepth);
-            uint32 blue = fix_color(buf.read(hdr.bitDepth), hdr.bitDepth);
-            uint32 alpha = fix_color(buf.read(hdr.bitDepth), hdr.bitDepth);
-            cur = Image::color_t(red, green, blue, alpha);
-          }
-          *data++ = cur;
-        }
-        prevLine = curLine;
-        src += bpl;
-      }
-      return true;
-    }
-
     struct SubImage {
       uint32 width;
       uint32 height;
-      uint32 src_size;
-      uint8* src;
       Image::color_t* data;
       int ref;
     };
@@ -271,6 +177,649 @@ namespace ImagePrivate {
       }
     }
 
+    PNGEffort::Type pngEffort = PNGEffort::Balanced;
+    bool useSimd = true;
+
+    // Rows are kept with 16 bytes of zeros on each side, so that filters can read the left
+    // neighbours of the first pixel and vector code can run past the end of the row.
+    const uint32 ROW_PADDING = 16;
+    const uint32 IDAT_SIZE = 65536;
+
+    // Writes the four filtered versions of a row to out[1..4] and returns the sum of absolute
+    // values of each filter's output (as signed bytes), the usual estimate of how well it
+    // compresses. sums[0] is for the unfiltered row.
+    void filter_row_scalar(uint8 const* cur, uint8 const* prev, uint32 length, uint32 bpp, uint8* const* out, uint32* sums) {
+      for (int f = 0; f < 5; ++f) {
+        sums[f] = 0;
+      }
+      uint8 const* left = cur - bpp;
+      uint8 const* upLeft = prev - bpp;
+      for (uint32 i = 0; i < length; ++i) {
+        uint8 x = cur[i];
+        uint8 a = left[i];
+        uint8 b = prev[i];
+        uint8 c = upLeft[i];
+        uint8 v[5] = {
+          x,
+          uint8(x - a),
+          uint8(x - b),
+          uint8(x - ((a + b) >> 1)),
+          uint8(x - paethPredictor(a, b, c)),
+        };
+        for (int f = 0; f < 5; ++f) {
+          if (f) out[f][i] = v[f];
+          sums[f] += abs(int(int8(v[f])));
+        }
+      }
+    }
+
+#ifdef SIMD_X86
+    SIMD_TARGET("ssse3")
+    inline uint32 sum_sad(__m128i sad) {
+      return uint32(_mm_cvtsi128_si32(sad) + _mm_cvtsi128_si32(_mm_srli_si128(sad, 8)));
+    }
+
+    // Paeth predictor of 8 pixels widened to 16 bits; returns all ones where the choice is a
+    // (first) and b (second)
+    SIMD_TARGET("ssse3")
+    inline void paeth_select(__m128i a, __m128i b, __m128i c, __m128i& useA, __m128i& useB) {
+      __m128i pa = _mm_abs_epi16(_mm_sub_epi16(b, c));
+      __m128i pb = _mm_abs_epi16(_mm_sub_epi16(a, c));
+      __m128i pc = _mm_abs_epi16(_mm_sub_epi16(_mm_add_epi16(a, b), _mm_add_epi16(c, c)));
+      __m128i notA = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+      useA = _mm_andnot_si128(notA, _mm_set1_epi16(-1));
+      useB = _mm_andnot_si128(_mm_or_si128(useA, _mm_cmpgt_epi16(pb, pc)), _mm_set1_epi16(-1));
+    }
+
+    SIMD_TARGET("ssse3")
+    void filter_row_ssse3(uint8 const* cur, uint8 const* prev, uint32 length, uint32 bpp, uint8* const* out, uint32* sums) {
+      __m128i const zero = _mm_setzero_si128();
+      __m128i const one = _mm_set1_epi8(1);
+      __m128i const lanes = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+      __m128i total[5] = {zero, zero, zero, zero, zero};
+      for (uint32 i = 0; i < length; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const*>(cur + i));
+        __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const*>(cur + i - bpp));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<__m128i const*>(prev + i));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<__m128i const*>(prev + i - bpp));
+
+        __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+        __m128i useA0, useB0, useA1, useB1;
+        paeth_select(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero), useA0, useB0);
+        paeth_select(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero), useA1, useB1);
+        __m128i useA = _mm_packs_epi16(useA0, useA1);
+        __m128i useB = _mm_packs_epi16(useB0, useB1);
+        __m128i paeth = _mm_or_si128(_mm_and_si128(useA, a),
+          _mm_or_si128(_mm_and_si128(useB, b), _mm_andnot_si128(_mm_or_si128(useA, useB), c)));
+
+        __m128i v[5] = {
+          x,
+          _mm_sub_epi8(x, a),
+          _mm_sub_epi8(x, b),
+          _mm_sub_epi8(x, average),
+          _mm_sub_epi8(x, paeth),
+        };
+        // bytes past the end of the row do not count
+        __m128i valid = _mm_cmplt_epi8(lanes, _mm_set1_epi8(char(std::min<uint32>(length - i, 16))));
+        for (int f = 0; f < 5; ++f) {
+          if (f) _mm_storeu_si128(reinterpret_cast<__m128i*>(out[f] + i), v[f]);
+          total[f] = _mm_add_epi64(total[f], _mm_sad_epu8(_mm_and_si128(_mm_abs_epi8(v[f]), valid), zero));
+        }
+      }
+      for (int f = 0; f < 5; ++f) {
+        sums[f] = sum_sad(total[f]);
+      }
+    }
+#endif
+
+    void filter_row(uint8 const* cur, uint8 const* prev, uint32 length, uint32 bpp, uint8* const* out, uint32* sums) {
+#ifdef SIMD_X86
+      if (useSimd && Simd::hasSSSE3()) {
+        filter_row_ssse3(cur, prev, length, bpp, out, sums);
+        return;
+      }
+#endif
+      filter_row_scalar(cur, prev, length, bpp, out, sums);
+    }
+
+    // Deflates the filtered rows straight into IDAT chunks
+    class IDATStream {
+    public:
+      IDATStream(File& file, int level, int strategy)
+        : file_(file)
+        , buffer_(IDAT_SIZE)
+      {
+        memset(&z_, 0, sizeof z_);
+        z_.zalloc = gzalloc;
+        z_.zfree = gzfree;
+        ok_ = (deflateInit2(&z_, level, Z_DEFLATED, MAX_WBITS, 8, strategy) == Z_OK);
+        z_.next_out = buffer_.data();
+        z_.avail_out = IDAT_SIZE;
+      }
+      ~IDATStream() {
+        if (ok_) deflateEnd(&z_);
+      }
+
+      bool write(uint8 const* data, uint32 size) {
+        return ok_ && run_(data, size, Z_NO_FLUSH);
+      }
+      bool finish() {
+        return ok_ && run_(nullptr, 0, Z_FINISH);
+      }
+
+    private:
+      File& file_;
+      std::vector<uint8> buffer_;
+      z_stream z_;
+      bool ok_;
+
+      bool run_(uint8 const* data, uint32 size, int flush) {
+        z_.next_in = const_cast<Bytef*>(data);
+        z_.avail_in = size;
+        while (true) {
+          int result = deflate(&z_, flush);
+          if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+            return false;
+          }
+          if (z_.avail_out == 0 || (result == Z_STREAM_END && z_.avail_out < IDAT_SIZE)) {
+            write_chunk(0x49444154 /*IDAT*/, IDAT_SIZE - z_.avail_out, buffer_.data(), file_);
+            z_.next_out = buffer_.data();
+            z_.avail_out = IDAT_SIZE;
+          }
+          if (result == Z_STREAM_END) return true;
+          if (flush == Z_NO_FLUSH && z_.avail_in == 0 && z_.avail_out != 0) return true;
+        }
+      }
+    };
+
+    // Smallest color type that stores the image without loss
+    uint8 pick_color_type(Image const& image) {
+      Image::color_t const* bits = image.bits();
+      bool opaque = true, gray = true;
+      for (size_t i = 0, count = size_t(image.width()) * image.height(); i < count && (opaque || gray); ++i) {
+        uint32 color = bits[i];
+        if ((color >> 24) != 0xFF) opaque = false;
+        if (((color >> 16) & 0xFF) != (color & 0xFF) || ((color >> 8) & 0xFF) != (color & 0xFF)) gray = false;
+      }
+      if (gray) return opaque ? 0 : 4;
+      return opaque ? 2 : 6;
+    }
+
+    // Converts a row to the samples of colorType; gray writes the average of the channels
+    void convert_row(Image::color_t const* src, uint32 width, uint8 colorType, uint8* dst) {
+      for (uint32 x = 0; x < width; ++x) {
+        Image::color_t color = src[x];
+        switch (colorType) {
+        case 0:
+          *dst++ = (color.red + color.green + color.blue) / 3;
+          break;
+        case 2:
+          *dst++ = color.red;
+          *dst++ = color.green;
+          *dst++ = color.blue;
+          break;
+        case 4:
+          *dst++ = (color.red + color.green + color.blue) / 3;
+          *dst++ = color.alpha;
+          break;
+        default:
+          *dst++ = color.red;
+          *dst++ = color.green;
+          *dst++ = color.blue;
+          *dst++ = color.alpha;
+        }
+      }
+    }
+
+    // Writes the image data as IDAT chunks. With adaptive filtering each row uses the filter
+    // with the smallest sum of absolute differences, otherwise rows are not filtered.
+    bool write_image_data(Image const& image, uint8 colorType, bool adaptive, int level, int strategy, File& file) {
+      uint32 width = image.width();
+      uint32 height = image.height();
+      uint32 bpp = (colorType == 0 ? 1 : colorType == 4 ? 2 : colorType == 2 ? 3 : 4);
+      uint32 stride = width * bpp;
+      uint32 padded = stride + 2 * ROW_PADDING;
+
+      std::vector<uint8> buffer(padded * 6, 0);
+      uint8* cur = &buffer[ROW_PADDING];
+      uint8* prev = cur + padded;
+      uint8* out[5] = {nullptr};
+      for (int f = 1; f < 5; ++f) {
+        out[f] = cur + padded * (f + 1);
+      }
+
+      IDATStream stream(file, level, strategy);
+      for (uint32 y = 0; y < height; ++y) {
+        convert_row(image.bits() + size_t(y) * width, width, colorType, cur);
+        uint32 best = 0;
+        if (adaptive) {
+          uint32 sums[5];
+          filter_row(cur, prev, stride, bpp, out, sums);
+          for (uint32 f = 1; f < 5; ++f) {
+            if (sums[f] < sums[best]) best = f;
+          }
+        }
+        // the byte before each row holds its filter type (0 for cur, which is also padding)
+        uint8* row = (best ? out[best] : cur);
+        row[-1] = uint8(best);
+        if (!stream.write(row - 1, stride + 1)) {
+          return false;
+        }
+        std::swap(cur, prev);
+      }
+      return stream.finish();
+    }
+
+    // Reverses a row filter in place; cur and prev are padded like the encoder's rows, so the
+    // left neighbours of the first pixel read as zero
+    void unfilter_row_scalar(uint8* cur, uint8 const* prev, uint32 length, uint32 bpp, uint8 filter) {
+      uint8 const* left = cur - bpp;
+      uint8 const* upLeft = prev - bpp;
+      switch (filter) {
+      case 1:
+        for (uint32 i = 0; i < length; ++i) {
+          cur[i] += left[i];
+        }
+        break;
+      case 2:
+        for (uint32 i = 0; i < length; ++i) {
+          cur[i] += prev[i];
+        }
+        break;
+      case 3:
+        for (uint32 i = 0; i < length; ++i) {
+          cur[i] += (left[i] + prev[i]) >> 1;
+        }
+        break;
+      case 4:
+        for (uint32 i = 0; i < length; ++i) {
+          cur[i] += paethPredictor(left[i], prev[i], upLeft[i]);
+        }
+        break;
+      }
+    }
+
+    // Sub, Average and Paeth depend on the pixel to the left, so the vector versions work on
+    // one pixel (3 to 8 bytes) at a time; Up has no such dependency and takes 16 bytes at once.
+    template<uint32 BPP>
+    inline uint64 load_pixel(uint8 const* src) {
+      uint64 value = 0;
+      memcpy(&value, src, BPP);
+      return value;
+    }
+    template<uint32 BPP>
+    inline void store_pixel(uint8* dst, uint64 value) {
+      memcpy(dst, &value, BPP);
+    }
+
+#ifdef SIMD_X86
+    SIMD_TARGET("ssse3")
+    void unfilter_up_ssse3(uint8* cur, uint8 const* prev, uint32 length) {
+      for (uint32 i = 0; i < length; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const*>(cur + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<__m128i const*>(prev + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(cur + i), _mm_add_epi8(x, b));
+      }
+    }
+
+    template<uint32 BPP>
+    SIMD_TARGET("ssse3")
+    inline __m128i load_pixel_ssse3(uint8 const* src) {
+      uint64 value = load_pixel<BPP>(src);
+      return _mm_loadl_epi64(reinterpret_cast<__m128i const*>(&value));
+    }
+    template<uint32 BPP>
+    SIMD_TARGET("ssse3")
+    inline void store_pixel_ssse3(uint8* dst, __m128i value) {
+      uint64 result;
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(&result), value);
+      store_pixel<BPP>(dst, result);
+    }
+
+    template<uint32 BPP>
+    SIMD_TARGET("ssse3")
+    void unfilter_pixels_ssse3(uint8* cur, uint8 const* prev, uint32 length, uint8 filter) {
+      __m128i const zero = _mm_setzero_si128();
+      __m128i a = zero;
+      if (filter == 1) {
+        for (uint32 i = 0; i < length; i += BPP) {
+          a = _mm_add_epi8(load_pixel_ssse3<BPP>(cur + i), a);
+          store_pixel_ssse3<BPP>(cur + i, a);
+        }
+      } else if (filter == 3) {
+        __m128i const one = _mm_set1_epi8(1);
+        for (uint32 i = 0; i < length; i += BPP) {
+          __m128i b = load_pixel_ssse3<BPP>(prev + i);
+          __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+          a = _mm_add_epi8(load_pixel_ssse3<BPP>(cur + i), average);
+          store_pixel_ssse3<BPP>(cur + i, a);
+        }
+      } else if (filter == 4) {
+        // in 16 bit lanes
+        __m128i const low = _mm_set1_epi16(0xFF);
+        __m128i c = zero;
+        for (uint32 i = 0; i < length; i += BPP) {
+          __m128i b = _mm_unpacklo_epi8(load_pixel_ssse3<BPP>(prev + i), zero);
+          __m128i useA, useB;
+          paeth_select(a, b, c, useA, useB);
+          __m128i paeth = _mm_or_si128(_mm_and_si128(useA, a),
+            _mm_or_si128(_mm_and_si128(useB, b), _mm_andnot_si128(_mm_or_si128(useA, useB), c)));
+          a = _mm_and_si128(_mm_add_epi16(_mm_unpacklo_epi8(load_pixel_ssse3<BPP>(cur + i), zero), paeth), low);
+          store_pixel_ssse3<BPP>(cur + i, _mm_packus_epi16(a, a));
+          c = b;
+        }
+      }
+    }
+#endif
+
+#ifdef SIMD_WASM
+    void unfilter_up_wasm(uint8* cur, uint8 const* prev, uint32 length) {
+      for (uint32 i = 0; i < length; i += 16) {
+        wasm_v128_store(cur + i, wasm_i8x16_add(wasm_v128_load(cur + i), wasm_v128_load(prev + i)));
+      }
+    }
+
+    template<uint32 BPP>
+    inline v128_t load_pixel_wasm(uint8 const* src) {
+      return wasm_i64x2_make(int64(load_pixel<BPP>(src)), 0);
+    }
+    template<uint32 BPP>
+    inline void store_pixel_wasm(uint8* dst, v128_t value) {
+      store_pixel<BPP>(dst, uint64(wasm_i64x2_extract_lane(value, 0)));
+    }
+
+    // same as unfilter_pixels_ssse3
+    template<uint32 BPP>
+    void unfilter_pixels_wasm(uint8* cur, uint8 const* prev, uint32 length, uint8 filter) {
+      v128_t const zero = wasm_i64x2_splat(0);
+      v128_t a = zero;
+      if (filter == 1) {
+        for (uint32 i = 0; i < length; i += BPP) {
+          a = wasm_i8x16_add(load_pixel_wasm<BPP>(cur + i), a);
+          store_pixel_wasm<BPP>(cur + i, a);
+        }
+      } else if (filter == 3) {
+        v128_t const one = wasm_i8x16_splat(1);
+        for (uint32 i = 0; i < length; i += BPP) {
+          v128_t b = load_pixel_wasm<BPP>(prev + i);
+          v128_t average = wasm_i8x16_sub(wasm_u8x16_avgr(a, b), wasm_v128_and(wasm_v128_xor(a, b), one));
+          a = wasm_i8x16_add(load_pixel_wasm<BPP>(cur + i), average);
+          store_pixel_wasm<BPP>(cur + i, a);
+        }
+      } else if (filter == 4) {
+        v128_t c = zero;
+        for (uint32 i = 0; i < length; i += BPP) {
+          v128_t b = wasm_u16x8_extend_low_u8x16(load_pixel_wasm<BPP>(prev + i));
+          v128_t pa = wasm_i16x8_abs(wasm_i16x8_sub(b, c));
+          v128_t pb = wasm_i16x8_abs(wasm_i16x8_sub(a, c));
+          v128_t pc = wasm_i16x8_abs(wasm_i16x8_sub(wasm_i16x8_add(a, b), wasm_i16x8_add(c, c)));
+          v128_t notA = wasm_v128_or(wasm_i16x8_gt(pa, pb), wasm_i16x8_gt(pa, pc));
+          v128_t paeth = wasm_v128_bitselect(wasm_v128_bitselect(c, b, wasm_i16x8_gt(pb, pc)), a, notA);
+          a = wasm_v128_and(wasm_i16x8_add(wasm_u16x8_extend_low_u8x16(load_pixel_wasm<BPP>(cur + i)), paeth), wasm_i16x8_splat(0xFF));
+          store_pixel_wasm<BPP>(cur + i, wasm_u8x16_narrow_i16x8(a, a));
+          c = b;
+        }
+      }
+    }
+#endif
+
+    void unfilter_row(uint8* cur, uint8 const* prev, uint32 length, uint32 bpp, uint8 filter) {
+      if (filter == 0) {
+        return;
+      }
+#ifdef SIMD_X86
+      if (useSimd && Simd::hasSSSE3()) {
+        switch (filter == 2 ? 0 : bpp) {
+        case 0: unfilter_up_ssse3(cur, prev, length); return;
+        case 3: unfilter_pixels_ssse3<3>(cur, prev, length, filter); return;
+        case 4: unfilter_pixels_ssse3<4>(cur, prev, length, filter); return;
+        case 6: unfilter_pixels_ssse3<6>(cur, prev, length, filter); return;
+        case 8: unfilter_pixels_ssse3<8>(cur, prev, length, filter); return;
+        }
+      }
+#endif
+#ifdef SIMD_WASM
+      if (useSimd) {
+        switch (filter == 2 ? 0 : bpp) {
+        case 0: unfilter_up_wasm(cur, prev, length); return;
+        case 3: unfilter_pixels_wasm<3>(cur, prev, length, filter); return;
+        case 4: unfilter_pixels_wasm<4>(cur, prev, length, filter); return;
+        case 6: unfilter_pixels_wasm<6>(cur, prev, length, filter); return;
+        case 8: unfilter_pixels_wasm<8>(cur, prev, length, filter); return;
+        }
+      }
+#endif
+      unfilter_row_scalar(cur, prev, length, bpp, filter);
+    }
+
+    // Expansion of 8-bit samples of each color type to colors, four pixels at a time: source
+    // bytes for each output byte (negative for none) and the bits to set afterwards
+    struct Expand8 {
+      int8 shuffle[16];
+      uint32 fill;
+    };
+    Expand8 const expand8[7] = {
+      {{0, 0, 0, -1, 1, 1, 1, -1, 2, 2, 2, -1, 3, 3, 3, -1}, 0xFF000000},
+      {},
+      {{2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1}, 0xFF000000},
+      {},
+      {{0, 0, 0, 1, 2, 2, 2, 3, 4, 4, 4, 5, 6, 6, 6, 7}, 0},
+      {},
+      {{2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15}, 0},
+    };
+
+    void expand_row_scalar(uint8 const* src, uint32 width, uint8 colorType, Image::color_t* dst) {
+      switch (colorType) {
+      case 0:
+        for (uint32 x = 0; x < width; ++x, src += 1) {
+          dst[x] = Image::color_t(src[0], src[0], src[0]);
+        }
+        break;
+      case 2:
+        for (uint32 x = 0; x < width; ++x, src += 3) {
+          dst[x] = Image::color_t(src[0], src[1], src[2]);
+        }
+        break;
+      case 4:
+        for (uint32 x = 0; x < width; ++x, src += 2) {
+          dst[x] = Image::color_t(src[0], src[0], src[0], src[1]);
+        }
+        break;
+      case 6:
+        for (uint32 x = 0; x < width; ++x, src += 4) {
+          dst[x] = Image::color_t(src[0], src[1], src[2], src[3]);
+        }
+        break;
+      }
+    }
+
+#ifdef SIMD_X86
+    // reads up to 16 bytes past the last full group of pixels, which the row padding allows
+    SIMD_TARGET("ssse3")
+    void expand_row_ssse3(uint8 const* src, uint32 width, uint8 colorType, Image::color_t* dst) {
+      uint32 bpp = (colorType == 0 ? 1 : colorType == 4 ? 2 : colorType == 2 ? 3 : 4);
+      __m128i shuffle = _mm_loadu_si128(reinterpret_cast<__m128i const*>(expand8[colorType].shuffle));
+      __m128i fill = _mm_set1_epi32(int(expand8[colorType].fill));
+      uint32 x = 0;
+      for (; x + 4 <= width; x += 4, src += 4 * bpp) {
+        __m128i pixels = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(src)), shuffle);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_or_si128(pixels, fill));
+      }
+      expand_row_scalar(src, width - x, colorType, dst + x);
+    }
+#endif
+
+#ifdef SIMD_WASM
+    void expand_row_wasm(uint8 const* src, uint32 width, uint8 colorType, Image::color_t* dst) {
+      uint32 bpp = (colorType == 0 ? 1 : colorType == 4 ? 2 : colorType == 2 ? 3 : 4);
+      v128_t shuffle = wasm_v128_load(expand8[colorType].shuffle);
+      v128_t fill = wasm_i32x4_splat(int(expand8[colorType].fill));
+      uint32 x = 0;
+      for (; x + 4 <= width; x += 4, src += 4 * bpp) {
+        v128_t pixels = wasm_i8x16_swizzle(wasm_v128_load(src), shuffle);
+        wasm_v128_store(dst + x, wasm_v128_or(pixels, fill));
+      }
+      expand_row_scalar(src, width - x, colorType, dst + x);
+    }
+#endif
+
+    // Converts a row of unfiltered samples to colors; palette indices out of range decode as
+    // transparent black
+    void convert_row(uint8 const* row, uint32 width, PNGHeader const& hdr, PNGPalette const& pal, Image::color_t* data) {
+      if (hdr.bitDepth == 8 && hdr.colorType == 3) {
+        for (uint32 x = 0; x < width; ++x) {
+          data[x] = pal.rgba[row[x]];
+        }
+        return;
+      }
+      if (hdr.bitDepth == 8 && !pal.useColorKey) {
+#ifdef SIMD_X86
+        if (useSimd && Simd::hasSSSE3()) {
+          expand_row_ssse3(row, width, hdr.colorType, data);
+          return;
+        }
+#endif
+#ifdef SIMD_WASM
+        if (useSimd) {
+          expand_row_wasm(row, width, hdr.colorType, data);
+          return;
+        }
+#endif
+        expand_row_scalar(row, width, hdr.colorType, data);
+        return;
+      }
+
+      BitStream buf(row);
+      for (uint32 x = 0; x < width; x++) {
+        Image::color_t cur = 0;
+        if (hdr.colorType == 0) {
+          uint32 gray = buf.read(hdr.bitDepth);
+          if (pal.useColorKey && gray == pal.colorKey[0]) {
+            cur = 0;
+          } else {
+            gray = fix_color(gray, hdr.bitDepth);
+            cur = Image::color_t(gray, gray, gray);
+          }
+        } else if (hdr.colorType == 2) {
+          uint32 red = buf.read(hdr.bitDepth);
+          uint32 green = buf.read(hdr.bitDepth);
+          uint32 blue = buf.read(hdr.bitDepth);
+          if (pal.useColorKey && red == pal.colorKey[0] &&
+            green == pal.colorKey[1] && blue == pal.colorKey[2]) {
+            cur = 0;
+          } else {
+            cur = Image::color_t(fix_color(red, hdr.bitDepth),
+              fix_color(green, hdr.bitDepth), fix_color(blue, hdr.bitDepth));
+          }
+        } else if (hdr.colorType == 3) {
+          cur = pal.rgba[buf.read(hdr.bitDepth)];
+        } else if (hdr.colorType == 4) {
+          uint32 gray = fix_color(buf.read(hdr.bitDepth), hdr.bitDepth);
+          uint32 alpha = fix_color(buf.read(hdr.bitDepth), hdr.bitDepth);
+          cur = Image::color_t(gray, gray, gray, alpha);
+        } else if (hdr.colorType == 6) {
+          uint32 red = fix_color(buf.read(hdr.bitDepth), hdr.bitDepth);
+          uint32 green = fix_color(buf.read(hdr.bitDepth), hdr.bitDepth);
+          uint32 blue = fix_color(buf.read(hdr.bitDepth), hdr.bitDepth);
+          uint32 alpha = fix_color(buf.read(hdr.bitDepth), hdr.bitDepth);
+          cur = Image::color_t(red, green, blue, alpha);
+        }
+        data[x] = cur;
+      }
+    }
+
+    // Decoder state that is kept between images, so that reading many PNGs does not allocate
+    // the inflate window, chunk and row buffers every time. Image data is inflated straight
+    // into the current row, which is unfiltered and converted as soon as it is complete.
+    class PNGReader {
+    public:
+      PNGReader() {
+        memset(&z_, 0, sizeof z_);
+        z_.zalloc = gzalloc;
+        z_.zfree = gzfree;
+        zinit_ = (inflateInit(&z_) == Z_OK);
+      }
+      ~PNGReader() {
+        if (zinit_) inflateEnd(&z_);
+      }
+
+      bool read(Image& image, File& file);
+
+    private:
+      z_stream z_;
+      bool zinit_;
+      PNGChunk chunk_;
+      std::vector<uint8> rows_;
+      std::vector<Image::color_t> passData_;
+
+      // stream position
+      PNGHeader hdr_;
+      PNGPalette pal_;
+      SubImage* passes_;
+      int numPasses_;
+      int pass_;
+      uint32 row_;
+      uint32 bpp_;
+      uint32 bpl_;
+      uint8* cur_;
+      uint8* prev_;
+
+      void start_pass_();
+      bool finish_row_();
+      bool inflate_(uint8 const* data, uint32 size);
+    };
+
+    void PNGReader::start_pass_() {
+      row_ = 0;
+      if (pass_ >= numPasses_) {
+        return;
+      }
+      bpl_ = (bitsPerPixel(hdr_) * passes_[pass_].width + 7) / 8;
+      memset(prev_ - ROW_PADDING, 0, bpl_ + 2 * ROW_PADDING);
+      z_.next_out = cur_ - 1;
+      z_.avail_out = bpl_ + 1;
+    }
+
+    bool PNGReader::finish_row_() {
+      // the byte before the row holds its filter type, and has to be zero for the filters
+      uint8 filter = cur_[-1];
+      cur_[-1] = 0;
+      if (filter > 4) {
+        return false;
+      }
+      unfilter_row(cur_, prev_, bpl_, bpp_, filter);
+      SubImage const& pass = passes_[pass_];
+      convert_row(cur_, pass.width, hdr_, pal_, pass.data + size_t(row_) * pass.width);
+      std::swap(cur_, prev_);
+      if (++row_ == pass.height) {
+        ++pass_;
+        start_pass_();
+      } else {
+        z_.next_out = cur_ - 1;
+        z_.avail_out = bpl_ + 1;
+      }
+      return true;
+    }
+
+    bool PNGReader::inflate_(uint8 const* data, uint32 size) {
+      z_.next_in = const_cast<Bytef*>(data);
+      z_.avail_in = size;
+      while (pass_ < numPasses_) {
+        int result = inflate(&z_, Z_NO_FLUSH);
+        if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+          return false;
+        }
+        if (z_.avail_out == 0) {
+          if (!finish_row_()) return false;
+          continue;
+        }
+        if (result != Z_OK || z_.avail_in == 0) {
+          break;
+        }
+      }
+      return true;
+    }
+
   }
 
   using namespace _png;
@@ -280,13 +829,12 @@ namespace ImagePrivate {
 
     uint32 width = image.width();
     uint32 height = image.height();
-    Image::color_t const* bits = image.bits();
 
     PNGHeader hdr;
     hdr.width = flipped(width);
     hdr.height = flipped(height);
     hdr.bitDepth = 8;
-    if (gray == 0) hdr.colorType = 6;
+    if (gray == 0) hdr.colorType = pick_color_type(image);
     else if (gray == 1) hdr.colorType = 0;
     else hdr.colorType = 4;
     hdr.compressionMethod = 0;
@@ -294,47 +842,48 @@ namespace ImagePrivate {
     hdr.interlaceMethod = 0;
     write_chunk(0x49484452 /*IHDR*/, sizeof hdr, &hdr, file);
 
-    int channels = (gray == 0 ? 4 : (gray == 1 ? 1 : 2));
-    uint32 usize = (width * channels + 1) * height;
-    std::vector<uint8> udata(usize);
-    uint8* dst = &udata[0];
-    for (size_t y = 0; y < height; y++) {
-      *dst++ = 0;
-      for (size_t x = 0; x < width; x++) {
-        Image::color_t color = *bits++;
-        if (gray) {
-          int sum = color.red + color.green + color.blue;
-          *dst++ = sum / 3;
-          if (gray > 1) *dst++ = color.alpha;
-        } else {
-          *dst++ = color.red;
-          *dst++ = color.green;
-          *dst++ = color.blue;
-          *dst++ = color.alpha;
+    if (pngEffort == PNGEffort::Max) {
+      // keep the smallest of a few filter and deflate strategies
+      struct { bool adaptive; int strategy; } const attempts[] = {
+        { true, Z_DEFAULT_STRATEGY },
+        { true, Z_FILTERED },
+        { false, Z_DEFAULT_STRATEGY },
+      };
+      File best;
+      for (auto const& attempt : attempts) {
+        MemoryFile data;
+        if (!write_image_data(image, hdr.colorType, attempt.adaptive, 9, attempt.strategy, data)) {
+          return false;
+        }
+        if (!best || data.size() < best.size()) {
+          best = data;
         }
       }
+      best.seek(0);
+      file.copy(best);
+    } else {
+      int level = (pngEffort == PNGEffort::Fast ? 1 : Z_DEFAULT_COMPRESSION);
+      if (!write_image_data(image, hdr.colorType, true, level, Z_DEFAULT_STRATEGY, file)) {
+        return false;
+      }
     }
-    uint32 csize = (usize * 11) / 10 + 32;
-    std::vector<uint8> cdata(csize);
-    if (gzdeflate(&udata[0], usize, &cdata[0], &csize)) {
-      return false;
-    }
-
-    write_chunk(0x49444154 /*IDAT*/, csize, &cdata[0], file);
     write_chunk(0x49454e44 /*IEND*/, 0, NULL, file);
 
     return true;
   }
 
-  bool imReadPNG(Image& image, File& file) {
+  bool PNGReader::read(Image& image, File& file) {
     uint8 sig[8];
     file.seek(0, SEEK_SET);
     if (file.read(sig, 8) != 8 || memcmp(sig, pngSignature, 8)) {
       return false;
     }
+    if (!zinit_) {
+      return false;
+    }
 
-    PNGChunk ch;
-    PNGHeader hdr;
+    PNGChunk& ch = chunk_;
+    PNGHeader& hdr = hdr_;
     if (!read_chunk(ch, file)) return false;
     if (ch.type != 0x49484452 /*IHDR*/ || ch.length != sizeof hdr) return false;
     memcpy(&hdr, ch.data, sizeof hdr);
@@ -343,6 +892,9 @@ namespace ImagePrivate {
     if (hdr.width == 0 || hdr.height == 0) {
       return false; // zero sized images not allowed
     }
+    if (hdr.width >= (1 << 24) || hdr.height >= (1 << 24) || uint64(hdr.width) * hdr.height > (1 << 28)) {
+      return false; // too large to hold, and row sizes would overflow
+    }
     if (hdr.bitDepth < 1 || hdr.bitDepth > 16 || (hdr.bitDepth & (hdr.bitDepth - 1)) != 0) {
       return false; // unknown bit depth (not 1 2 4 8 or 16)
     }
@@ -366,18 +918,15 @@ namespace ImagePrivate {
       return false; // unknown interlace method
     }
 
+    Image result(hdr.width, hdr.height);
     SubImage passes[7];
     int numPasses;
-    uint32 total_src_size = 0;
-    uint32 total_data_size = 0;
     if (hdr.interlaceMethod == 0) {
       numPasses = 1;
       passes[0].width = hdr.width;
       passes[0].height = hdr.height;
-      passes[0].src_size = get_image_size(hdr.width, hdr.height, hdr);
+      passes[0].data = result.mutable_bits();
       passes[0].ref = 0;
-      total_src_size += passes[0].src_size;
-      total_data_size += hdr.width * hdr.height;
     } else
     {
       numPasses = 0;
@@ -396,6 +945,7 @@ namespace ImagePrivate {
       passes[6].width = hdr.width;
       passes[6].height = hdr.height / 2;
 
+      size_t total_data_size = 0;
       for (int i = 0; i < 7; i++) {
         passes[i].ref = -1;
         if (passes[i].width && passes[i].height) {
@@ -404,30 +954,38 @@ namespace ImagePrivate {
             passes[numPasses].height = passes[i].height;
           }
           passes[i].ref = numPasses;
-          passes[numPasses].src_size = get_image_size(passes[numPasses].width, passes[numPasses].height, hdr);
-          total_src_size += passes[numPasses].src_size;
-          total_data_size += passes[numPasses].width * passes[numPasses].height;
+          total_data_size += size_t(passes[numPasses].width) * passes[numPasses].height;
           numPasses++;
         }
       }
+      passData_.resize(total_data_size);
+      size_t cur_data = 0;
+      for (int i = 0; i < numPasses; i++) {
+        passes[i].data = &passData_[cur_data];
+        cur_data += size_t(passes[i].width) * passes[i].height;
+      }
     }
-    std::vector<uint8> src(total_src_size);
-    std::vector<Image::color_t> data(total_data_size);
 
-    uint32 cur_src = 0;
-    uint32 cur_data = 0;
-    for (int i = 0; i < numPasses; i++) {
-      passes[i].src = &src[cur_src];
-      passes[i].data = &data[cur_data];
-      cur_src += passes[i].src_size;
-      cur_data += passes[i].width * passes[i].height;
+    // two rows of the full width (the widest pass) with padding on both sides
+    uint32 stride = (bitsPerPixel(hdr) * hdr.width + 7) / 8 + 2 * ROW_PADDING;
+    if (rows_.size() < 2 * stride) {
+      rows_.resize(2 * stride);
     }
+    cur_ = &rows_[ROW_PADDING];
+    prev_ = cur_ + stride;
+    memset(cur_ - ROW_PADDING, 0, ROW_PADDING);
+    bpp_ = (bitsPerPixel(hdr) + 7) / 8;
+    passes_ = passes;
+    numPasses_ = numPasses;
+    pass_ = 0;
+    inflateReset(&z_);
+    start_pass_();
 
-    PNGPalette pal;
+    PNGPalette& pal = pal_;
     pal.size = 0;
     pal.useColorKey = false;
+    std::fill(pal.rgba, pal.rgba + 256, Image::color_t(0));
 
-    std::vector<uint8> buf;
     while (true) {
       if (!read_chunk(ch, file)) {
         return false;
@@ -436,7 +994,7 @@ namespace ImagePrivate {
         break;
       } else if (ch.type == 0x504c5445 /*PLTE*/) {
         pal.size = ch.length / 3;
-        if (ch.length != pal.size * 3) {
+        if (ch.length != pal.size * 3 || pal.size > 256) {
           return false;
         }
         for (uint32 i = 0; i < pal.size; i++) {
@@ -471,21 +1029,16 @@ namespace ImagePrivate {
           return false;
         }
       } else if (ch.type == 0x49444154 /*IDAT*/) {
-        buf.insert(buf.end(), ch.data, ch.data + ch.length);
+        if (!inflate_(ch.data, ch.length)) {
+          return false;
+        }
       }
     }
-    if (gzinflate(&buf[0], static_cast<uint32>(buf.size()), &src[0], &total_src_size)) {
-      return false;
+    if (pass_ < numPasses) {
+      return false; // image data ended early
     }
 
-    for (int i = 0; i < numPasses; i++) {
-      read_sub_image(passes[i].width, passes[i].height, passes[i].data, passes[i].src, hdr, pal);
-    }
-
-    image = Image(hdr.width, hdr.height);
-    if (hdr.interlaceMethod == 0) {
-      memcpy(image.mutable_bits(), passes[0].data, image.size());
-    } else {
+    if (hdr.interlaceMethod != 0) {
       uint32 sx[7] = { 0, 4, 0, 2, 0, 1, 0 };
       uint32 dx[7] = { 8, 8, 4, 4, 2, 2, 1 };
       uint32 sy[7] = { 0, 0, 4, 0, 2, 0, 1 };
@@ -494,12 +1047,26 @@ namespace ImagePrivate {
         if (passes[i].ref >= 0) {
           int j = passes[i].ref;
           write_image(passes[j].data, passes[j].width, passes[j].height,
-            image.mutable_bits(), image.width(), image.height(),
+            result.mutable_bits(), result.width(), result.height(),
             sx[i], sy[i], dx[i], dy[i]);
         }
       }
     }
+    image = result;
     return true;
   }
 
+  bool imReadPNG(Image& image, File& file, ImageDecodeOptions const& options) {
+    static thread_local PNGReader reader;
+    return reader.read(image, file);
+  }
+
+}
+
+void setPNGSimd(bool enabled) {
+  ImagePrivate::_png::useSimd = enabled;
+}
+
+void setPNGEffort(PNGEffort::Type effort) {
+  ImagePrivate::_png::pngEffort = effort;
 }
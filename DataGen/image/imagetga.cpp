@@ -20,7 +20,7 @@ struct TGAHeader {
 #pragma pack (pop)
 
 namespace ImagePrivate {
-  bool imReadTGA(Image& image, File& file) {
+  bool imReadTGA(Image& image, File& file, ImageDecodeOptions const& options) {
     file.seek(0, SEEK_SET);
     TGAHeader hdr;
     if (file.read(&hdr, sizeof hdr) != sizeof hdr) {
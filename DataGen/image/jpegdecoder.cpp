@@ -0,0 +1,193 @@
+#include "jpegdecoder.h"
+#include <setjmp.h>
+
+extern "C"
+{
+#include "jpeg/jpeglib.h"
+#include "jpeg/jerror.h"
+}
+
+namespace _jpeg {
+
+  J_DCT_METHOD dctMethod = JDCT_ISLOW;
+
+  // Feeds libjpeg the header and then the data, both straight from memory when the file is
+  // held there. A truncated stream ends with a fake EOI, which leaves the missing rows gray.
+  struct Source {
+    jpeg_source_mgr pub;
+    JOCTET const* next;
+    size_t nextSize;
+
+    static void init(j_decompress_ptr) {
+    }
+    static boolean fill(j_decompress_ptr cinfo) {
+      static JOCTET const eoi[2] = {0xFF, JPEG_EOI};
+      Source* src = reinterpret_cast<Source*>(cinfo->src);
+      if (src->nextSize) {
+        src->pub.next_input_byte = src->next;
+        src->pub.bytes_in_buffer = src->nextSize;
+        src->nextSize = 0;
+      } else {
+        WARNMS(cinfo, JWRN_JPEG_EOF);
+        src->pub.next_input_byte = eoi;
+        src->pub.bytes_in_buffer = 2;
+      }
+      return TRUE;
+    }
+    static void skip(j_decompress_ptr cinfo, long count) {
+      jpeg_source_mgr* src = cinfo->src;
+      if (count <= 0) return;
+      while (count > long(src->bytes_in_buffer)) {
+        count -= long(src->bytes_in_buffer);
+        fill(cinfo);
+      }
+      src->next_input_byte += count;
+      src->bytes_in_buffer -= count;
+    }
+    static void term(j_decompress_ptr) {
+    }
+  };
+
+  struct ErrorManager {
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+
+    static void exit(j_common_ptr cinfo) {
+      longjmp(reinterpret_cast<ErrorManager*>(cinfo->err)->jump, 1);
+    }
+    static void message(j_common_ptr, int) {
+    }
+  };
+
+  class Decoder {
+  public:
+    Decoder() {
+      cinfo_.err = jpeg_std_error(&error_.pub);
+      error_.pub.error_exit = ErrorManager::exit;
+      error_.pub.emit_message = ErrorManager::message;
+      jpeg_create_decompress(&cinfo_);
+      source_.pub.init_source = Source::init;
+      source_.pub.fill_input_buffer = Source::fill;
+      source_.pub.skip_input_data = Source::skip;
+      source_.pub.resync_to_restart = jpeg_resync_to_restart;
+      source_.pub.term_source = Source::term;
+      cinfo_.src = &source_.pub;
+    }
+    ~Decoder() {
+      jpeg_destroy_decompress(&cinfo_);
+    }
+
+    bool decode(Image& image, File& file, uint64 headerOffset, uint32 headerSize, uint64 offset, uint32 size,
+      ImageDecodeOptions const& options, bool bgr);
+
+  private:
+    jpeg_decompress_struct cinfo_;
+    ErrorManager error_;
+    Source source_;
+    std::vector<uint8> input_;
+    std::vector<uint8> row_;
+
+    bool read_(File& file);
+  };
+
+  bool Decoder::decode(Image& image, File& file, uint64 headerOffset, uint32 headerSize, uint64 offset, uint32 size,
+    ImageDecodeOptions const& options, bool bgr)
+  {
+    uint64 fileSize = file.size();
+    if (headerOffset + headerSize > fileSize || offset + size > fileSize || !size) {
+      return false;
+    }
+    uint8 const* header;
+    uint8 const* data;
+    if (uint8 const* contents = file.data()) {
+      header = contents + headerOffset;
+      data = contents + offset;
+    } else {
+      input_.resize(size_t(headerSize) + size);
+      file.seek(headerOffset);
+      if (file.read(input_.data(), headerSize) != headerSize) return false;
+      file.seek(offset);
+      if (file.read(input_.data() + headerSize, size) != size) return false;
+      header = input_.data();
+      data = input_.data() + headerSize;
+    }
+    source_.pub.next_input_byte = header;
+    source_.pub.bytes_in_buffer = headerSize;
+    source_.next = data;
+    source_.nextSize = size;
+
+    if (setjmp(error_.jump)) {
+      // leaves the decompressor ready for the next image
+      jpeg_abort_decompress(&cinfo_);
+      image.release();
+      return false;
+    }
+
+    jpeg_read_header(&cinfo_, TRUE);
+    cinfo_.dct_method = dctMethod;
+    cinfo_.scale_num = 1;
+    cinfo_.scale_denom = 1;
+    if (options.width > 0 || options.height > 0) {
+      for (unsigned denom = 8; denom > 1; denom /= 2) {
+        if ((cinfo_.image_width + denom - 1) / denom >= unsigned(std::max(options.width, 1)) &&
+            (cinfo_.image_height + denom - 1) / denom >= unsigned(std::max(options.height, 1))) {
+          cinfo_.scale_denom = denom;
+          break;
+        }
+      }
+    }
+    jpeg_start_decompress(&cinfo_);
+
+    image = Image(cinfo_.output_width, cinfo_.output_height);
+    int components = cinfo_.output_components;
+    row_.resize(size_t(cinfo_.output_width) * components);
+    JSAMPROW row = row_.data();
+    Image::color_t* bits = image.mutable_bits();
+    int width = image.width();
+    while (cinfo_.output_scanline < cinfo_.output_height) {
+      Image::color_t* line = bits + size_t(width) * cinfo_.output_scanline;
+      jpeg_read_scanlines(&cinfo_, &row, 1);
+      uint8 const* ptr = row;
+      if (components == 1) {
+        for (int i = 0; i < width; ++i) {
+          line[i] = Image::color_t(ptr[i], ptr[i], ptr[i]);
+        }
+      } else if (components == 3) {
+        int r = (bgr ? 2 : 0), b = 2 - r;
+        for (int i = 0; i < width; ++i, ptr += 3) {
+          line[i] = Image::color_t(ptr[r], ptr[1], ptr[b]);
+        }
+      } else {
+        int r = (bgr ? 2 : 0), b = 2 - r;
+        for (int i = 0; i < width; ++i, ptr += components) {
+          line[i] = Image::color_t(ptr[r], ptr[1], ptr[b], ptr[3]);
+        }
+      }
+    }
+
+    jpeg_finish_decompress(&cinfo_);
+    return true;
+  }
+
+}
+
+using namespace _jpeg;
+
+namespace JPEG {
+
+  bool decode(Image& image, File& file, uint64 headerOffset, uint32 headerSize, uint64 offset, uint32 size,
+    ImageDecodeOptions const& options, bool bgr)
+  {
+    static thread_local Decoder decoder;
+    return decoder.decode(image, file, headerOffset, headerSize, offset, size, options, bgr);
+  }
+
+}
+
+void setJPEGDCT(JPEGDCT::Type dct) {
+  switch (dct) {
+  case JPEGDCT::Fast: dctMethod = JDCT_IFAST; break;
+  case JPEGDCT::Float: dctMethod = JDCT_FLOAT; break;
+  default: dctMethod = JDCT_ISLOW;
+  }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "image.h"
+
+// JPEG decoding shared by the JPG and BLP readers. Each thread keeps one libjpeg decompressor
+// and reuses it for every image, along with its input and row buffers.
+namespace JPEG {
+
+  // Decodes the JPEG stream made of size bytes at offset, preceded by headerSize bytes at
+  // headerOffset: BLP files keep the tables shared by all mip levels apart from the levels.
+  // The output is reduced by the IDCT (1/2, 1/4 or 1/8) to the smallest size that is still
+  // at least the size in options. With bgr, three and four channel output is taken in blue,
+  // green, red (and alpha) order.
+  bool decode(Image& image, File& file, uint64 headerOffset, uint32 headerSize, uint64 offset, uint32 size,
+    ImageDecodeOptions const& options, bool bgr);
+
+}
@@ -0,0 +1,274 @@
+#include "image.h"
+#include "utils/simd.h"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+namespace ImagePrivate {
+
+  namespace {
+
+    bool useSimd = true;
+
+    // Weights for one direction of a resize: output pixel i is the sum of
+    // weights[i * taps + k] * src[left[i] + k] for k < count[i], divided by total[i]
+    struct Kernel {
+      std::vector<int32> left;
+      std::vector<int32> count;
+      std::vector<double> total;
+      std::vector<double> weights;
+      int taps;
+    };
+
+    // Same taps and weights as LinScaler
+    std::shared_ptr<Kernel> build_kernel(int from, int to, double scale, double radius, ImageFilter::Function filter) {
+      double support = (scale < 1 ? radius / scale : radius);
+      auto kernel = std::make_shared<Kernel>();
+      kernel->taps = 0;
+      for (int i = 0; i < to; ++i) {
+        double center = (i + 0.5) / scale;
+        int left = std::max(0, static_cast<int>(floor(center - support)));
+        int right = std::min<int>(from, static_cast<int>(ceil(center + support)) + 1);
+        kernel->left.push_back(left);
+        kernel->count.push_back(std::max(right - left, 0));
+        kernel->taps = std::max(kernel->taps, right - left);
+      }
+      kernel->weights.assign(size_t(to) * kernel->taps, 0.0);
+      kernel->total.assign(to, 0.0);
+      for (int i = 0; i < to; ++i) {
+        double center = (i + 0.5) / scale;
+        double* weights = &kernel->weights[size_t(i) * kernel->taps];
+        for (int k = 0; k < kernel->count[i]; ++k) {
+          int j = kernel->left[i] + k;
+          weights[k] = filter(scale < 1 ? std::abs((center - j - 0.5) * scale) : std::abs(center - j - 0.5));
+          kernel->total[i] += weights[k];
+        }
+      }
+      return kernel;
+    }
+
+    // Resizes repeat the same few sizes (every icon goes to the same cell size), so kernels
+    // are kept by size and filter
+    std::shared_ptr<Kernel const> get_kernel(int from, int to, double scale, double radius, ImageFilter::Function filter) {
+      typedef std::tuple<int, int, double, uintptr_t> Key;
+      static std::map<Key, std::shared_ptr<Kernel const>> cache;
+      static std::mutex mutex;
+      Key key(from, to, scale, reinterpret_cast<uintptr_t>(filter));
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = cache.find(key);
+        if (it != cache.end()) return it->second;
+      }
+      std::shared_ptr<Kernel const> kernel = build_kernel(from, to, scale, radius, filter);
+      std::lock_guard<std::mutex> lock(mutex);
+      if (cache.size() >= 256) cache.clear();
+      cache.emplace(key, kernel);
+      return kernel;
+    }
+
+    // The sums are accumulated in double precision in the same order as Accum, and rounded
+    // the same way, so every path gives exactly LinScaler's result. The intermediate row is
+    // rounded to 8 bits between the passes; with float sums, rounding ties that went the
+    // other way there were amplified by the second pass into errors of 2.
+
+    inline uint32 pack(double const* sum, double total) {
+      if (total == 0) return 0;
+      uint32 result = 0;
+      for (int c = 0; c < 4; ++c) {
+        int value = static_cast<int>(sum[c] / total + 0.5);
+        result |= uint32(std::max(0, std::min(255, value))) << (8 * c);
+      }
+      return result;
+    }
+
+    void rows_scalar(Kernel const& kernel, uint32 const* src, uint32* dst, int width) {
+      for (int i = 0; i < width; ++i) {
+        double const* weights = &kernel.weights[size_t(i) * kernel.taps];
+        uint8 const* pixels = reinterpret_cast<uint8 const*>(src + kernel.left[i]);
+        double sum[4] = {0, 0, 0, 0};
+        for (int k = 0; k < kernel.count[i]; ++k, pixels += 4) {
+          for (int c = 0; c < 4; ++c) {
+            sum[c] += weights[k] * pixels[c];
+          }
+        }
+        dst[i] = pack(sum, kernel.total[i]);
+      }
+    }
+
+    // one output row from rows[k] weighted by weights[k], pixels [begin, end)
+    void columns_scalar(uint32 const* const* rows, double const* weights, int count, double total, uint32* dst, int begin, int end) {
+      for (int x = begin; x < end; ++x) {
+        double sum[4] = {0, 0, 0, 0};
+        for (int k = 0; k < count; ++k) {
+          uint8 const* pixel = reinterpret_cast<uint8 const*>(rows[k] + x);
+          for (int c = 0; c < 4; ++c) {
+            sum[c] += weights[k] * pixel[c];
+          }
+        }
+        dst[x] = pack(sum, total);
+      }
+    }
+
+#ifdef SIMD_X86
+    // A pixel's four channels fill one register of doubles
+    SIMD_TARGET("avx2")
+    inline __m256d load_avx2(uint32 const* pixel) {
+      return _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(int(*pixel))));
+    }
+    SIMD_TARGET("avx2")
+    inline __m128i round_avx2(__m256d sum, __m256d total) {
+      return _mm256_cvttpd_epi32(_mm256_add_pd(_mm256_div_pd(sum, total), _mm256_set1_pd(0.5)));
+    }
+
+    SIMD_TARGET("avx2")
+    void rows_avx2(Kernel const& kernel, uint32 const* src, uint32* dst, int width) {
+      for (int i = 0; i < width; ++i) {
+        if (kernel.total[i] == 0) {
+          dst[i] = 0;
+          continue;
+        }
+        double const* weights = &kernel.weights[size_t(i) * kernel.taps];
+        uint32 const* pixels = src + kernel.left[i];
+        __m256d sum = _mm256_setzero_pd();
+        for (int k = 0; k < kernel.count[i]; ++k) {
+          sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_set1_pd(weights[k]), load_avx2(pixels + k)));
+        }
+        __m128i value = round_avx2(sum, _mm256_set1_pd(kernel.total[i]));
+        value = _mm_packs_epi32(value, value);
+        dst[i] = uint32(_mm_cvtsi128_si32(_mm_packus_epi16(value, value)));
+      }
+    }
+
+    // Whole source rows at a time, four pixels per step, so the vertical pass reads memory in
+    // order instead of walking down columns
+    SIMD_TARGET("avx2")
+    void columns_avx2(uint32 const* const* rows, double const* weights, int count, double total, uint32* dst, int width) {
+      if (total == 0) {
+        memset(dst, 0, sizeof(uint32) * width);
+        return;
+      }
+      __m256d const divisor = _mm256_set1_pd(total);
+      int x = 0;
+      for (; x + 4 <= width; x += 4) {
+        __m256d sum[4] = {_mm256_setzero_pd(), _mm256_setzero_pd(), _mm256_setzero_pd(), _mm256_setzero_pd()};
+        for (int k = 0; k < count; ++k) {
+          __m256d weight = _mm256_set1_pd(weights[k]);
+          for (int j = 0; j < 4; ++j) {
+            sum[j] = _mm256_add_pd(sum[j], _mm256_mul_pd(weight, load_avx2(rows[k] + x + j)));
+          }
+        }
+        __m128i lo = _mm_packs_epi32(round_avx2(sum[0], divisor), round_avx2(sum[1], divisor));
+        __m128i hi = _mm_packs_epi32(round_avx2(sum[2], divisor), round_avx2(sum[3], divisor));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(lo, hi));
+      }
+      columns_scalar(rows, weights, count, total, dst, x, width);
+    }
+
+    // Same with two registers per pixel: blue and green, red and alpha
+    SIMD_TARGET("ssse3")
+    inline void load_ssse3(uint32 const* pixel, __m128d& lo, __m128d& hi) {
+      __m128i const spread = _mm_setr_epi8(0, -1, -1, -1, 1, -1, -1, -1, 2, -1, -1, -1, 3, -1, -1, -1);
+      __m128i value = _mm_shuffle_epi8(_mm_cvtsi32_si128(int(*pixel)), spread);
+      lo = _mm_cvtepi32_pd(value);
+      hi = _mm_cvtepi32_pd(_mm_srli_si128(value, 8));
+    }
+    SIMD_TARGET("ssse3")
+    inline __m128i round_ssse3(__m128d lo, __m128d hi, __m128d total) {
+      __m128d const half = _mm_set1_pd(0.5);
+      __m128i a = _mm_cvttpd_epi32(_mm_add_pd(_mm_div_pd(lo, total), half));
+      __m128i b = _mm_cvttpd_epi32(_mm_add_pd(_mm_div_pd(hi, total), half));
+      return _mm_unpacklo_epi64(a, b);
+    }
+
+    SIMD_TARGET("ssse3")
+    void rows_ssse3(Kernel const& kernel, uint32 const* src, uint32* dst, int width) {
+      for (int i = 0; i < width; ++i) {
+        if (kernel.total[i] == 0) {
+          dst[i] = 0;
+          continue;
+        }
+        double const* weights = &kernel.weights[size_t(i) * kernel.taps];
+        uint32 const* pixels = src + kernel.left[i];
+        __m128d sumLo = _mm_setzero_pd(), sumHi = _mm_setzero_pd();
+        for (int k = 0; k < kernel.count[i]; ++k) {
+          __m128d weight = _mm_set1_pd(weights[k]), lo, hi;
+          load_ssse3(pixels + k, lo, hi);
+          sumLo = _mm_add_pd(sumLo, _mm_mul_pd(weight, lo));
+          sumHi = _mm_add_pd(sumHi, _mm_mul_pd(weight, hi));
+        }
+        __m128i value = round_ssse3(sumLo, sumHi, _mm_set1_pd(kernel.total[i]));
+        value = _mm_packs_epi32(value, value);
+        dst[i] = uint32(_mm_cvtsi128_si32(_mm_packus_epi16(value, value)));
+      }
+    }
+
+    SIMD_TARGET("ssse3")
+    void columns_ssse3(uint32 const* const* rows, double const* weights, int count, double total, uint32* dst, int width) {
+      if (total == 0) {
+        memset(dst, 0, sizeof(uint32) * width);
+        return;
+      }
+      __m128d const divisor = _mm_set1_pd(total);
+      int x = 0;
+      for (; x + 2 <= width; x += 2) {
+        __m128d sum[4] = {_mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd()};
+        for (int k = 0; k < count; ++k) {
+          __m128d weight = _mm_set1_pd(weights[k]), lo, hi;
+          load_ssse3(rows[k] + x, lo, hi);
+          sum[0] = _mm_add_pd(sum[0], _mm_mul_pd(weight, lo));
+          sum[1] = _mm_add_pd(sum[1], _mm_mul_pd(weight, hi));
+          load_ssse3(rows[k] + x + 1, lo, hi);
+          sum[2] = _mm_add_pd(sum[2], _mm_mul_pd(weight, lo));
+          sum[3] = _mm_add_pd(sum[3], _mm_mul_pd(weight, hi));
+        }
+        __m128i value = _mm_packs_epi32(round_ssse3(sum[0], sum[1], divisor), round_ssse3(sum[2], sum[3], divisor));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(value, value));
+      }
+      columns_scalar(rows, weights, count, total, dst, x, width);
+    }
+#endif
+
+  }
+
+  void resampleRows(Image const& src, Image& dst, double scale, double radius, ImageFilter::Function filter) {
+    auto kernel = get_kernel(src.width(), dst.width(), scale, radius, filter);
+    auto rows = rows_scalar;
+#ifdef SIMD_X86
+    if (useSimd && Simd::hasAVX2()) rows = rows_avx2;
+    else if (useSimd && Simd::hasSSSE3()) rows = rows_ssse3;
+#endif
+    uint32 const* in = reinterpret_cast<uint32 const*>(src.bits());
+    uint32* out = reinterpret_cast<uint32*>(dst.mutable_bits());
+    for (int y = 0; y < src.height(); ++y, in += src.width(), out += dst.width()) {
+      rows(*kernel, in, out, dst.width());
+    }
+  }
+
+  void resampleColumns(Image const& src, Image& dst, double scale, double radius, ImageFilter::Function filter) {
+    auto kernel = get_kernel(src.height(), dst.height(), scale, radius, filter);
+    auto columns = [](uint32 const* const* rows, double const* weights, int count, double total, uint32* dst, int width) {
+      columns_scalar(rows, weights, count, total, dst, 0, width);
+    };
+    void(*func)(uint32 const* const*, double const*, int, double, uint32*, int) = columns;
+#ifdef SIMD_X86
+    if (useSimd && Simd::hasAVX2()) func = columns_avx2;
+    else if (useSimd && Simd::hasSSSE3()) func = columns_ssse3;
+#endif
+    int width = src.width();
+    uint32 const* in = reinterpret_cast<uint32 const*>(src.bits());
+    uint32* out = reinterpret_cast<uint32*>(dst.mutable_bits());
+    std::vector<uint32 const*> rows(kernel->taps);
+    for (int y = 0; y < dst.height(); ++y, out += width) {
+      for (int k = 0; k < kernel->count[y]; ++k) {
+        rows[k] = in + size_t(kernel->left[y] + k) * width;
+      }
+      func(rows.data(), &kernel->weights[size_t(y) * kernel->taps], kernel->count[y], kernel->total[y], out, width);
+    }
+  }
+
+}
+
+void setResampleSimd(bool enabled) {
+  ImagePrivate::useSimd = enabled;
+}
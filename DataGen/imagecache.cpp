@@ -0,0 +1,111 @@
+#include "imagecache.h"
+#include "utils/path.h"
+#include <algorithm>
+
+namespace {
+
+  const uint32 KEYS_SIGNATURE = 0x59454B49; // IKEY
+  const uint32 ARCHIVE_SIGNATURE = 0x31585A47; // GZX1
+
+#pragma pack(push, 1)
+  struct KeysHeader {
+    uint32 signature;
+    uint32 version;
+    uint32 archives;
+    uint32 count;
+  };
+  // entry of the table at the start of a .gzx file, see Archive::write
+  struct ArchiveEntry {
+    uint64 id;
+    uint32 offset;
+    uint32 size;
+    uint32 usize;
+  };
+#pragma pack(pop)
+
+}
+
+const uint32 ImageCache::VERSION;
+
+ImageCache::ImageCache(std::string const& root, uint32 archives)
+  : root_(root)
+  , archives_(archives)
+{
+  File list(root / "images.keys", "rb");
+  KeysHeader header;
+  if (!list || list.read(&header, sizeof header) != sizeof header || header.signature != KEYS_SIGNATURE ||
+      header.version != VERSION || !header.archives || header.archives > 256 ||
+      uint64(header.count) * sizeof(Entry) > list.size() - sizeof header) {
+    return;
+  }
+  std::vector<Entry> entries(header.count);
+  list.read(entries.data(), entries.size() * sizeof(Entry));
+
+  std::vector<std::unordered_map<uint64, ArchiveEntry>> tables(header.archives);
+  for (uint32 i = 0; i < header.archives; ++i) {
+    oldArchives_.push_back(MappedFile(root / fmtstring("images%u.gzx", i)));
+    ByteReader reader(oldArchives_.back());
+    if (reader.read32() != ARCHIVE_SIGNATURE) continue;
+    uint32 count = reader.read32();
+    for (uint32 j = 0; j < count && reader.left() >= sizeof(ArchiveEntry); ++j) {
+      ArchiveEntry entry = reader.read<ArchiveEntry>();
+      uint64 id = entry.id;
+      tables[i][id] = entry;
+    }
+  }
+
+  for (Entry const& entry : entries) {
+    uint64 id = entry.id;
+    uint32 archive = uint32(id % header.archives);
+    auto it = tables[archive].find(id);
+    // images are stored uncompressed; anything else means the archive was written by
+    // another run
+    if (it == tables[archive].end() || it->second.size != entry.size || it->second.usize != entry.size ||
+        uint64(it->second.offset) + entry.size > oldArchives_[archive].size()) {
+      continue;
+    }
+    old_.emplace(Key::from(entry.key), Location{archive, it->second.offset, entry.size});
+  }
+}
+
+File ImageCache::find(uint8 const* key) const {
+  auto cur = new_.find(Key::from(key));
+  if (cur != new_.end()) {
+    return cur->second;
+  }
+  auto it = old_.find(Key::from(key));
+  if (it == old_.end()) {
+    return File();
+  }
+  // copied out of the mapping, which release() unmaps before the old archive is overwritten
+  MemoryFile image;
+  memcpy(image.alloc(it->second.size), oldArchives_[it->second.archive].data() + it->second.offset, it->second.size);
+  image.seek(0);
+  return image;
+}
+
+void ImageCache::add(uint8 const* key, uint64 id, File image) {
+  Entry entry;
+  memcpy(entry.key, key, sizeof entry.key);
+  entry.id = id;
+  entry.size = uint32(image.size());
+  entries_.push_back(entry);
+  new_.emplace(Key::from(key), image);
+}
+
+void ImageCache::release() {
+  old_.clear();
+  new_.clear();
+  oldArchives_.clear();
+  delete_file((root_ / "images.keys").c_str());
+}
+
+void ImageCache::write() {
+  std::stable_sort(entries_.begin(), entries_.end(), [](Entry const& lhs, Entry const& rhs) {
+    return memcmp(lhs.key, rhs.key, sizeof lhs.key) < 0;
+  });
+  File list(root_ / "images.keys", "wb");
+  KeysHeader header = {KEYS_SIGNATURE, VERSION, archives_, uint32(entries_.size())};
+  list.write(&header, sizeof header);
+  list.write(entries_.data(), entries_.size() * sizeof(Entry));
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "utils/file.h"
+#include "ngdp/ngdp.h"
+#include <unordered_map>
+
+// Lets write_images skip decoding and encoding images whose source did not change. Every
+// archive entry is recorded with the content key of the file it was made from (see
+// FileLoader::contentKey) in images.keys, next to the image archives (images<n>.gzx). The
+// next run copies the encoded image from the old archive when it finds the same key, and
+// files with the same contents within a run share one encoded image.
+class ImageCache {
+public:
+  // raise when images decode or encode differently, to drop the entries of older runs
+  static const uint32 VERSION = 1;
+
+  // Reads the list left in root by the previous run and maps its archives
+  ImageCache(std::string const& root, uint32 archives);
+
+  // the encoded image made from contents with this key, or null; images from the old
+  // archives are copied into memory, so they stay valid after release()
+  File find(uint8 const* key) const;
+  // records the archive entry holding the image made from contents with this key
+  void add(uint8 const* key, uint64 id, File image);
+
+  // Unmaps the old archives and deletes their list, so that a run stopped while the new
+  // archives are written can't leave a list that doesn't match them. Call before writing;
+  // find() returns nothing afterwards.
+  void release();
+  // writes the list of the entries added in this run
+  void write();
+
+private:
+#pragma pack(push, 1)
+  struct Entry {
+    NGDP::Hash key;
+    uint64 id;
+    uint32 size;
+  };
+#pragma pack(pop)
+  struct Location {
+    uint32 archive;
+    uint32 offset;
+    uint32 size;
+  };
+  typedef NGDP::Hash_container Key;
+
+  std::string root_;
+  uint32 archives_;
+  std::vector<File> oldArchives_;
+  std::unordered_map<Key, Location, Key::hash, Key::equal> old_;
+  std::unordered_map<Key, File, Key::hash, Key::equal> new_;
+  std::vector<Entry> entries_;
+};
@@ -10,11 +10,12 @@
 #include "rmpq/archive.h"
 #include "utils/logger.h"
 #include "icons.h"
+#include "imagecache.h"
 #include "hash.h"
 #include "jass.h"
 #include "parse.h"
-
-#include <windows.h>
+#include "bench.h"
+#include "tests.h"
 
 File stringify(json::Value const& js, int indent = 0) {
   MemoryFile mfile;
@@ -45,15 +46,25 @@ File gzip(File src) {
 #define USE_CDN 1
 #define GENERATE_MAPS 0
 #define TEST_MAP 0
+#define RUN_BENCHMARKS 0
+#define RUN_TESTS 0
+#define VERIFY_CACHE 0
 #define NUM_IMAGE_ARCHIVES 8
+#define PNG_EFFORT PNGEffort::Balanced
+#define JPEG_DCT JPEGDCT::Accurate
 
 MemoryFile write_images(std::set<istring> const& names, CompositeLoader& loader, bool all = false) {
-  ImageStorage images(16, 16, 16, 16);
+  setPNGEffort(PNG_EFFORT);
+  setJPEGDCT(JPEG_DCT);
+  ImageStorage images({16, 32, 64}, 16, 16);
   HashArchive imarc[NUM_IMAGE_ARCHIVES];
   HashArchive mdxarc;
   File listFile;
+  std::unique_ptr<ImageCache> cache;
+  size_t reused = 0;
   if (all) {
 	  listFile = File("rootlist.txt", "wb");
+    cache.reset(new ImageCache(path::root(), NUM_IMAGE_ARCHIVES));
   }
   for (auto fn : Logger::loop(names)) {
     istring ext = path::ext(fn);
@@ -82,32 +93,54 @@ MemoryFile write_images(std::set<istring> const& names, CompositeLoader& loader,
     if (!isImage) {
       continue;
     }
-    if (!all && fn.find("replaceabletextures\\") != 0) {
+    bool isIcon = (fn.find("replaceabletextures\\") == 0);
+    if (!all && !isIcon) {
       continue;
     }
+    // images made from the same contents earlier, in this run or the previous one, are copied
+    // without decoding them; icons still need the picture for the sheets
+    NGDP::Hash key;
+    bool hasKey = (all && loader.contentKey(fn.c_str(), key));
+    File cached = (hasKey ? cache->find(key) : File());
+    if (cached) {
+      imarc[hash % NUM_IMAGE_ARCHIVES].add(hash, cached);
+      cache->add(key, hash, cached);
+      listFile.printf("%s\n", fn.c_str());
+      reused += 1;
+      if (!isIcon) {
+        continue;
+      }
+    }
     File f = loader.load(fn.c_str());
-    Image img(f);
+    // the icon sheets only need a small mip level, unless the image is also written in full
+    Image img(f, all && !cached ? ImageDecodeOptions() : images.options());
     if (img) {
-      if (fn.find("replaceabletextures\\") == 0) {
+      if (isIcon) {
         images.add(pathHash(fn.c_str()), img);
       }
-	    if (all) {
+	    if (all && !cached) {
         File& imgf = imarc[hash % NUM_IMAGE_ARCHIVES].create(hash);
         img.write(imgf);
+        if (hasKey) {
+          cache->add(key, hash, imgf);
+        }
         listFile.printf("%s\n", fn.c_str());
 	    }
     }
   }
   if (all) {
+    Logger::log("%u images copied from earlier builds or duplicates", (uint32) reused);
+    cache->release();
     for (size_t i = 0; i < NUM_IMAGE_ARCHIVES; ++i) {
       imarc[i].write(File(path::root() / fmtstring("images%d.gzx", (int)i), "wb"));
     }
     mdxarc.write(File(path::root() / "files.gzx", "wb"));
+    cache->write();
   }
-  MemoryFile hashes;
-  images.writeHashes(hashes);
-  hashes.seek(0);
-  return hashes;
+  MemoryFile icons;
+  images.write(icons);
+  icons.seek(0);
+  return icons;
 }
 
 MemoryFile write_meta(std::set<istring> const& names, CompositeLoader& loader, File icons) {
@@ -279,10 +312,10 @@ struct MpqBuildData : public BuildData {
       loader.add(arc);
     }
 
-    File listf(path::root() / "../listfile.txt", "rb");
-    std::string line;
+    LineReader listf(File(path::root() / "../listfile.txt", "rb"));
+    StringView line;
     while (listf.getline(line)) {
-      names.insert(trim(line));
+      names.insert(trim(line).str());
     }
 
     info.build = 7085;
@@ -291,6 +324,17 @@ struct MpqBuildData : public BuildData {
 };
 
 int main() {
+#if VERIFY_CACHE
+  NGDP::ArchiveIndex::verify(true);
+  return 0;
+#endif
+
+#if RUN_TESTS
+  size_t failed = test_http() + test_cdn_pool() + test_archive_cache();
+  Logger::log("tests: %u failed checks", (uint32) failed);
+  return failed ? 1 : 0;
+#endif
+
   auto build = CdnLoader::ngdp().version().build;
   //build = "38f31eb67143d03da05854bfb559ed42"; // 1.30.1.10211
   //build = "34872da6a3842639ff2d2a86ee9b3755"; // 1.30.2.11024
@@ -302,6 +346,21 @@ int main() {
 
   //std::string root = R"(G:\Games\Warcraft III)";
 
+#if RUN_BENCHMARKS
+  benchmark_slk(data.loader, data.names);
+  benchmark_w3u(data.loader, data.names);
+  benchmark_resolve(data.loader, data.names);
+  benchmark_dxt(data.loader, data.names);
+  benchmark_bptc(data.loader, data.names);
+  benchmark_png(data.loader, data.names);
+  benchmark_resample(data.loader, data.names);
+  benchmark_blend(data.loader, data.names);
+  benchmark_index(data.cdnloader->archives());
+  report_blte();
+  report_cdn(CdnLoader::ngdp().cdn());
+  return 0;
+#endif
+
   data.write_data(true, true);
 
   //data.write_maps();
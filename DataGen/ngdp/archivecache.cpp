@@ -0,0 +1,305 @@
+#include "archivecache.h"
+#include "utils/parallel.h"
+#include "utils/path.h"
+#include "utils/checksum.h"
+#include "utils/logger.h"
+#include <algorithm>
+
+namespace NGDP {
+
+  const uint32 ArchiveCache::INVALID;
+  const uint32 ArchiveCache::MAX_REQUEST_BLOCKS;
+
+  ArchiveCache::ArchiveCache(std::string const& root, CdnPool& cdn, PathFunc path, uint32 blockSize, size_t connections)
+    : root_(root)
+    , cdn_(cdn)
+    , path_(path)
+    , blockSize_(blockSize)
+    , connections_(connections)
+  {
+  }
+
+#pragma pack(push, 1)
+  struct CacheIndexHeader {
+    uint32 magic;
+    uint32 version;
+    uint32 blockSize;
+    uint32 reserved;
+  };
+  struct CacheIndexRecord {
+    uint32 block;
+    uint32 offset;
+    uint32 size;
+    uint32 crc;
+  };
+#pragma pack(pop)
+  static const uint32 CACHE_INDEX_MAGIC = 0x58494341; // ACIX
+  static const uint32 CACHE_INDEX_VERSION = 1;
+
+  ArchiveCache::Archive& ArchiveCache::archive_(std::string const& name) {
+    Archive* archive;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      archive = &archives_[name];
+    }
+    std::lock_guard<std::mutex> lock(archive->mutex);
+    refresh_(name, *archive);
+    return *archive;
+  }
+
+  void ArchiveCache::refresh_(std::string const& name, Archive& archive) {
+    std::string path = root_ / name + ".idx";
+    uint64 size = file_size(path.c_str());
+    if (size == archive.indexSize) return;
+    if (size < archive.indexSize) {
+      // the index was rebuilt by verify
+      archive.indexSize = 0;
+      archive.blocks.clear();
+    }
+    File index(path);
+    if (!index) return;
+    if (!archive.indexSize) {
+      CacheIndexHeader header;
+      if (index.read(&header, sizeof header) != sizeof header || header.magic != CACHE_INDEX_MAGIC ||
+          header.version != CACHE_INDEX_VERSION || header.blockSize != blockSize_) {
+        return;
+      }
+      archive.indexSize = sizeof header;
+    }
+    index.seek(archive.indexSize);
+    CacheIndexRecord record;
+    // a record cut short by a crash is ignored, and overwritten by the next writer
+    while (index.read(&record, sizeof record) == sizeof record) {
+      if (record.block >= archive.blocks.size()) {
+        archive.blocks.resize(record.block + 1);
+      }
+      archive.blocks[record.block].offset = record.offset;
+      archive.blocks[record.block].size = record.size;
+      archive.indexSize += sizeof record;
+    }
+  }
+
+  bool ArchiveCache::has_(Archive& archive, uint32 block) {
+    return block < archive.blocks.size() && archive.blocks[block].offset != INVALID;
+  }
+
+  bool ArchiveCache::fetch(std::vector<Range> const& ranges) {
+    std::map<std::string, std::vector<uint32>> missing;
+    for (auto const& range : ranges) {
+      if (!range.size) continue;
+      Archive& archive = archive_(range.archive);
+      std::lock_guard<std::mutex> lock(archive.mutex);
+      uint32 start = range.offset / blockSize_;
+      uint32 end = (uint32) ((uint64(range.offset) + range.size + blockSize_ - 1) / blockSize_);
+      for (uint32 i = start; i < end; ++i) {
+        if (!has_(archive, i)) {
+          missing[range.archive].push_back(i);
+        }
+      }
+    }
+
+    // merge runs of consecutive blocks, capped so that large batches still spread over connections
+    std::vector<Span> spans;
+    for (auto& kv : missing) {
+      auto& blocks = kv.second;
+      std::sort(blocks.begin(), blocks.end());
+      blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+      Archive& archive = archive_(kv.first);
+      for (size_t i = 0; i < blocks.size();) {
+        size_t j = i + 1;
+        while (j < blocks.size() && blocks[j] == blocks[j - 1] + 1 && blocks[j] - blocks[i] < MAX_REQUEST_BLOCKS) {
+          ++j;
+        }
+        spans.push_back(Span{&archive, kv.first, blocks[i], blocks[j - 1] + 1});
+        i = j;
+      }
+    }
+
+    std::vector<uint8> done(spans.size());
+    parallel_for(spans.size(), [&](size_t i) {
+      done[i] = download_(spans[i]);
+    }, connections_);
+    return !std::count(done.begin(), done.end(), 0);
+  }
+
+  bool ArchiveCache::download_(Span const& span) {
+    CdnPool::Response response;
+    if (!cdn_.get(path_(span.name), response, fmtstring("%u-%u", span.start * blockSize_, span.end * blockSize_ - 1))) {
+      return false;
+    }
+    uint32 status = response.status;
+    File result = response.body;
+
+    // a server that ignores the range sends the whole archive
+    uint32 start = 0, end, total = (uint32) result.size();
+    end = total - 1;
+    if (status == 206) {
+      std::string range;
+      for (auto const& header : response.headers) {
+        if (istring(header.first) == "Content-Range") {
+          range = header.second;
+        }
+      }
+      if (sscanf(range.c_str(), "bytes %u-%u/%u", &start, &end, &total) != 3) {
+        return false;
+      }
+    }
+    if (!total || end < start || result.size() < end - start + 1) return false;
+
+    // only blocks that were received in full can be stored
+    uint32 bstart = (start + blockSize_ - 1) / blockSize_;
+    uint32 bend = (end >= total - 1 ? (total + blockSize_ - 1) / blockSize_ : (end + 1) / blockSize_);
+
+    Archive& archive = *span.archive;
+    std::lock_guard<std::mutex> lock(archive.mutex);
+    std::string path = root_ / span.name;
+    FileLock fileLock((path + ".lock").c_str());
+    if (!fileLock) return false;
+    refresh_(span.name, archive);
+
+    File index;
+    if (!archive.indexSize) {
+      // new archive, or one stored in an older format
+      delete_file(path.c_str());
+      delete_file((path + ".map").c_str());
+      index = File(path + ".idx", "wb+");
+      CacheIndexHeader header{CACHE_INDEX_MAGIC, CACHE_INDEX_VERSION, blockSize_, 0};
+      if (!index || !index.write(header)) return false;
+      archive.indexSize = sizeof header;
+      archive.blocks.clear();
+    } else {
+      index = File(path + ".idx", "rb+");
+      if (!index) return false;
+    }
+    File data(path, "rb+");
+    if (!data) data = File(path, "wb+");
+    if (!data) return false;
+    data.seek(0, SEEK_END);
+    uint32 filepos = (uint32) data.tell();
+
+    std::vector<CacheIndexRecord> records;
+    std::vector<uint8> buffer;
+    for (uint32 i = bstart; i < bend; ++i) {
+      if (!has_(archive, i)) {
+        uint32 size = std::min<uint32>(blockSize_, total - i * blockSize_);
+        buffer.resize(size);
+        result.seek(i * blockSize_ - start);
+        if (result.read(buffer.data(), size) != size || data.write(buffer.data(), size) != size) return false;
+        records.push_back(CacheIndexRecord{i, filepos, size, crc32(buffer.data(), size)});
+        filepos += size;
+      }
+    }
+    // blocks must be on disk before the records that point to them
+    if (!records.empty()) {
+      if (!data.flush()) return false;
+      index.seek(archive.indexSize);
+      if (index.write(records.data(), records.size() * sizeof(CacheIndexRecord)) != records.size() * sizeof(CacheIndexRecord) ||
+          !index.flush()) {
+        return false;
+      }
+      archive.indexSize += records.size() * sizeof(CacheIndexRecord);
+      for (auto const& record : records) {
+        if (record.block >= archive.blocks.size()) {
+          archive.blocks.resize(record.block + 1);
+        }
+        archive.blocks[record.block].offset = record.offset;
+        archive.blocks[record.block].size = record.size;
+      }
+    }
+    for (uint32 i = span.start; i < span.end && i * uint64(blockSize_) < total; ++i) {
+      if (!has_(archive, i)) return false;
+    }
+    return true;
+  }
+
+  File ArchiveCache::read(std::string const& name, uint32 offset, uint32 size) {
+    // ranges that are already stored skip fetch and its request bookkeeping
+    File result = read_(name, offset, size);
+    if (!result) {
+      fetch(std::vector<Range>{Range{name, offset, size}});
+      result = read_(name, offset, size);
+    }
+    return result;
+  }
+
+  File ArchiveCache::read_(std::string const& name, uint32 offset, uint32 size) {
+    Archive& archive = archive_(name);
+    std::lock_guard<std::mutex> lock(archive.mutex);
+    uint32 blockStart = offset / blockSize_;
+    uint32 blockEnd = (uint32) ((uint64(offset) + size + blockSize_ - 1) / blockSize_);
+    for (uint32 i = blockStart; i < blockEnd; ++i) {
+      if (!has_(archive, i)) return File();
+    }
+    File data(root_ / name);
+    if (!data) return File();
+    MemoryFile result;
+    uint8* output = result.alloc(size);
+    for (uint32 i = blockStart; i < blockEnd; ++i) {
+      uint32 curstart = std::max<uint32>(offset, i * blockSize_);
+      uint32 curend = (uint32) std::min<uint64>(uint64(offset) + size, uint64(i) * blockSize_ + archive.blocks[i].size);
+      if (curend <= curstart) return File();
+      data.seek(archive.blocks[i].offset + curstart - i * blockSize_);
+      if (data.read(output + curstart - offset, curend - curstart) != curend - curstart) return File();
+    }
+    result.seek(0);
+    return result;
+  }
+
+  size_t ArchiveCache::verify(std::string const& root, bool repair) {
+    size_t bad = 0, total = 0;
+    std::string const suffix = ".idx";
+    for (std::string const& file : list_files(root.c_str())) {
+      if (file.size() <= suffix.size() || file.substr(file.size() - suffix.size()) != suffix) continue;
+      std::string name = file.substr(0, file.size() - suffix.size());
+      std::string path = root / name;
+      FileLock fileLock((path + ".lock").c_str());
+
+      File index(path + ".idx");
+      File data(path);
+      CacheIndexHeader header;
+      if (!index || index.read(&header, sizeof header) != sizeof header || header.magic != CACHE_INDEX_MAGIC ||
+          header.version != CACHE_INDEX_VERSION) {
+        Logger::log("%s: invalid index", name.c_str());
+        continue;
+      }
+      uint64 dataSize = (data ? data.size() : 0);
+      std::vector<CacheIndexRecord> good;
+      size_t damaged = 0;
+      std::vector<uint8> buffer;
+      CacheIndexRecord record;
+      while (index.read(&record, sizeof record) == sizeof record) {
+        bool valid = (record.size && record.size <= header.blockSize && uint64(record.offset) + record.size <= dataSize);
+        if (valid) {
+          buffer.resize(record.size);
+          data.seek(record.offset);
+          valid = (data.read(buffer.data(), record.size) == record.size && crc32(buffer.data(), record.size) == record.crc);
+        }
+        if (valid) {
+          good.push_back(record);
+        } else {
+          damaged++;
+        }
+      }
+      total += good.size() + damaged;
+      if (!damaged) continue;
+      bad += damaged;
+      Logger::log("%s: %u of %u blocks damaged", name.c_str(), (uint32) damaged, (uint32) (good.size() + damaged));
+      if (repair) {
+        index.release();
+        std::string temp = path + ".idx.tmp";
+        {
+          File out(temp, "wb");
+          if (!out) continue;
+          out.write(header);
+          out.write(good.data(), good.size() * sizeof(CacheIndexRecord));
+          out.flush();
+        }
+        delete_file((path + ".idx").c_str());
+        rename_file(temp.c_str(), (path + ".idx").c_str());
+      }
+    }
+    Logger::log("archive cache: %u blocks checked, %u damaged", (uint32) total, (uint32) bad);
+    return bad;
+  }
+
+}
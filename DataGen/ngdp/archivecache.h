@@ -0,0 +1,82 @@
+#pragma once
+#include "utils/common.h"
+#include "utils/file.h"
+#include "cdnpool.h"
+#include <functional>
+#include <mutex>
+
+namespace NGDP {
+
+  // Local copy of the parts of CDN archives that have been used so far. Each archive is stored
+  // as a log of the blocks fetched so far, appended in download order, and <name>.idx is an
+  // append-only list of records giving the position, size and CRC of every stored block.
+  // Blocks are written and synced before their records, so a crash can only leave unused
+  // bytes behind. Writers hold a lock on <name>.lock, which lets several processes share the
+  // cache; each one picks up the records added by the others before downloading.
+  class ArchiveCache {
+  public:
+    // maps an archive name to its path on the CDN
+    typedef std::function<std::string(std::string const& name)> PathFunc;
+
+    ArchiveCache(std::string const& root, CdnPool& cdn, PathFunc path, uint32 blockSize = (1U << 20), size_t connections = 4);
+
+    struct Range {
+      std::string archive;
+      uint32 offset;
+      uint32 size;
+    };
+
+    // Downloads every missing block touched by ranges. Adjacent and overlapping blocks of an
+    // archive are merged into one request, and up to `connections` requests run at once.
+    // Returns false if any request failed.
+    bool fetch(std::vector<Range> const& ranges);
+
+    // Reads a range of an archive, fetching it first if needed
+    File read(std::string const& archive, uint32 offset, uint32 size);
+
+    // Checks every block stored under root against its size and CRC, and returns the number
+    // of bad blocks. With repair, the index of each damaged archive is rewritten without them
+    // so they are downloaded again.
+    static size_t verify(std::string const& root, bool repair = false);
+
+    static const uint32 INVALID = 0xFFFFFFFFUL;
+    // longest run of blocks fetched by a single request
+    static const uint32 MAX_REQUEST_BLOCKS = 16;
+
+  private:
+    struct Block {
+      uint32 offset = INVALID;
+      uint32 size = 0;
+    };
+    struct Archive {
+      std::mutex mutex;
+      uint64 indexSize = 0; // bytes of the index applied to blocks so far
+      std::vector<Block> blocks;
+    };
+    struct Span {
+      Archive* archive;
+      std::string name;
+      uint32 start;
+      uint32 end;
+    };
+
+    std::string root_;
+    CdnPool& cdn_;
+    PathFunc path_;
+    uint32 blockSize_;
+    size_t connections_;
+    std::map<std::string, Archive> archives_;
+    std::mutex mutex_;
+
+    // returns the archive with the current index applied; the caller must then hold
+    // archive.mutex to use it
+    Archive& archive_(std::string const& name);
+    // applies the records added to the index since the last call
+    void refresh_(std::string const& name, Archive& archive);
+    bool has_(Archive& archive, uint32 block);
+    bool download_(Span const& span);
+    // reads a range from the stored blocks; null if any of them is missing
+    File read_(std::string const& name, uint32 offset, uint32 size);
+  };
+
+}
@@ -0,0 +1,500 @@
+#include "blte.h"
+#include "utils/checksum.h"
+#include "utils/parallel.h"
+#include "utils/path.h"
+#include "zlib/zlib.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+namespace NGDP {
+
+  struct BLTEChunk {
+    uint32 csize;
+    uint32 usize; // 0 if unknown (headerless files)
+    bool checked;
+    uint8 hash[16];
+    uint64 src;
+    uint64 dst;
+  };
+
+  // reads the chunk table and leaves the file at the start of the chunk data; headerless files
+  // are described as a single unchecked chunk
+  static bool ReadChunks(File& blte, std::vector<BLTEChunk>& chunks, uint32 usize = 0) {
+    if (!blte) return false;
+    uint64 size = blte.size();
+    blte.seek(0);
+    if (size < 8 || blte.read32(true) != 0x424c5445 /*BLTE*/) return false;
+    uint32 headerSize = blte.read32(true);
+    if (headerSize) {
+      blte.seek(2, SEEK_CUR); // flags
+      uint16 count = blte.read16(true);
+      if (!count) return false;
+      chunks.resize(count);
+      uint64 src = 0, dst = 0;
+      for (auto& chunk : chunks) {
+        chunk.csize = blte.read32(true);
+        chunk.usize = blte.read32(true);
+        chunk.checked = true;
+        if (blte.read(chunk.hash, sizeof chunk.hash) != sizeof chunk.hash) return false;
+        chunk.src = src;
+        chunk.dst = dst;
+        if (!chunk.csize) return false;
+        src += chunk.csize;
+        dst += chunk.usize;
+      }
+      return size - blte.tell() >= src;
+    } else {
+      if (size == 8) return false;
+      chunks.resize(1);
+      chunks[0].csize = size - 8;
+      chunks[0].usize = usize;
+      chunks[0].checked = false;
+      chunks[0].src = 0;
+      chunks[0].dst = 0;
+      return true;
+    }
+  }
+
+  // inflates a stream of unknown size
+  static bool InflateAll(uint8 const* src, uint32 size, std::vector<uint8>& dst) {
+    z_stream z;
+    memset(&z, 0, sizeof z);
+    z.next_in = const_cast<Bytef*>(src);
+    z.avail_in = size;
+    z.zalloc = gzalloc;
+    z.zfree = gzfree;
+    if (inflateInit(&z) != Z_OK) return false;
+    dst.resize(std::max<size_t>(size * 4, 4096));
+    int result;
+    do {
+      if (z.total_out == dst.size()) dst.resize(dst.size() * 2);
+      z.next_out = dst.data() + z.total_out;
+      z.avail_out = dst.size() - z.total_out;
+      result = inflate(&z, Z_NO_FLUSH);
+    } while (result == Z_OK);
+    dst.resize(z.total_out);
+    inflateEnd(&z);
+    return result == Z_STREAM_END;
+  }
+
+  static bool VerifyChunk(uint8 const* src, BLTEChunk const& chunk) {
+    uint8 hash[16];
+    MD5::checksum(src, chunk.csize, hash);
+    return !memcmp(hash, chunk.hash, sizeof hash);
+  }
+
+  static void Salsa20(uint8 const* key, uint8 const* iv, uint8* data, size_t size) {
+    static const uint32 sigma[4] = {0x61707865, 0x3120646e, 0x79622d36, 0x6b206574}; // "expand 16-byte k"
+    uint32 input[16];
+    input[0] = sigma[0];
+    input[5] = sigma[1];
+    input[10] = sigma[2];
+    input[15] = sigma[3];
+    for (int i = 0; i < 4; ++i) {
+      memcpy(&input[1 + i], key + i * 4, 4);
+      memcpy(&input[11 + i], key + i * 4, 4);
+    }
+    memcpy(&input[6], iv, 8);
+    input[8] = input[9] = 0;
+
+    auto rotl = [](uint32 x, int n) { return (x << n) | (x >> (32 - n)); };
+    uint32 x[16];
+    uint8 stream[64];
+    for (size_t pos = 0; pos < size; pos += 64) {
+      memcpy(x, input, sizeof x);
+      for (int i = 0; i < 10; ++i) {
+        x[4] ^= rotl(x[0] + x[12], 7); x[8] ^= rotl(x[4] + x[0], 9);
+        x[12] ^= rotl(x[8] + x[4], 13); x[0] ^= rotl(x[12] + x[8], 18);
+        x[9] ^= rotl(x[5] + x[1], 7); x[13] ^= rotl(x[9] + x[5], 9);
+        x[1] ^= rotl(x[13] + x[9], 13); x[5] ^= rotl(x[1] + x[13], 18);
+        x[14] ^= rotl(x[10] + x[6], 7); x[2] ^= rotl(x[14] + x[10], 9);
+        x[6] ^= rotl(x[2] + x[14], 13); x[10] ^= rotl(x[6] + x[2], 18);
+        x[3] ^= rotl(x[15] + x[11], 7); x[7] ^= rotl(x[3] + x[15], 9);
+        x[11] ^= rotl(x[7] + x[3], 13); x[15] ^= rotl(x[11] + x[7], 18);
+        x[1] ^= rotl(x[0] + x[3], 7); x[2] ^= rotl(x[1] + x[0], 9);
+        x[3] ^= rotl(x[2] + x[1], 13); x[0] ^= rotl(x[3] + x[2], 18);
+        x[6] ^= rotl(x[5] + x[4], 7); x[7] ^= rotl(x[6] + x[5], 9);
+        x[4] ^= rotl(x[7] + x[6], 13); x[5] ^= rotl(x[4] + x[7], 18);
+        x[11] ^= rotl(x[10] + x[9], 7); x[8] ^= rotl(x[11] + x[10], 9);
+        x[9] ^= rotl(x[8] + x[11], 13); x[10] ^= rotl(x[9] + x[8], 18);
+        x[12] ^= rotl(x[15] + x[14], 7); x[13] ^= rotl(x[12] + x[15], 9);
+        x[14] ^= rotl(x[13] + x[12], 13); x[15] ^= rotl(x[14] + x[13], 18);
+      }
+      for (int i = 0; i < 16; ++i) {
+        uint32 word = x[i] + input[i];
+        memcpy(stream + i * 4, &word, 4);
+      }
+      size_t count = std::min<size_t>(64, size - pos);
+      for (size_t i = 0; i < count; ++i) {
+        data[pos + i] ^= stream[i];
+      }
+      if (!++input[8]) ++input[9];
+    }
+  }
+
+  static void ARC4(uint8 const* key, size_t keySize, uint8* data, size_t size) {
+    uint8 state[256];
+    for (int i = 0; i < 256; ++i) {
+      state[i] = i;
+    }
+    for (int i = 0, j = 0; i < 256; ++i) {
+      j = (j + state[i] + key[i % keySize]) & 0xFF;
+      std::swap(state[i], state[j]);
+    }
+    for (size_t k = 0, i = 0, j = 0; k < size; ++k) {
+      i = (i + 1) & 0xFF;
+      j = (j + state[i]) & 0xFF;
+      std::swap(state[i], state[j]);
+      data[k] ^= state[(state[i] + state[j]) & 0xFF];
+    }
+  }
+
+  // decrypts the payload of an 'E' chunk in place, returning the start of the inner chunk
+  static uint8* DecryptChunk(uint8* src, uint32& size, size_t index) {
+    uint8* end = src + size;
+    if (size < 1 || *src++ != 8 || end - src < 9) return nullptr;
+    uint64 name;
+    memcpy(&name, src, 8);
+    src += 8;
+    uint8 ivSize = *src++;
+    if (ivSize > 8 || end - src < ivSize + 1) return nullptr;
+    uint8 iv[8] = {0};
+    memcpy(iv, src, ivSize);
+    src += ivSize;
+    uint8 type = *src++;
+    uint8 const* key = KeyStore::instance().get(name);
+    if (!key) return nullptr;
+    // the chunk index is mixed into the IV so that every chunk gets its own stream
+    for (int i = 0; i < 4; ++i) {
+      iv[i] ^= (index >> (i * 8)) & 0xFF;
+    }
+    size = end - src;
+    if (type == 'S') {
+      Salsa20(key, iv, src, size);
+    } else if (type == 'A') {
+      uint8 arcKey[32] = {0};
+      memcpy(arcKey, key, 16);
+      memcpy(arcKey + 16, iv, ivSize);
+      ARC4(arcKey, sizeof arcKey, src, size);
+    } else {
+      return nullptr;
+    }
+    return src;
+  }
+
+  struct TypeCounters {
+    std::atomic<uint64> chunks;
+    std::atomic<uint64> csize;
+    std::atomic<uint64> usize;
+    std::atomic<uint64> ns;
+  };
+  static TypeCounters counters[4];
+  static char const counterTypes[] = "NZEF";
+
+  class ChunkTimer {
+  public:
+    ChunkTimer(uint8 type, uint32 csize)
+      : counter_(nullptr)
+      , start_(std::chrono::steady_clock::now())
+      , csize_(csize)
+    {
+      char const* pos = (type ? strchr(counterTypes, type) : nullptr);
+      if (pos) counter_ = &counters[pos - counterTypes];
+    }
+    void done(uint32 usize) {
+      if (!counter_) return;
+      counter_->chunks += 1;
+      counter_->csize += csize_;
+      counter_->usize += usize;
+      counter_->ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count();
+    }
+  private:
+    TypeCounters* counter_;
+    std::chrono::steady_clock::time_point start_;
+    uint32 csize_;
+  };
+
+  static bool DecodeChunk(uint8 const* src, uint32 csize, size_t index, std::vector<uint8>& dst, uint32 usize);
+
+  // decodes a chunk whose decoded size is known
+  static bool DecodeChunk(uint8 const* src, uint32 csize, size_t index, uint8* dst, uint32 usize) {
+    if (!csize) return false;
+    ChunkTimer timer(src[0], csize);
+    uint32 size = usize;
+    switch (src[0]) {
+    case 'N':
+      if (csize - 1 != usize) return false;
+      memcpy(dst, src + 1, usize);
+      break;
+    case 'Z':
+      if (gzinflate(src + 1, csize - 1, dst, &size) || size != usize) return false;
+      break;
+    case 'E': {
+      std::vector<uint8> temp(src + 1, src + csize);
+      uint32 length = temp.size();
+      uint8* inner = DecryptChunk(temp.data(), length, index);
+      if (!inner || !DecodeChunk(inner, length, index, dst, usize)) return false;
+      break;
+    }
+    case 'F': {
+      File inner = DecodeBLTE(MemoryFile(src + 1, csize - 1));
+      if (!inner || inner.size() != usize) return false;
+      memcpy(dst, inner.data(), usize);
+      break;
+    }
+    default:
+      // unsupported compression
+      return false;
+    }
+    timer.done(usize);
+    return true;
+  }
+
+  // decodes a chunk into a buffer of the right size, handling chunks of unknown size
+  static bool DecodeChunk(uint8 const* src, uint32 csize, size_t index, std::vector<uint8>& dst, uint32 usize) {
+    if (usize || !csize) {
+      dst.resize(usize);
+      return DecodeChunk(src, csize, index, dst.data(), usize);
+    }
+    ChunkTimer timer(src[0], csize);
+    switch (src[0]) {
+    case 'N':
+      dst.assign(src + 1, src + csize);
+      break;
+    case 'Z':
+      if (!InflateAll(src + 1, csize - 1, dst)) return false;
+      break;
+    case 'E': {
+      std::vector<uint8> temp(src + 1, src + csize);
+      uint32 length = temp.size();
+      uint8* inner = DecryptChunk(temp.data(), length, index);
+      if (!inner || !DecodeChunk(inner, length, index, dst, 0)) return false;
+      break;
+    }
+    case 'F': {
+      File inner = DecodeBLTE(MemoryFile(src + 1, csize - 1));
+      if (!inner) return false;
+      dst.assign(inner.data(), inner.data() + inner.size());
+      break;
+    }
+    default:
+      return false;
+    }
+    timer.done(dst.size());
+    return true;
+  }
+
+  // files below this size are not worth spreading over threads
+  static const uint64 BLTE_PARALLEL_SIZE = (1 << 20);
+
+  File DecodeBLTE(File blte, uint32 eusize, bool verify) {
+    std::vector<BLTEChunk> chunks;
+    if (!ReadChunks(blte, chunks, eusize)) return File();
+    uint64 start = blte.tell();
+    if (!chunks[0].checked) {
+      BLTEChunk const& chunk = chunks[0];
+      if (blte.getc() == 'N') {
+        return blte.subfile(start + 1, chunk.csize - 1);
+      }
+      ByteReader reader(blte);
+      reader.seek(start);
+      std::vector<uint8> out;
+      if (!DecodeChunk(reader.ptr(), chunk.csize, 0, out, chunk.usize)) return File();
+      return MemoryFile(std::move(out));
+    }
+
+    ByteReader reader(blte);
+    reader.seek(start);
+    uint8 const* data = reader.ptr();
+    uint64 size = chunks.back().dst + chunks.back().usize;
+    MemoryFile out;
+    uint8* ptr = out.alloc(size);
+    // chunks are independent, so they are decoded straight into place
+    std::vector<uint8> valid(chunks.size());
+    parallel_for(chunks.size(), [&](size_t i) {
+      BLTEChunk const& chunk = chunks[i];
+      valid[i] = (!verify || VerifyChunk(data + chunk.src, chunk)) && DecodeChunk(data + chunk.src, chunk.csize, i, ptr + chunk.dst, chunk.usize);
+    }, size >= BLTE_PARALLEL_SIZE ? 0 : 1);
+    if (std::count(valid.begin(), valid.end(), 0)) return File();
+    out.seek(0);
+    return out;
+  }
+
+  class BlteFileBuffer : public FileBuffer {
+  public:
+    BlteFileBuffer(File blte, std::vector<BLTEChunk>&& chunks, bool verify)
+      : blte_(blte)
+      , start_(blte.tell())
+      , chunks_(std::move(chunks))
+      , verify_(verify)
+    {
+      size_ = chunks_.back().dst + chunks_.back().usize;
+    }
+
+    uint64 tell() const {
+      return pos_;
+    }
+    void seek(int64 pos, int mode) {
+      switch (mode) {
+      case SEEK_CUR:
+        pos += pos_;
+        break;
+      case SEEK_END:
+        pos += size();
+        break;
+      }
+      if (pos < 0) pos = 0;
+      pos_ = pos;
+    }
+    uint64 size() {
+      if (!chunks_[0].checked && !chunks_[0].usize) {
+        // headerless file of unknown size, the only way to find out is to decode it
+        load_(0);
+      }
+      return size_;
+    }
+
+    size_t read(void* ptr, size_t size) {
+      uint8* dst = (uint8*) ptr;
+      size_t done = 0;
+      while (done < size) {
+        if (current_ >= chunks_.size() || pos_ < chunks_[current_].dst || pos_ >= chunks_[current_].dst + data_.size()) {
+          // find the chunk containing pos_, typically the next one
+          size_t index = std::upper_bound(chunks_.begin(), chunks_.end(), pos_, [](uint64 pos, BLTEChunk const& chunk) {
+            return pos < chunk.dst;
+          }) - chunks_.begin() - 1;
+          if (!load_(index)) break;
+          if (pos_ >= chunks_[current_].dst + data_.size()) break;
+        }
+        size_t offset = pos_ - chunks_[current_].dst;
+        size_t count = std::min(size - done, data_.size() - offset);
+        memcpy(dst + done, data_.data() + offset, count);
+        done += count;
+        pos_ += count;
+      }
+      return done;
+    }
+    size_t write(void const* ptr, size_t size) {
+      return 0;
+    }
+
+  private:
+    File blte_;
+    uint64 start_;
+    std::vector<BLTEChunk> chunks_;
+    bool verify_;
+    uint64 size_;
+    uint64 pos_ = 0;
+    size_t current_ = -1;
+    std::vector<uint8> data_;
+    std::vector<uint8> raw_;
+
+    bool load_(size_t index) {
+      if (index == current_) return true;
+      current_ = -1;
+      data_.clear();
+      BLTEChunk const& chunk = chunks_[index];
+      uint8 const* src = blte_.data();
+      if (src) {
+        src += start_ + chunk.src;
+      } else {
+        raw_.resize(chunk.csize);
+        blte_.seek(start_ + chunk.src);
+        if (blte_.read(raw_.data(), chunk.csize) != chunk.csize) return false;
+        src = raw_.data();
+      }
+      if (verify_ && chunk.checked && !VerifyChunk(src, chunk)) return false;
+      if (!DecodeChunk(src, chunk.csize, index, data_, chunk.usize)) return false;
+      if (!chunk.checked) size_ = data_.size();
+      current_ = index;
+      return true;
+    }
+  };
+
+  File OpenBLTE(File blte, bool verify) {
+    std::vector<BLTEChunk> chunks;
+    if (!ReadChunks(blte, chunks)) return File();
+    return File(std::make_shared<BlteFileBuffer>(blte, std::move(chunks), verify));
+  }
+
+  KeyStore& KeyStore::instance() {
+    static KeyStore store(File(path::root() / "tactkeys.txt"));
+    return store;
+  }
+
+  KeyStore::KeyStore(File file) {
+    if (file) load(file);
+  }
+
+  static bool ParseHex(StringView str, uint8* out, size_t size) {
+    if (str.size() != size * 2) return false;
+    for (size_t i = 0; i < str.size(); ++i) {
+      char c = str[i];
+      int digit;
+      if (c >= '0' && c <= '9') {
+        digit = c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        digit = c - 'a' + 10;
+      } else if (c >= 'A' && c <= 'F') {
+        digit = c - 'A' + 10;
+      } else {
+        return false;
+      }
+      out[i / 2] = (out[i / 2] << 4) | digit;
+    }
+    return true;
+  }
+
+  size_t KeyStore::load(File file) {
+    size_t count = 0;
+    LineReader reader(file);
+    StringView line;
+    while (reader.getline(line)) {
+      line = trim(line);
+      if (line.empty() || line[0] == '#') continue;
+      size_t sep = 0;
+      while (sep < line.size() && !strchr(" \t;,", line[sep])) ++sep;
+      size_t next = sep;
+      while (next < line.size() && strchr(" \t;,", line[next])) ++next;
+      uint8 name[8];
+      Key key;
+      if (ParseHex(line.substr(0, sep), name, sizeof name) && ParseHex(trim(line.substr(next)), key.data(), key.size())) {
+        // names are written as big-endian numbers, but stored little-endian in the chunks
+        uint64 id = 0;
+        for (uint8 byte : name) {
+          id = (id << 8) | byte;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        keys_[id] = key;
+        ++count;
+      }
+    }
+    return count;
+  }
+
+  void KeyStore::add(uint64 name, uint8 const* key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    memcpy(keys_[name].data(), key, 16);
+  }
+
+  uint8 const* KeyStore::get(uint64 name) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = keys_.find(name);
+    return (it == keys_.end() ? nullptr : it->second.data());
+  }
+
+  std::map<char, BLTEStats> GetBLTEStats() {
+    std::map<char, BLTEStats> stats;
+    for (size_t i = 0; i < sizeof counters / sizeof counters[0]; ++i) {
+      if (!counters[i].chunks) continue;
+      BLTEStats& dst = stats[counterTypes[i]];
+      dst.chunks = counters[i].chunks;
+      dst.csize = counters[i].csize;
+      dst.usize = counters[i].usize;
+      dst.time = double(counters[i].ns) / 1000000.0;
+    }
+    return stats;
+  }
+
+}
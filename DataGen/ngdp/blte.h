@@ -0,0 +1,48 @@
+#pragma once
+#include "utils/common.h"
+#include "utils/file.h"
+#include <array>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+namespace NGDP {
+
+  // Decodes a whole BLTE file into memory. Chunks are decoded in parallel for large files;
+  // verify checks each chunk against its MD5. usize is only used by headerless files, and
+  // may be left at 0 if unknown.
+  File DecodeBLTE(File blte, uint32 usize = 0, bool verify = false);
+
+  // Returns a File that decodes chunks as they are read, so only the encoded data and the
+  // current chunk are kept in memory. Seeking skips over chunks without decoding them.
+  File OpenBLTE(File blte, bool verify = false);
+
+  // Keys for encrypted ('E') chunks. The shared instance reads tactkeys.txt from the root
+  // folder, one "name key" pair of hex strings per line.
+  class KeyStore {
+  public:
+    static KeyStore& instance();
+
+    KeyStore(File file = File());
+
+    size_t load(File file);
+    void add(uint64 name, uint8 const* key);
+    uint8 const* get(uint64 name) const;
+
+  private:
+    typedef std::array<uint8, 16> Key;
+    std::unordered_map<uint64, Key> keys_;
+    mutable std::mutex mutex_;
+  };
+
+  // Totals per chunk type since startup; the time of 'E' and 'F' chunks includes the chunks
+  // nested inside them
+  struct BLTEStats {
+    uint64 chunks;
+    uint64 csize;
+    uint64 usize;
+    double time; // ms, summed over all threads
+  };
+  std::map<char, BLTEStats> GetBLTEStats();
+
+}
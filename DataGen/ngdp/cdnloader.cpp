@@ -1,4 +1,5 @@
 #include "cdnloader.h"
+#include "utils/parallel.h"
 
 CdnLoader::CdnLoader(std::string const& build)
   : archives_(ngdp())
@@ -9,24 +10,28 @@ CdnLoader::CdnLoader(std::string const& build)
 
   auto encodingHashes = split(buildConfig_["encoding"]);
   if (encodingHashes.size() != 2) throw Exception("failed to parse build config");
-  File rawFile = ngdp().load(encodingHashes[1], "data", false, "Fetching encoding file");
-  if (!rawFile) throw Exception("failed to load encoding file");
-  encoding_.reset(new NGDP::Encoding(NGDP::DecodeBLTE(rawFile, stoi(split(buildConfig_["encoding-size"])[0]))));
-  rawFile.release();
+  encoding_ = NGDP::LoadEncoding(ngdp(), encodingHashes[0], encodingHashes[1]);
 
   NGDP::Hash hash;
   NGDP::from_string(hash, buildConfig_["root"]);
-  File root = load_(hash);
+  auto* rootEntry = encoding_->getEncoding(hash);
+  File root = (rootEntry ? NGDP::OpenBLTE(archives_.load(rootEntry->keys[0])) : File());
   if (!root) {
     throw Exception("invalid root file");
   }
 
-  std::string line;
-  while (root.getline(line)) {
-    auto parts = split(line, '|');
-    if (parts.size() >= 2 && parts[1].size() == 32) {
-      fixPath_(parts[0]);
-      NGDP::from_string(root_[parts[0]]._, parts[1]);
+  LineReader reader(root);
+  StringView line;
+  std::string path;
+  while (reader.getline(line)) {
+    size_t sep = line.find('|');
+    if (sep == StringView::npos) continue;
+    size_t end = line.find('|', sep + 1);
+    StringView hash = line.substr(sep + 1, end == StringView::npos ? end : end - sep - 1);
+    if (hash.size() == 32) {
+      path.assign(line.data(), sep);
+      fixPath_(path);
+      NGDP::from_string(root_[path]._, hash.str());
     }
   }
 }
@@ -43,6 +48,7 @@ void CdnLoader::fixPath_(std::string& path) {
 
 File CdnLoader::load_(const NGDP::Hash hash) {
   auto* entry = encoding_->getEncoding(hash);
+  if (!entry) return File();
   File raw = archives_.load(entry->keys[0]);
   if (!raw) return raw;
   return NGDP::DecodeBLTE(raw, entry->usize);
@@ -59,6 +65,49 @@ File CdnLoader::load(char const* cpath) {
   }
 }
 
+FileLoader* CdnLoader::resolve(std::string& path) {
+  fixPath_(path);
+  return root_.count(path) ? this : nullptr;
+}
+
+bool CdnLoader::contentKey(char const* cpath, uint8* key) {
+  std::string path = cpath;
+  fixPath_(path);
+  auto it = root_.find(path);
+  if (it == root_.end()) return false;
+  memcpy(key, it->second._, sizeof(NGDP::Hash));
+  return true;
+}
+
+std::vector<std::future<File>> CdnLoader::loadMany(std::vector<std::string> const& paths) {
+  return splitBatch(run_async([this, paths]() {
+    std::vector<File> files(paths.size());
+    std::vector<size_t> found;
+    std::vector<NGDP::Hash_container> keys;
+    std::vector<NGDP::Encoding::EncodingEntry const*> entries;
+    std::string path;
+    for (size_t i = 0; i < paths.size(); ++i) {
+      path = paths[i];
+      fixPath_(path);
+      auto it = root_.find(path);
+      if (it == root_.end()) continue;
+      auto* entry = encoding_->getEncoding(it->second._);
+      if (!entry) continue;
+      found.push_back(i);
+      keys.push_back(NGDP::Hash_container::from(entry->keys[0]));
+      entries.push_back(entry);
+    }
+    // fetch the raw data in one pass, then decode on all cores
+    std::vector<File> raw = archives_.loadMany(keys);
+    parallel_for(found.size(), [&](size_t i) {
+      if (raw[i]) {
+        files[found[i]] = NGDP::DecodeBLTE(raw[i], entries[i]->usize);
+      }
+    });
+    return files;
+  }), paths.size());
+}
+
 CdnLoader::BuildInfo CdnLoader::buildInfo() const {
   std::string const& name = buildConfig_.at("build-name");
   BuildInfo info;
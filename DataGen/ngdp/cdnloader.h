@@ -12,6 +12,14 @@ public:
   }
 
   virtual File load(char const* path) override;
+  virtual std::vector<std::future<File>> loadMany(std::vector<std::string> const& paths) override;
+  virtual FileLoader* resolve(std::string& path) override;
+  // the content hash listed in the root file
+  virtual bool contentKey(char const* path, uint8* key) override;
+
+  NGDP::ArchiveIndex const& archives() const {
+    return archives_;
+  }
 
   std::map<std::string, std::string> buildConfig() const {
     return buildConfig_;
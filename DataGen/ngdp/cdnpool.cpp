@@ -0,0 +1,114 @@
+#include "cdnpool.h"
+#include "utils/http.h"
+#include <algorithm>
+
+namespace NGDP {
+
+  // weight of the latest request in the moving average
+  static const double LATENCY_DECAY = 0.25;
+  // added to every host's latency so that idle hosts still share concurrent requests
+  static const double LATENCY_BIAS = 50.0;
+  static const uint32 MAX_BACKOFF = 60;
+
+  CdnPool::CdnPool(std::vector<std::string> const& hosts, std::string const& path)
+    : hosts_(hosts.size())
+  {
+    for (size_t i = 0; i < hosts.size(); ++i) {
+      hosts_[i].base = "http://" + hosts[i] + "/" + path + "/";
+      hosts_[i].stats = HostStats{hosts[i], 0, 0, 0, 0.0, 0.0};
+    }
+  }
+
+  int CdnPool::acquire_(std::vector<bool>& tried) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto now = Clock::now();
+    int best = -1;
+    bool bestReady = false;
+    double bestScore = 0;
+    for (size_t i = 0; i < hosts_.size(); ++i) {
+      if (tried[i]) continue;
+      Host const& host = hosts_[i];
+      bool ready = (host.retry <= now);
+      // hosts that are backing off are only used once every other host has failed
+      double score = ready ? (host.stats.latency + LATENCY_BIAS) * (host.active + 1)
+                           : std::chrono::duration<double>(host.retry - now).count();
+      if (best < 0 || (ready && !bestReady) || (ready == bestReady && score < bestScore)) {
+        best = (int) i;
+        bestReady = ready;
+        bestScore = score;
+      }
+    }
+    if (best >= 0) {
+      tried[best] = true;
+      hosts_[best].active++;
+    }
+    return best;
+  }
+
+  void CdnPool::release_(int index, bool failed, uint64 bytes, double time) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Host& host = hosts_[index];
+    host.active--;
+    host.stats.requests++;
+    host.stats.time += time;
+    if (failed) {
+      host.stats.failures++;
+      host.errors++;
+      uint32 backoff = std::min<uint32>(MAX_BACKOFF, 1U << std::min<uint32>(host.errors - 1, 6));
+      host.retry = Clock::now() + std::chrono::seconds(backoff);
+    } else {
+      host.errors = 0;
+      host.stats.bytes += bytes;
+      host.stats.latency = (host.stats.requests == 1 ? time : host.stats.latency + (time - host.stats.latency) * LATENCY_DECAY);
+    }
+  }
+
+  bool CdnPool::get(std::string const& path, Response& response, std::string const& range, File output) {
+    std::vector<bool> tried(hosts_.size(), false);
+    uint64 start = (output ? output.tell() : 0);
+    int index;
+    while ((index = acquire_(tried)) >= 0) {
+      auto time = Clock::now();
+      HttpRequest request(hosts_[index].base + path);
+      if (!range.empty()) request.addHeader("Range: bytes=" + range);
+      if (output) {
+        // drop whatever a failed attempt wrote, which may be longer than the response
+        if (!output.truncate(start) && output.size() > start) return false;
+        output.seek(start);
+        request.setOutput(output);
+      }
+      response.status = (request.send() ? request.status() : 0);
+      response.headers.clear();
+      response.body = File();
+      if (response.status == 200 || response.status == 206) {
+        response.headers = request.headers();
+        response.body = request.response();
+      }
+      bool failed = (!response.body && (response.status == 0 || response.status >= 500));
+      release_(index, failed, response.body ? response.body.size() : 0,
+        std::chrono::duration<double, std::milli>(Clock::now() - time).count());
+      // other errors (e.g. 404) are the same on every mirror
+      if (!failed) return !!response.body;
+    }
+    return false;
+  }
+
+  std::string CdnPool::url(std::string const& path) {
+    std::vector<bool> tried(hosts_.size(), false);
+    int index = acquire_(tried);
+    if (index < 0) return std::string();
+    std::lock_guard<std::mutex> lock(mutex_);
+    hosts_[index].active--;
+    return hosts_[index].base + path;
+  }
+
+  std::vector<CdnPool::HostStats> CdnPool::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<HostStats> result;
+    for (auto const& host : hosts_) {
+      result.push_back(host.stats);
+    }
+    return result;
+  }
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "utils/common.h"
+#include "utils/file.h"
+#include <chrono>
+#include <mutex>
+
+namespace NGDP {
+
+  // Requests to the mirrors listed for a CDN. Each request goes to the host with the lowest
+  // expected wait (recent request time times the number of requests in flight), so that
+  // concurrent requests spread over all hosts and slow mirrors get less work. A host that
+  // fails is skipped for an increasing backoff time, and the request moves on to the next
+  // host. Connections to every host used are kept alive by HttpRequest.
+  class CdnPool {
+  public:
+    CdnPool(std::vector<std::string> const& hosts, std::string const& path);
+
+    struct Response {
+      uint32 status = 0;
+      std::map<std::string, std::string> headers;
+      File body;
+    };
+
+    // GET for a path relative to the CDN root, with an optional "first-last" byte range. The
+    // body is streamed into output if it is given, which is truncated back to its starting
+    // position before every attempt. Returns false if no host responded with 200 or 206;
+    // response then holds the last answer received.
+    bool get(std::string const& path, Response& response, std::string const& range = "", File output = File());
+
+    size_t size() const {
+      return hosts_.size();
+    }
+    // URL of a path on the currently preferred host
+    std::string url(std::string const& path);
+
+    struct HostStats {
+      std::string host;
+      uint64 requests;
+      uint64 failures;
+      uint64 bytes;
+      double time;    // ms spent in requests, summed over all threads
+      double latency; // ms, moving average of recent requests
+    };
+    std::vector<HostStats> stats() const;
+
+  private:
+    typedef std::chrono::steady_clock Clock;
+    struct Host {
+      std::string base;
+      uint32 active = 0;
+      uint32 errors = 0; // consecutive failures
+      Clock::time_point retry;
+      HostStats stats;
+    };
+    std::vector<Host> hosts_;
+    mutable std::mutex mutex_;
+
+    // picks a host not in tried and marks a request as started on it, or returns -1
+    int acquire_(std::vector<bool>& tried);
+    void release_(int index, bool failed, uint64 bytes, double time);
+  };
+
+}
@@ -3,7 +3,9 @@
 #include "utils/path.h"
 #include "utils/checksum.h"
 #include "utils/logger.h"
+#include "utils/parallel.h"
 #include <algorithm>
+#include <functional>
   
 namespace NGDP {
 
@@ -62,7 +64,7 @@ namespace NGDP {
     if (!cdns.count(region) || !versions.count(region)) {
       throw Exception("invalid region");
     }
-    base_ = "http://" + cdns[region].hosts[0] + "/" + cdns[region].path + "/";
+    cdn_ = std::make_shared<CdnPool>(cdns[region].hosts, cdns[region].path);
     version_ = versions[region];
     if (app == "d3") {
       auto v2 = GetVersions("d3t");
@@ -72,18 +74,37 @@ namespace NGDP {
     }
   }
 
+  std::string NGDP::cdnpath(std::string const& hash, std::string const& type, bool index) const {
+    std::string path = type + "/" + hash.substr(0, 2) + "/" + hash.substr(2, 2) + "/" + hash;
+    if (index) path += ".index";
+    return path;
+  }
   std::string NGDP::geturl(std::string const& hash, std::string const& type, bool index) const {
-    std::string url = base_ + type + "/" + hash.substr(0, 2) + "/" + hash.substr(2, 2) + "/" + hash;
-    if (index) url += ".index";
-    return url;
+    return cdn_->url(cdnpath(hash, type, index));
   }
   File NGDP::load(std::string const& hash, std::string const& type, bool index, char const* preload) const {
     std::string path = path::root() / CACHE / type / hash;
     if (index) path += ".index";
     File file(path);
     if (file) return file;
-    file = HttpRequest::get(geturl(hash, type, index));
-    if (!file) return file;
+    if (!preload) {
+      // stream straight to disk, so that large files are never held in memory
+      std::string part = path + ".part";
+      bool success;
+      {
+        CdnPool::Response response;
+        success = cdn_->get(cdnpath(hash, type, index), response, "", File(part, "wb+")) && response.status == 200;
+      }
+      if (!success) {
+        delete_file(part.c_str());
+        return File();
+      }
+      rename_file(part.c_str(), path.c_str());
+      return File(path);
+    }
+    CdnPool::Response response;
+    if (!cdn_->get(cdnpath(hash, type, index), response) || response.status != 200) return File();
+    file = response.body;
     if (preload) {
       ::NGDP::preload(preload, file);
     }
@@ -92,57 +113,6 @@ namespace NGDP {
     return file;
   }
 
-  File DecodeBLTE(File blte, uint32 eusize) {
-    if (blte.read32(true) != 0x424c5445 /*BLTE*/) return File();
-    uint32 headerSize = blte.read32(true);
-    if (headerSize) {
-      std::vector<uint32> csize;
-      std::vector<uint32> usize;
-      uint16 flags = blte.read16(true);
-      uint16 chunks = blte.read16(true);
-      for (uint16 i = 0; i < chunks; ++i) {
-        csize.push_back(blte.read32(true));
-        usize.push_back(blte.read32(true));
-        blte.seek(16, SEEK_CUR);
-      }
-      MemoryFile dst;
-      std::vector<uint8> tmp;
-      for (uint16 i = 0; i < chunks; ++i) {
-        uint8 type = blte.read8();
-        if (type == 'N') {
-          if (csize[i] - 1 != usize[i]) return File();
-          blte.read(dst.alloc(usize[i]), usize[i]);
-        } else if (type == 'Z') {
-          tmp.resize(csize[i] - 1);
-          blte.read(&tmp[0], tmp.size());
-          if (gzinflate(&tmp[0], tmp.size(), dst.alloc(usize[i]), &usize[i])) return File();
-        } else {
-          // unsupported compression
-          return File();
-        }
-      }
-      dst.seek(0);
-      return dst;
-    } else {
-      uint8 type = blte.read8();
-      uint64 offset = blte.tell();
-      uint64 size = blte.size() - offset;
-      if (type == 'N') {
-        return blte.subfile(offset, size);
-      } else if (type == 'Z' && eusize) {
-        std::vector<uint8> tmp(size);
-        blte.read(&tmp[0], size);
-        MemoryFile dst;
-        if (gzinflate(&tmp[0], size, dst.alloc(eusize), &eusize)) return File();
-        dst.seek(0);
-        return dst;
-      } else {
-        // unsupported compression
-        return File();
-      }
-    }
-  }
-
   std::map<std::string, std::string> ParseConfig(File file) {
     std::map<std::string, std::string> result;
     if (!file) return result;
@@ -181,6 +151,27 @@ namespace NGDP {
     return MD5::format(hash);
   }
 
+  struct EncodingTableHeader {
+    uint32 magic;
+    uint32 version;
+    uint32 stringSize;
+    uint32 encodingCount;
+    uint32 encodingSize;
+    uint32 layoutCount;
+    uint32 layoutSize; // including the terminating zero
+    uint32 reserved;
+  };
+  static const uint32 ENCODING_TABLE_MAGIC = 0x4C425445; // ETBL
+  static const uint32 ENCODING_TABLE_VERSION = 1;
+
+  static uint64 align4(uint64 size) {
+    return (size + 3) & ~uint64(3);
+  }
+  static uint64 tableSize(EncodingTableHeader const& header) {
+    return sizeof(EncodingTableHeader) + align4(header.stringSize) + uint64(header.encodingCount) * sizeof(uint32) +
+      align4(header.encodingSize) + uint64(header.layoutCount) * sizeof(Encoding::LayoutEntry) + header.layoutSize;
+  }
+
   Encoding::Encoding(File file) {
     EncodingFileHeader header;
     file.read(&header, sizeof header);
@@ -193,160 +184,385 @@ namespace NGDP {
     }
 
     uint32 size = file.size();
-    uint32 posHeaderA = sizeof(EncodingFileHeader) + header.stringSize;
-    uint32 posEntriesA = posHeaderA + header.entriesA * 32;
-    uint32 posHeaderB = posEntriesA + header.entriesA * 4096;
-    uint32 posEntriesB = posHeaderB + header.entriesB * 32;
-    uint32 posLayout = posEntriesB + header.entriesB * 4096;
-
-    data_.resize(header.stringSize + (header.entriesA + header.entriesB) * 4096 + (size - posLayout));
-    char* layouts = (char*) &data_[0];
-    uint8* entriesA = &data_[header.stringSize];
-    uint8* entriesB = entriesA + header.entriesA * 4096;
-    layout_ = (char*) (entriesB + header.entriesB * 4096);
-
-    file.read(layouts, header.stringSize);
-    file.seek(posEntriesA, SEEK_SET);
-    file.read(entriesA, header.entriesA * 4096);
-    file.seek(posEntriesB, SEEK_SET);
-    file.read(entriesB, header.entriesB * 4096);
-    file.read(layout_, size - posLayout);
-
-    for (char* ptr = layouts; ptr < layouts + header.stringSize; ++ptr) {
-      layouts_.push_back(ptr);
-      while (*ptr) ++ptr;
-    }
-
-    file.seek(posHeaderA, SEEK_SET);
-    encodingTable_.resize(header.entriesA);
-    for (uint32 i = 0; i < header.entriesA; ++i) {
-      file.read(encodingTable_[i].hash, sizeof(Hash));
-      Hash blockHash, realHash;
-      file.read(blockHash, sizeof blockHash);
-      MD5::checksum(entriesA, 4096, realHash);
-      if (memcmp(realHash, blockHash, sizeof(Hash))) {
-        throw Exception("encoding file checksum mismatch");
+    uint32 posLayout = sizeof(EncodingFileHeader) + header.stringSize + (header.entriesA + header.entriesB) * (32 + 4096);
+    if (size < posLayout) {
+      throw Exception("invalid encoding file");
+    }
+
+    // The file is read front to back so that it can be streamed, and each page is parsed
+    // straight into the flat table. Entry counts are only known once all pages are read, so
+    // every section gets the most a page can hold; the sections are then moved down over the
+    // unused space and the table is cut to size.
+    static const uint32 PAGE_SIZE = 4096;
+    static const uint32 BATCH_PAGES = 256;
+    EncodingTableHeader table;
+    memset(&table, 0, sizeof table);
+    table.magic = ENCODING_TABLE_MAGIC;
+    table.version = ENCODING_TABLE_VERSION;
+    table.stringSize = header.stringSize;
+    table.layoutSize = size - posLayout + 1;
+    uint64 maxEncodingCount = uint64(header.entriesA) * (PAGE_SIZE / sizeof(EncodingEntry));
+    uint64 maxEncodingSize = uint64(header.entriesA) * PAGE_SIZE;
+    uint64 maxLayoutCount = uint64(header.entriesB) * (PAGE_SIZE / sizeof(LayoutEntry));
+
+    MemoryFile data;
+    uint8* out = data.alloc((size_t) (sizeof table + align4(table.stringSize) + maxEncodingCount * sizeof(uint32) +
+      align4(maxEncodingSize) + maxLayoutCount * sizeof(LayoutEntry) + table.layoutSize));
+    uint8* outStrings = out + sizeof table;
+    uint32* outOffsets = reinterpret_cast<uint32*>(outStrings + align4(table.stringSize));
+    uint8* outEncoding = reinterpret_cast<uint8*>(outOffsets + maxEncodingCount);
+    uint8* outLayout = outEncoding + align4(maxEncodingSize);
+    file.read(outStrings, table.stringSize);
+    memset(outStrings + table.stringSize, 0, (size_t) (align4(table.stringSize) - table.stringSize));
+
+    // pages are read a batch at a time into one buffer, so that their checksums can be
+    // verified in parallel
+    std::vector<uint8> batch(BATCH_PAGES * PAGE_SIZE);
+    auto readPages = [&](uint32 count, uint8 const* checksums, std::function<void(uint8*)> parsePage) {
+      for (uint32 first = 0; first < count; first += BATCH_PAGES) {
+        uint32 pages = std::min(BATCH_PAGES, count - first);
+        if (file.read(batch.data(), pages * PAGE_SIZE) != pages * PAGE_SIZE) {
+          throw Exception("invalid encoding file");
+        }
+        parallel_for(pages, [&](size_t i) {
+          Hash realHash;
+          MD5::checksum(&batch[i * PAGE_SIZE], PAGE_SIZE, realHash);
+          if (memcmp(realHash, checksums + (first + i) * 32 + 16, sizeof(Hash))) {
+            throw Exception("encoding file checksum mismatch");
+          }
+        });
+        for (uint32 i = 0; i < pages; ++i) {
+          parsePage(&batch[i * PAGE_SIZE]);
+        }
       }
-      for (uint8* ptr = entriesA; ptr + sizeof(EncodingEntry) <= entriesA + 4096;) {
+    };
+
+    std::vector<uint8> headerA(header.entriesA * 32);
+    file.read(headerA.data(), headerA.size());
+    readPages(header.entriesA, headerA.data(), [&](uint8* page) {
+      uint8* ptr = page;
+      while (ptr + sizeof(EncodingEntry) <= page + PAGE_SIZE) {
         EncodingEntry* entry = reinterpret_cast<EncodingEntry*>(ptr);
         if (!entry->keyCount) break;
-        encodingTable_[i].entries.push_back(entry);
+        size_t entrySize = sizeof(EncodingEntry) + (entry->keyCount - 1) * sizeof(Hash);
+        if (ptr + entrySize > page + PAGE_SIZE) break;
         flip(entry->usize);
-        ptr += sizeof(EncodingEntry) + (entry->keyCount - 1) * sizeof(Hash);
+        outOffsets[table.encodingCount++] = table.encodingSize + (uint32) (ptr - page);
+        ptr += entrySize;
       }
-      entriesA += 4096;
-    }
+      memcpy(outEncoding + table.encodingSize, page, ptr - page);
+      table.encodingSize += (uint32) (ptr - page);
+    });
 
     Hash nilHash;
     memset(nilHash, 0, sizeof(Hash));
-
-    file.seek(posHeaderB, SEEK_SET);
-    layoutTable_.resize(header.entriesB);
-    for (uint32 i = 0; i < header.entriesB; ++i) {
-      file.read(layoutTable_[i].key, sizeof(Hash));
-      Hash blockHash, realHash;
-      file.read(blockHash, sizeof blockHash);
-      MD5::checksum(entriesB, 4096, realHash);
-      if (memcmp(realHash, blockHash, sizeof(Hash))) {
-        throw Exception("encoding file checksum mismatch");
-      }
-      for (uint8* ptr = entriesB; ptr + sizeof(LayoutEntry) <= entriesB + 4096;) {
+    std::vector<uint8> headerB(header.entriesB * 32);
+    file.read(headerB.data(), headerB.size());
+    readPages(header.entriesB, headerB.data(), [&](uint8* page) {
+      for (uint8* ptr = page; ptr + sizeof(LayoutEntry) <= page + PAGE_SIZE; ptr += sizeof(LayoutEntry)) {
         LayoutEntry* entry = reinterpret_cast<LayoutEntry*>(ptr);
-        if (!memcmp(entry->key, nilHash, sizeof(Hash))) {
-          break;
-        }
-        layoutTable_[i].entries.push_back(entry);
+        if (!memcmp(entry->key, nilHash, sizeof(Hash))) break;
         flip(entry->stringIndex);
         flip(entry->csize);
-        ptr += sizeof(LayoutEntry);
+        memcpy(outLayout + table.layoutCount++ * sizeof(LayoutEntry), entry, sizeof(LayoutEntry));
       }
-      entriesB += 4096;
+    });
+
+    // move the sections down to their final places, in order, so nothing is overwritten
+    // before it is moved
+    uint8* encoding = reinterpret_cast<uint8*>(outOffsets + table.encodingCount);
+    memmove(encoding, outEncoding, table.encodingSize);
+    memset(encoding + table.encodingSize, 0, (size_t) (align4(table.encodingSize) - table.encodingSize));
+    uint8* layout = encoding + align4(table.encodingSize);
+    memmove(layout, outLayout, table.layoutCount * sizeof(LayoutEntry));
+    uint8* layoutString = layout + table.layoutCount * sizeof(LayoutEntry);
+    file.read(layoutString, table.layoutSize - 1);
+    layoutString[table.layoutSize - 1] = 0;
+    memcpy(out, &table, sizeof table);
+    data.resize((size_t) tableSize(table));
+
+    if (!parse_(data)) {
+      throw Exception("invalid encoding file");
     }
   }
 
-  template<class Vec, class Comp>
-  typename Vec::const_iterator find_hash(Vec const& vec, Comp less) {
-    if (vec.empty() || less(vec[0])) return vec.end();
-    size_t left = 0, right = vec.size();
-    while (right - left > 1) {
+  bool Encoding::parse_(File data) {
+    uint8 const* base = data.data();
+    uint64 size = data.size();
+    if (!base || size < sizeof(EncodingTableHeader)) return false;
+    EncodingTableHeader const* header = reinterpret_cast<EncodingTableHeader const*>(base);
+    if (header->magic != ENCODING_TABLE_MAGIC || header->version != ENCODING_TABLE_VERSION ||
+        !header->layoutSize || tableSize(*header) != size) {
+      return false;
+    }
+    char const* strings = reinterpret_cast<char const*>(header + 1);
+    uint32 const* offsets = reinterpret_cast<uint32 const*>(strings + align4(header->stringSize));
+    uint8 const* entries = reinterpret_cast<uint8 const*>(offsets + header->encodingCount);
+    for (uint32 i = 0; i < header->encodingCount; ++i) {
+      if (uint64(offsets[i]) + sizeof(EncodingEntry) > header->encodingSize) return false;
+    }
+    LayoutEntry const* layoutEntries = reinterpret_cast<LayoutEntry const*>(entries + align4(header->encodingSize));
+    char const* layout = reinterpret_cast<char const*>(layoutEntries + header->layoutCount);
+    if (layout[header->layoutSize - 1]) return false;
+
+    layouts_.clear();
+    for (char const* ptr = strings; ptr < strings + header->stringSize; ++ptr) {
+      layouts_.push_back(ptr);
+      while (ptr < strings + header->stringSize && *ptr) ++ptr;
+    }
+    data_ = data;
+    dataSize_ = (size_t) size;
+    encodingOffsets_ = offsets;
+    encodingEntries_ = entries;
+    encodingCount_ = header->encodingCount;
+    layoutEntries_ = layoutEntries;
+    layoutCount_ = header->layoutCount;
+    layout_ = layout;
+    return true;
+  }
+
+  bool Encoding::save(File file) const {
+    return file && file.write(data_.data(), dataSize_) == dataSize_;
+  }
+
+  std::unique_ptr<Encoding> Encoding::load(File file) {
+    if (!file) return nullptr;
+    if (!file.data()) file = MemoryFile::from(file);
+    std::unique_ptr<Encoding> encoding(new Encoding);
+    if (!encoding->parse_(file)) return nullptr;
+    return encoding;
+  }
+
+  Encoding::EncodingEntry const* Encoding::getEncoding(const Hash hash) const {
+    size_t left = 0, right = encodingCount_;
+    while (left < right) {
       size_t mid = (left + right) / 2;
-      if (less(vec[mid])) {
+      EncodingEntry const* entry = reinterpret_cast<EncodingEntry const*>(encodingEntries_ + encodingOffsets_[mid]);
+      int cmp = memcmp(entry->hash, hash, sizeof(Hash));
+      if (!cmp) return entry;
+      if (cmp < 0) {
+        left = mid + 1;
+      } else {
         right = mid;
+      }
+    }
+    return nullptr;
+  }
+  Encoding::LayoutEntry const* Encoding::getLayout(const Hash key) const {
+    size_t left = 0, right = layoutCount_;
+    while (left < right) {
+      size_t mid = (left + right) / 2;
+      int cmp = memcmp(layoutEntries_[mid].key, key, sizeof(Hash));
+      if (!cmp) return &layoutEntries_[mid];
+      if (cmp < 0) {
+        left = mid + 1;
       } else {
-        left = mid;
+        right = mid;
       }
     }
-    return vec.begin() + left;
+    return nullptr;
   }
 
-  Encoding::EncodingEntry const* Encoding::getEncoding(const Hash hash) const {
-    auto it = find_hash(encodingTable_, [&hash](EncodingHeader const& rhs) {
-      return memcmp(hash, rhs.hash, sizeof(Hash)) < 0;
-    });
-    if (it == encodingTable_.end()) return nullptr;
-    auto sub = find_hash(it->entries, [&hash](EncodingEntry const* rhs) {
-      return memcmp(hash, rhs->hash, sizeof(Hash)) < 0;
-    });
-    if (sub == it->entries.end()) return nullptr;
-    if (memcmp((*sub)->hash, hash, sizeof(Hash))) return nullptr;
-    return *sub;
-  }
-  Encoding::LayoutEntry const* Encoding::getLayout(const Hash key) const {
-    auto it = find_hash(layoutTable_, [&key](LayoutHeader const& rhs) {
-      return memcmp(key, rhs.key, sizeof(Hash)) < 0;
-    });
-    if (it == layoutTable_.end()) return nullptr;
-    auto sub = find_hash(it->entries, [&key](LayoutEntry const* rhs) {
-      return memcmp(key, rhs->key, sizeof(Hash)) < 0;
-    });
-    if (sub == it->entries.end()) return nullptr;
-    if (memcmp((*sub)->key, key, sizeof(Hash))) return nullptr;
-    return *sub;
+  std::unique_ptr<Encoding> LoadEncoding(NGDP const& ngdp, std::string const& ckey, std::string const& ekey) {
+    std::string path = path::root() / CACHE / "encoding" / ckey;
+    std::unique_ptr<Encoding> encoding = Encoding::load(MappedFile(path));
+    if (encoding) return encoding;
+
+    File raw = ngdp.load(ekey, "data", false, "Fetching encoding file");
+    if (!raw) throw Exception("failed to load encoding file");
+    // decoded chunk by chunk while it is parsed
+    File file = OpenBLTE(raw);
+    if (!file) throw Exception("invalid encoding file");
+    encoding.reset(new Encoding(file));
+
+    std::string temp = path + ".tmp";
+    if (encoding->save(File(temp, "wb"))) {
+      delete_file(path.c_str());
+      rename_file(temp.c_str(), path.c_str());
+    } else {
+      delete_file(temp.c_str());
+    }
+    return encoding;
   }
 
+  struct IndexCacheHeader {
+    uint32 magic;
+    uint32 version;
+    uint32 count;
+    uint32 archives;
+    Hash listHash;
+  };
+  static const uint32 INDEX_CACHE_MAGIC = 0x58444941; // AIDX
+  static const uint32 INDEX_CACHE_VERSION = 3;
+
   ArchiveIndex::ArchiveIndex(NGDP const& ngdp, uint32 blockSize)
     : ngdp_(ngdp)
-    , blockSize_(blockSize)
+    , cache_(path::root() / CACHE / "data", ngdp.cdn(), [&ngdp](std::string const& name) {
+        return ngdp.cdnpath(name, "data");
+      }, blockSize, 4 * ngdp.cdn().size())
   {
-    Hash nilHash;
-    memset(nilHash, 0, sizeof(Hash));
-
     File cdnFile = ngdp.load(ngdp.version().cdn);
     if (!cdnFile) return;
-    std::vector<std::string> archives = split(ParseConfig(cdnFile)["archives"]);
+    archives_ = split(ParseConfig(cdnFile)["archives"]);
+
+    Hash listHash;
+    MD5 checksum;
+    for (auto const& name : archives_) {
+      checksum.process(name.data(), (uint32) name.size());
+      checksum.process("\n", 1);
+    }
+    checksum.finish(listHash);
+
+    std::string path = path::root() / CACHE / "archives.idx";
+    if (!open_(MappedFile(path), listHash)) {
+      open_(build_(path, listHash), listHash);
+    }
+  }
+
+  bool ArchiveIndex::open_(File file, Hash const& listHash) {
+    if (!file || file.size() < sizeof(IndexCacheHeader)) return false;
+    IndexCacheHeader const* header = reinterpret_cast<IndexCacheHeader const*>(file.data());
+    if (header->magic != INDEX_CACHE_MAGIC || header->version != INDEX_CACHE_VERSION ||
+        header->archives != archives_.size() || memcmp(header->listHash, listHash, sizeof(Hash)) ||
+        file.size() != sizeof(IndexCacheHeader) + uint64(header->count) * sizeof(IndexEntry)) {
+      return false;
+    }
+    index_ = file;
+    entries_ = reinterpret_cast<IndexEntry const*>(header + 1);
+    count_ = header->count;
+    return true;
+  }
 
-    archives_.resize(archives.size());
-    Logger::begin(archives.size(), "Loading indices");
-    for (size_t i = 0; i < archives.size(); ++i) {
-      archives_[i].name = archives[i];
+  File ArchiveIndex::loadIndex(size_t archive) const {
+    return ngdp_.load(archives_[archive], "data", true);
+  }
+
+  File ArchiveIndex::build_(std::string const& path, Hash const& listHash) {
+    Hash nilHash;
+    memset(nilHash, 0, sizeof(Hash));
 
+    std::vector<IndexEntry> entries;
+    size_t failed = 0;
+    Logger::begin(archives_.size(), "Loading indices");
+    for (size_t i = 0; i < archives_.size(); ++i) {
       Logger::item(nullptr);
-      File index = ngdp.load(archives[i], "data", true);
-      if (!index) continue;
-      size_t size = index.size();
+      File index = loadIndex(i);
+      if (!index) {
+        Logger::log("failed to load %s.index", archives_[i].c_str());
+        ++failed;
+        continue;
+      }
+      ByteReader reader(index);
+      size_t size = reader.size();
       for (size_t block = 0; block + 4096 <= size; block += 4096) {
-        Hash hash;
-        index.seek(block, SEEK_SET);
-        for (size_t pos = 0; pos + 24 <= 4096; pos += 24) {
-          index.read(hash, sizeof(Hash));
-          if (!memcmp(hash, nilHash, sizeof(Hash))) {
+        reader.seek(block);
+        uint8 const* ptr = reader.ptr();
+        for (size_t pos = 0; pos + 24 <= 4096; pos += 24, ptr += 24) {
+          if (!memcmp(ptr, nilHash, sizeof(Hash))) {
             block = size;
             break;
           }
-          auto& dst = index_[Hash_container::from(hash)];
-          dst.index = i;
-          dst.size = index.read32(true);
-          dst.offset = index.read32(true);
+          IndexEntry entry;
+          memcpy(entry.key, ptr, KEY_SIZE);
+          entry.index = (uint16) i;
+          entry.size = flipped(*reinterpret_cast<uint32 const*>(ptr + 16));
+          entry.offset = flipped(*reinterpret_cast<uint32 const*>(ptr + 20));
+          entries.push_back(entry);
         }
       }
+    }
+    Logger::end();
 
-      File map(path::root() / CACHE / "data" / archives[i] + ".map");
-      if (map) {
-        archives_[i].map.resize(map.size() / sizeof(uint32));
-        map.read(&archives_[i].map[0], archives_[i].map.size() * sizeof(uint32));
+    // keys listed more than once resolve to the last entry, as before
+    std::reverse(entries.begin(), entries.end());
+    std::stable_sort(entries.begin(), entries.end(), [](IndexEntry const& lhs, IndexEntry const& rhs) {
+      return memcmp(lhs.key, rhs.key, KEY_SIZE) < 0;
+    });
+    entries.erase(std::unique(entries.begin(), entries.end(), [](IndexEntry const& lhs, IndexEntry const& rhs) {
+      return !memcmp(lhs.key, rhs.key, KEY_SIZE);
+    }), entries.end());
+
+    IndexCacheHeader header;
+    header.magic = INDEX_CACHE_MAGIC;
+    header.version = INDEX_CACHE_VERSION;
+    header.count = (uint32) entries.size();
+    header.archives = (uint32) archives_.size();
+    memcpy(header.listHash, listHash, sizeof(Hash));
+    MemoryFile table;
+    table.write(header);
+    table.write(entries.data(), entries.size() * sizeof(IndexEntry));
+    std::vector<IndexEntry>().swap(entries);
+
+    // the table is cached by archive list, which does not change when a download fails, so
+    // a table missing some archives is only used for this run
+    if (failed) {
+      Logger::log("%u archive indices failed to load, %s not written", (uint32) failed, path.c_str());
+      return table;
+    }
+    std::string temp = path + ".tmp";
+    {
+      File file(temp, "wb");
+      if (!file || file.write(table.data(), (size_t) table.size()) != table.size()) {
+        file.release();
+        delete_file(temp.c_str());
+        Logger::log("failed to write %s", path.c_str());
+        return table;
       }
     }
-    Logger::end();
+    delete_file(path.c_str());
+    rename_file(temp.c_str(), path.c_str());
+    return table;
+  }
+
+  // leading key bytes as a number, for interpolation
+  static uint64 key_prefix(uint8 const* key) {
+    uint64 value;
+    memcpy(&value, key, sizeof value);
+    return flipped(value);
+  }
+
+  // Keys are MD5 hashes, so their leading bytes are uniformly distributed and interpolation
+  // finds the range in a few steps; it switches to bisection if the range stops shrinking fast.
+  ArchiveIndex::IndexEntry const* ArchiveIndex::find_(Hash const& key) const {
+    uint64 target = key_prefix(key);
+    size_t lo = 0, hi = count_;
+    for (int step = 0; lo < hi; ++step) {
+      size_t mid;
+      if (step < 4) {
+        uint64 low = key_prefix(entries_[lo].key);
+        uint64 high = key_prefix(entries_[hi - 1].key);
+        if (target < low || target > high) return nullptr;
+        double frac = (high > low ? double(target - low) / double(high - low) : 0.0);
+        mid = lo + std::min<size_t>(hi - lo - 1, size_t(frac * double(hi - lo - 1)));
+      } else {
+        mid = lo + (hi - lo) / 2;
+      }
+      int cmp = memcmp(entries_[mid].key, key, KEY_SIZE);
+      if (!cmp) return &entries_[mid];
+      if (cmp < 0) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return nullptr;
+  }
+
+  bool ArchiveIndex::locate(Hash const& key, Location& location) const {
+    IndexEntry const* entry = find_(key);
+    if (!entry) return false;
+    location.archive = entry->index;
+    location.offset = entry->offset;
+    location.size = entry->size;
+    return true;
+  }
+
+  size_t ArchiveIndex::verify(bool repair) {
+    return ArchiveCache::verify(path::root() / CACHE / "data", repair);
+  }
+
+  size_t ArchiveIndex::memory() const {
+    return entries_ ? sizeof(IndexCacheHeader) + count_ * sizeof(IndexEntry) : 0;
   }
 
   //void ArchiveIndex::convert() {
@@ -386,106 +602,37 @@ namespace NGDP {
   //}
 
   File ArchiveIndex::load(Hash const& hash) {
-    auto it = index_.find(Hash_container::from(hash));
-    if (it == index_.end()) return ngdp_.load(hash, "data");
-    std::string archivePath = path::root() / CACHE / "data" / archives_[it->second.index].name;
-
-    uint32 offset = it->second.offset;
-    uint32 size = it->second.size;
-    uint32 blockStart = offset / blockSize_;
-    uint32 blockEnd = (offset + size + blockSize_ - 1) / blockSize_;
-    auto& map = archives_[it->second.index].map;
-    uint32 getStart = blockEnd;
-    uint32 getEnd = blockStart;
-    for (uint32 i = blockStart; i < blockEnd; ++i) {
-      if (i >= map.size() || map[i] == ArchiveInfo::INVALID) {
-        getStart = std::min(getStart, i);
-        getEnd = std::max(getEnd, i + 1);
-      }
-    }
-    if (getStart < getEnd) {
-      std::string url = ngdp_.geturl(archives_[it->second.index].name, "data");
-      HttpRequest request(url);
-      request.addHeader(fmtstring("Range: bytes=%u-%u", getStart * blockSize_, getEnd * blockSize_ - 1));
-      request.send();
-      uint32 status = request.status();
-      if (status != 200 && status != 206) return File();
-      auto headers = request.headers();
-      File result = request.response();
-      File archive = File(archivePath, "rb+");
-      if (!archive) archive = File(archivePath, "wb+");
-      if (headers.count("Content-Range")) {
-        uint32 start, end, total, bstart, bend;
-        if (sscanf(headers["Content-Range"].c_str(), "bytes %u-%u/%u", &start, &end, &total) != 3) {
-          return File();
-        }
-        bstart = (start + blockSize_ - 1) / blockSize_;
-        if (end >= total - 1) {
-          bend = (total + blockSize_ - 1) / blockSize_;
-        } else {
-          bend = (end + 1) / blockSize_;
-        }
-        map.resize((total + blockSize_ - 1) / blockSize_, ArchiveInfo::INVALID);
-        size_t filepos = archive.size();
-        archive.seek(filepos, SEEK_SET);
-        for (size_t i = bstart; i < bend; ++i) {
-          if (map[i] == ArchiveInfo::INVALID) {
-            map[i] = filepos;
-            size_t size = std::min<size_t>(blockSize_, total - i * blockSize_);
-            result.seek(i * blockSize_ - start, SEEK_SET);
-            archive.copy(result, size);
-            filepos += size;
-          }
-        }
-        File(path::root() / CACHE / "data" / archives_[it->second.index].name + ".map", "wb").write(&map[0], map.size() * sizeof(uint32));
-      } else {
-        archive.copy(result);
-        size_t size = result.size();
-        size_t blocks = (size + blockSize_ - 1) / blockSize_;
-        map.resize(blocks);
-        for (size_t i = 0; i < blocks; ++i) {
-          map[i] = i * blockSize_;
-        }
-        File(path::root() / CACHE / "data" / archives_[it->second.index].name + ".map", "wb").write(&map[0], map.size() * sizeof(uint32));
+    IndexEntry const* entry = find_(hash);
+    if (!entry) return ngdp_.load(hash, "data");
+    return cache_.read(archives_[entry->index], entry->offset, entry->size);
+  }
+
+  std::vector<File> ArchiveIndex::loadMany(std::vector<Hash_container> const& keys) {
+    std::vector<ArchiveCache::Range> ranges;
+    for (auto const& key : keys) {
+      IndexEntry const* entry = find_(key._);
+      if (entry) {
+        ranges.push_back(ArchiveCache::Range{archives_[entry->index], entry->offset, entry->size});
       }
     }
-
-    File data(archivePath);
-    if (!data) return File();
-    MemoryFile result;
-    uint8* output = result.alloc(size);
-    for (uint32 i = blockStart; i < blockEnd; ++i) {
-      if (map[i] == ArchiveInfo::INVALID) continue;
-      uint32 curstart = std::max<uint32>(offset, i * blockSize_);
-      uint32 curend = std::min<uint32>(offset + size, i * blockSize_ + blockSize_);
-      data.seek(map[i] + curstart - i * blockSize_, SEEK_SET);
-      data.read(output + curstart - offset, curend - curstart);
+    cache_.fetch(ranges);
+    std::vector<File> files(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+      files[i] = load(keys[i]._);
     }
-    result.seek(0);
-    return result;
+    return files;
   }
 
   CascStorage::CascStorage(std::string const& root)
     : root_(root)
   {
-    CreateDirectory((root / "config").c_str(), nullptr);
-    CreateDirectory((root / "data").c_str(), nullptr);
-    CreateDirectory((root / "indices").c_str(), nullptr);
-    CreateDirectory((root / "patch").c_str(), nullptr);
-
-    std::vector<std::string> names;
-    WIN32_FIND_DATA fdata;
-    HANDLE hFind = FindFirstFile((root / "data" / "*").c_str(), &fdata);
-    if (hFind == INVALID_HANDLE_VALUE) return;
-    do {
-      if (!(fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
-        names.push_back(fdata.cFileName);
-      }
-    } while (FindNextFile(hFind, &fdata));
-    FindClose(hFind);
+    create_dir((root / "config").c_str());
+    create_dir((root / "data").c_str());
+    create_dir((root / "indices").c_str());
+    create_dir((root / "patch").c_str());
 
-    for (std::string const& name : names) {
-      DeleteFile((root / "data" / name).c_str());
+    for (std::string const& name : list_files((root / "data").c_str())) {
+      delete_file((root / "data" / name).c_str());
     }
   }
 
@@ -582,7 +729,7 @@ namespace NGDP {
 
     IndexHeader header;
     header.keyIndex = indexCount_++;
-    header.maxOffset = _byteswap_uint64(MaxDataSize);
+    header.maxOffset = flipped<uint64>(MaxDataSize);
 
     File index = storage_.addData(fmtstring("%02x%08x.idx", indexCount_ - 1, 1));
     index.write32(sizeof(IndexHeader));
@@ -605,7 +752,7 @@ namespace NGDP {
     for (IndexEntry const& entry : index_) {
       WriteIndexEntry write;
       memcpy(write.hash, entry.hash, sizeof(write.hash));
-      *(uint32*) (write.pos + 1) = _byteswap_ulong(entry.offset);
+      *(uint32*) (write.pos + 1) = flipped(entry.offset);
       write.pos[0] = entry.index / 4;
       write.pos[1] |= ((entry.index & 3) << 6);
       write.size = entry.size;
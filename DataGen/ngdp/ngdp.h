@@ -2,6 +2,9 @@
 #include "utils/common.h"
 #include "utils/json.h"
 #include "utils/file.h"
+#include "archivecache.h"
+#include "cdnpool.h"
+#include "blte.h"
 #include <unordered_map>
 
 namespace NGDP {
@@ -19,7 +22,10 @@ namespace NGDP {
     Hash _;
     struct hash {
       size_t operator()(Hash_container const& hash) const {
-        return *reinterpret_cast<size_t const*>(hash._);
+        uint64 lo, hi;
+        memcpy(&lo, hash._, sizeof lo);
+        memcpy(&hi, hash._ + 8, sizeof hi);
+        return (size_t) (lo ^ (hi * 0x9E3779B97F4A7C15ULL));
       }
     };
     struct equal {
@@ -54,6 +60,12 @@ namespace NGDP {
       return version_;
     }
 
+    CdnPool& cdn() const {
+      return *cdn_;
+    }
+
+    // path of a file relative to the CDN root
+    std::string cdnpath(std::string const& hash, std::string const& type = "config", bool index = false) const;
     std::string geturl(std::string const& hash, std::string const& type = "config", bool index = false) const;
     File load(std::string const& hash, std::string const& type = "config", bool index = false, char const* preload = nullptr) const;
     File load(const Hash hash, std::string const& type = "config", bool index = false, char const* preload = nullptr) const {
@@ -61,17 +73,23 @@ namespace NGDP {
     }
 
   private:
-    std::string base_;
+    std::shared_ptr<CdnPool> cdn_;
     VersionData version_;
   };
 
-  File DecodeBLTE(File blte, uint32 usize = 0);
   std::map<std::string, std::string> ParseConfig(File file);
 
   class Encoding {
   public:
+    // Parses an encoding file. Pages are checked against their MD5 and parsed straight into
+    // one flat table as they are read.
     Encoding(File file);
 
+    // Writes the parsed table, which load can use without parsing it again
+    bool save(File file) const;
+    // Uses a table written by save (usually memory-mapped); null if it is not valid
+    static std::unique_ptr<Encoding> load(File file);
+
 #pragma pack(push, 1)
     struct EncodingEntry {
       uint16 keyCount;
@@ -98,21 +116,28 @@ namespace NGDP {
     }
 
   private:
-    std::vector<uint8> data_;
-    struct EncodingHeader {
-      Hash hash;
-      std::vector<EncodingEntry*> entries;
-    };
-    struct LayoutHeader {
-      Hash key;
-      std::vector<LayoutEntry*> entries;
-    };
-    std::vector<EncodingHeader> encodingTable_;
-    std::vector<LayoutHeader> layoutTable_;
-    std::vector<char*> layouts_;
-    char* layout_;
+    Encoding() {}
+
+    // The table is one block laid out as written by save: layout strings, offsets of the
+    // encoding entries sorted by hash, the packed encoding entries, the layout entries sorted
+    // by key and the file layout string, with all fields in native byte order.
+    File data_;
+    size_t dataSize_ = 0;
+    uint32 const* encodingOffsets_ = nullptr;
+    uint8 const* encodingEntries_ = nullptr;
+    size_t encodingCount_ = 0;
+    LayoutEntry const* layoutEntries_ = nullptr;
+    size_t layoutCount_ = 0;
+    std::vector<char const*> layouts_;
+    char const* layout_ = nullptr;
+
+    bool parse_(File data);
   };
 
+  // Encoding table for a build, using the copy preprocessed by an earlier run when there
+  // is one. ckey and ekey are the two hashes from the build config.
+  std::unique_ptr<Encoding> LoadEncoding(NGDP const& ngdp, std::string const& ckey, std::string const& ekey);
+
   class CascStorage {
   public:
     CascStorage(std::string const& root);
@@ -136,22 +161,57 @@ namespace NGDP {
     ArchiveIndex(NGDP const& ngdp, uint32 blockSize = (1U<<20));
 
     File load(Hash const& hash);
+    // Results are in the same order as keys; all missing data is fetched in one batch
+    std::vector<File> loadMany(std::vector<Hash_container> const& keys);
+
+    // Keys are truncated to KEY_SIZE bytes, like in local CASC indices
+    enum { KEY_SIZE = 9 };
+    struct Location {
+      uint16 archive;
+      uint32 offset;
+      uint32 size;
+    };
+    bool locate(Hash const& key, Location& location) const;
+
+    // checks the downloaded archive data, see ArchiveCache::verify
+    static size_t verify(bool repair = false);
+
+    size_t size() const {
+      return count_;
+    }
+    // bytes of the mapped table
+    size_t memory() const;
+    // archive names, by the index in Location
+    std::vector<std::string> const& archives() const {
+      return archives_;
+    }
+    // the .index file of an archive, as the table is built from
+    File loadIndex(size_t archive) const;
 
   private:
+#pragma pack(push, 1)
     struct IndexEntry {
+      uint8 key[KEY_SIZE];
       uint16 index;
-      uint32 size;
       uint32 offset;
+      uint32 size;
     };
-    struct ArchiveInfo {
-      std::string name;
-      std::vector<uint32> map;
-      static const uint32 INVALID = 0xFFFFFFFFUL;
-    };
+#pragma pack(pop)
+
     NGDP const& ngdp_;
-    uint32 blockSize_;
-    std::vector<ArchiveInfo> archives_;
-    std::unordered_map<Hash_container, IndexEntry, Hash_container::hash, Hash_container::equal> index_;
+    ArchiveCache cache_;
+    std::vector<std::string> archives_;
+    // entries of all archive indices sorted by key, mapped from a cache file that is rebuilt
+    // when the archive list changes (or held in memory, when just built)
+    File index_;
+    IndexEntry const* entries_ = nullptr;
+    size_t count_ = 0;
+
+    bool open_(File file, Hash const& listHash);
+    // Builds the table in memory from the archive indices and saves it to path, unless some
+    // of them could not be loaded; the table then has the entries of all others
+    File build_(std::string const& path, Hash const& listHash);
+    IndexEntry const* find_(Hash const& key) const;
   };
 
   class DataStorage {
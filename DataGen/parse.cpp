@@ -10,6 +10,7 @@
 #include "rmpq/common.h"
 #include "utils/path.h"
 #include "hash.h"
+#include "icontable.h"
 #include "search.h"
 
 #include "parse.h"
@@ -88,21 +89,22 @@ void parseMeta(json::Visitor& out, MetaData* meta, GameData::Type type, WEString
 }
 
 json::Value parseINI(File file) {
-  std::string line;
+  LineReader reader(file);
+  StringView line;
   json::Value out;
   json::Value* cur = nullptr;
-  while (file.getline(line)) {
+  while (reader.getline(line)) {
     line = trim(line);
     if (line.size() > 0 && line[0] == '[') {
       if (line[line.size() - 1] != ']') {
         return json::Value();
       } else {
-        cur = &out[line.substr(1, line.size() - 2)];
+        cur = &out[line.substr(1, line.size() - 2).str()];
       }
     } else if (cur && line.size() > 0 && line[0] != '/') {
       size_t pos = line.find('=');
-      if (pos != std::string::npos) {
-        (*cur)[line.substr(0, pos)] = line.substr(pos + 1);
+      if (pos != StringView::npos) {
+        (*cur)[line.substr(0, pos).str()] = line.substr(pos + 1).str();
       }
     }
   }
@@ -110,21 +112,22 @@ json::Value parseINI(File file) {
 }
 
 json::Value parseTypes(File file, WEStrings& wes) {
-  std::string line;
+  LineReader reader(file);
+  StringView line;
   json::Value out;
   json::Value* cur = nullptr;
   std::map<int, std::string> values;
-  while (file.getline(line)) {
+  while (reader.getline(line)) {
     line = trim(line);
     if (line.size() > 0 && line[0] == '[') {
       if (line[line.size() - 1] != ']') {
         return json::Value();
       } else {
         values.clear();
-        cur = &out[line.substr(1, line.size() - 2)];
+        cur = &out[line.substr(1, line.size() - 2).str()];
       }
     } else if (cur && line.size() > 0 && line[0] != '/') {
-      auto p = split(line, '=');
+      auto p = split(line.str(), '=');
       if (p.size() == 2 && (p[0].size() == 2 || p[0].size() == 6) && isdigit((unsigned char) p[0][0]) && isdigit((unsigned char) p[0][1])) {
         int key = atoi(p[0].c_str());
         if (p[0].size() == 6) {
@@ -291,13 +294,7 @@ MemoryFile MapParser::processObjects() {
   json::WriterVisitor out(outFile);
   //out.setIndent(2);
 
-  std::set<uint32> icons;
-  if (File iconFile = dataFiles->load("images.dat")) {
-    size_t count = (size_t)iconFile.size() / 4;
-    for (size_t i = 0; i < count; ++i) {
-      icons.insert(iconFile.read32());
-    }
-  }
+  IconTable icons(dataFiles->load("images.dat"));
 
   auto wed = parseINI(loader.load("UI\\WorldEditData.txt"));
 
@@ -310,7 +307,7 @@ MemoryFile MapParser::processObjects() {
     if (mapArchive && mapArchive->fileExists(name)) {
       return true;
     }
-    return icons.count(pathHash(name)) != 0;
+    return icons.find(pathHash(name));
   };
 
   for (int type = 0; type < GameData::NUM_TYPES; ++type) {
@@ -2,6 +2,7 @@
 #include "utils/checksum.h"
 #include "utils/common.h"
 #include "utils/path.h"
+#include "utils/parallel.h"
 #include <algorithm>
 
 namespace mpq {
@@ -117,11 +118,14 @@ void Archive::loadListFile() {
 
 void Archive::listFiles(File list) {
   if (!list) return;
-  std::string line;
-  while (list.getline(line)) {
+  LineReader reader(list);
+  StringView line;
+  std::string name;
+  while (reader.getline(line)) {
     line = trim(line);
-    if (line.length()) {
-      addName_(line.c_str());
+    if (line.size()) {
+      name.assign(line.data(), line.size());
+      addName_(name.c_str());
     }
   }
 }
@@ -185,6 +189,7 @@ bool Archive::fileExists(size_t pos) const {
 }
 
 bool Archive::testFile(size_t pos) {
+  std::lock_guard<std::mutex> lock(mutex_);
   if (!fileExists(pos)) {
     return false;
   }
@@ -237,6 +242,7 @@ bool Archive::testFile(size_t pos) {
 }
 
 File Archive::load(char const* name) {
+  std::lock_guard<std::mutex> lock(mutex_);
   auto pos = findFile(name);
   if (pos < 0) {
     return File();
@@ -245,6 +251,7 @@ File Archive::load(char const* name) {
 }
 
 File Archive::load(char const* name, uint16 locale) {
+  std::lock_guard<std::mutex> lock(mutex_);
   auto pos = findFile(name, locale);
   if (pos < 0) {
     return File();
@@ -253,12 +260,40 @@ File Archive::load(char const* name, uint16 locale) {
 }
 
 File Archive::load(size_t index) {
+  std::lock_guard<std::mutex> lock(mutex_);
   if (!fileExists(index)) {
     return File();
   }
   return load_(index, 0, false);
 }
 
+FileLoader* Archive::resolve(std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return findFile(path.c_str()) >= 0 ? this : nullptr;
+}
+
+std::vector<std::future<File>> Archive::loadMany(std::vector<std::string> const& paths) {
+  return splitBatch(run_async([this, paths]() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<File> files(paths.size());
+    std::vector<intptr_t> index(paths.size());
+    std::vector<std::pair<uint64, size_t>> order;
+    for (size_t i = 0; i < paths.size(); ++i) {
+      index[i] = findFile(paths[i].c_str());
+      if (index[i] >= 0) {
+        order.emplace_back(filePos_(index[i]), i);
+      }
+    }
+    // sorting by offset turns the batch into a single forward pass over the archive
+    std::sort(order.begin(), order.end());
+    for (auto const& item : order) {
+      size_t i = item.second;
+      files[i] = load_(index[i], hashString(path::name(paths[i]).c_str(), HASH_KEY), true);
+    }
+    return files;
+  }), paths.size());
+}
+
 intptr_t Archive::findNextFile(char const* name, intptr_t from) const {
   uint32 name1 = hashString(name, HASH_NAME1);
   uint32 name2 = hashString(name, HASH_NAME2);
@@ -287,12 +322,18 @@ char const* Archive::getFileName(size_t index) const {
   return nullptr;
 }
 
-File Archive::load_(size_t pos, uint32 key, bool keyValid) {
+uint64 Archive::filePos_(size_t pos) const {
   uint32 block = hashTable_[pos].blockIndex;
   uint64 filePos = blockTable_[block].filePos;
   if (hiBlockTable_.size()) {
     filePos |= uint64(hiBlockTable_[block]) << 32;
   }
+  return filePos;
+}
+
+File Archive::load_(size_t pos, uint32 key, bool keyValid) {
+  uint32 block = hashTable_[pos].blockIndex;
+  uint64 filePos = filePos_(pos);
   size_t fileSize = blockTable_[block].fSize;
   size_t cmpSize = blockTable_[block].cSize;
   uint32 flags = blockTable_[block].flags;
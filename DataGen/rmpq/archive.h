@@ -4,6 +4,7 @@
 #include "rmpq/locale.h"
 #include "rmpq/common.h"
 
+#include <mutex>
 #include <unordered_map>
 
 namespace mpq {
@@ -43,6 +44,9 @@ public:
   }
 
   virtual File load(char const* name) override;
+  // Reads the batch in archive order on a background thread
+  virtual std::vector<std::future<File>> loadMany(std::vector<std::string> const& paths) override;
+  virtual FileLoader* resolve(std::string& path) override;
   File load(char const* name, uint16 locale);
   File load(size_t index);
 
@@ -70,9 +74,11 @@ private:
   mutable std::vector<std::string> names_;
   mutable size_t unknowns_;
   std::vector<uint8> buffer_;
+  std::mutex mutex_;
 
   void addName_(char const* name);
 
+  uint64 filePos_(size_t index) const;
   File load_(size_t index, uint32 key, bool keyValid);
 };
 
@@ -110,59 +110,44 @@ void FileSearch::analyze_(size_t index) {
   }
 }
 
-namespace
-{
-  std::string& readString(File file, std::string& str) {
-    str.clear();
-    while (int c = file.getc()) {
-      if (c == EOF) {
-        break;
-      }
-      str.push_back(c);
-    }
-    return str;
-  }
-
-}
-
 void FileSearch::analyzeObj_(char const* name, bool ext) {
   auto pos = mpq_.findFile(name);
   if (pos < 0) return;
   states_[pos] = 1;
-  File file = mpq_.load(pos);
-  if (!file) return;
+  ByteReader reader(mpq_.load(pos));
+  if (reader.eof()) return;
 
-  if (file.read32() > 3) {
+  if (reader.read32() > 3) {
     return;
   }
-  size_t end = file.size();
   std::string str;
-  for (int tbl = 0; tbl < 2 && end - file.tell() >= 4; tbl++) {
-    uint32 count = file.read32();
+  for (int tbl = 0; tbl < 2 && reader.left() >= 4; tbl++) {
+    uint32 count = reader.read32();
     if (count > 5000) {
       return;
     }
-    for (uint32 i = 0; i < count && end - file.tell() >= 12; i++) {
-      file.seek(8, SEEK_CUR);
-      uint32 count = file.read32();
+    for (uint32 i = 0; i < count && reader.left() >= 12; i++) {
+      reader.skip(8);
+      uint32 count = reader.read32();
       if (count > 500) {
         return;
       }
-      for (uint32 j = 0; j < count && end - file.tell() >= 8; j++) {
-        uint32 modid = file.read32(true);
-        uint32 type = file.read32();
+      for (uint32 j = 0; j < count && reader.left() >= 8; j++) {
+        uint32 modid = reader.read32(true);
+        uint32 type = reader.read32();
         if (type > 3) {
           return;
         }
         if (ext) {
-          file.seek(8, SEEK_CUR);
+          reader.skip(8);
         }
         if (type == 3) {
-          addStringEx_(readString(file, str));
+          str = reader.readString().str();
+          addStringEx_(str);
         } else {
-          file.seek(4, SEEK_CUR);
+          reader.skip(4);
         }
-        file.seek(4, SEEK_CUR);
+        reader.skip(4);
       }
     }
   }
@@ -172,22 +157,21 @@ void FileSearch::analyzeW3i_(char const* name) {
   auto pos = mpq_.findFile(name);
   if (pos < 0) return;
   states_[pos] = 1;
-  File file = mpq_.load(pos);
-  if (!file) return;
+  ByteReader reader(mpq_.load(pos));
+  if (reader.eof()) return;
 
-  if (file.read32() > 25) {
+  if (reader.read32() > 25) {
     return;
   }
-  file.seek(8, SEEK_CUR);
-  std::string str;
-  readString(file, str);
-  readString(file, str);
-  readString(file, str);
-  readString(file, str);
-  file.seek(61, SEEK_CUR);
-  int lscr = file.read32();
+  reader.skip(8);
+  for (int i = 0; i < 4; ++i) {
+    reader.readString();
+  }
+  reader.skip(61);
+  int lscr = reader.read32();
   if (lscr < 0) {
-    addStringEx_(readString(file, str));
+    std::string str = reader.readString().str();
+    addStringEx_(str);
   }
 }
 
@@ -0,0 +1,495 @@
+// winsock2.h has to come before anything that includes windows.h
+#ifdef _WIN32
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
+
+#include "tests.h"
+#include "ngdp/archivecache.h"
+#include "ngdp/cdnpool.h"
+#include "utils/http.h"
+#include "utils/path.h"
+#include "utils/logger.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <random>
+
+#define CHECK(cond) ((cond) ? (void) 0 : (Logger::log("%s:%d: check failed: %s", __FILE__, __LINE__, #cond), ++failed, (void) 0))
+
+namespace {
+
+#ifdef _WIN32
+  typedef SOCKET Socket;
+  const int SHUTDOWN_BOTH = SD_BOTH;
+#else
+  typedef int Socket;
+  const Socket INVALID_SOCKET = -1;
+  const int SHUTDOWN_BOTH = SHUT_RDWR;
+  void closesocket(Socket socket) {
+    close(socket);
+  }
+#endif
+
+  bool send_all(Socket socket, char const* data, size_t size) {
+#ifdef MSG_NOSIGNAL
+    int flags = MSG_NOSIGNAL;
+#else
+    int flags = 0;
+#endif
+    while (size) {
+      int sent = send(socket, data, (int) std::min<size_t>(size, 1 << 20), flags);
+      if (sent <= 0) return false;
+      data += sent;
+      size -= sent;
+    }
+    return true;
+  }
+
+  // HTTP/1.1 server on a loopback port that serves the files under a directory, with
+  // keep-alive and single byte ranges. It counts connections and requests, so that tests
+  // can check how many round trips the client made and whether connections were reused.
+  class TestServer {
+  public:
+    explicit TestServer(std::string const& root, bool ranges = true)
+      : root_(root)
+      , ranges_(ranges)
+    {
+#ifdef _WIN32
+      WSADATA data;
+      WSAStartup(MAKEWORD(2, 2), &data);
+#endif
+      listen_ = socket(AF_INET, SOCK_STREAM, 0);
+      sockaddr_in addr;
+      memset(&addr, 0, sizeof addr);
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      addr.sin_port = 0;
+      socklen_t length = sizeof addr;
+      if (listen_ == INVALID_SOCKET || bind(listen_, (sockaddr*) &addr, sizeof addr) || listen(listen_, 16) ||
+          getsockname(listen_, (sockaddr*) &addr, &length)) {
+        return;
+      }
+      port_ = ntohs(addr.sin_port);
+      thread_ = std::thread([this]() { accept_(); });
+    }
+    ~TestServer() {
+      if (thread_.joinable()) {
+        // wake up accept with a connection of our own
+        stopping_ = true;
+        Socket wake = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof addr);
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port_);
+        connect(wake, (sockaddr*) &addr, sizeof addr);
+        thread_.join();
+        closesocket(wake);
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (Socket client : clients_) {
+          shutdown(client, SHUTDOWN_BOTH);
+        }
+      }
+      for (auto& thread : threads_) {
+        thread.join();
+      }
+      if (listen_ != INVALID_SOCKET) {
+        closesocket(listen_);
+      }
+    }
+
+    explicit operator bool() const {
+      return port_ != 0;
+    }
+    // host name for CdnPool
+    std::string host() const {
+      return fmtstring("127.0.0.1:%u", (uint32) port_);
+    }
+    std::string url(std::string const& path) const {
+      return "http://" + host() + "/" + path;
+    }
+    uint32 connections() const {
+      return connections_;
+    }
+    uint32 requests() const {
+      return requests_;
+    }
+    // answers the next count requests for path with status and a body of size bytes
+    void fail(std::string const& path, uint32 status, uint32 size, uint32 count = 1) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      failures_[path] = Failure{status, size, count};
+    }
+
+  private:
+    std::string root_;
+    bool ranges_;
+    Socket listen_ = INVALID_SOCKET;
+    uint16 port_ = 0;
+    std::thread thread_;
+    std::vector<std::thread> threads_;
+    std::vector<Socket> clients_;
+    std::mutex mutex_;
+    std::atomic<bool> stopping_{false};
+    std::atomic<uint32> connections_{0};
+    std::atomic<uint32> requests_{0};
+    struct Failure {
+      uint32 status;
+      uint32 size;
+      uint32 count;
+    };
+    std::map<std::string, Failure> failures_;
+
+    void accept_() {
+      while (true) {
+        Socket client = accept(listen_, nullptr, nullptr);
+        if (client == INVALID_SOCKET) {
+          if (stopping_) return;
+          continue;
+        }
+        if (stopping_) {
+          closesocket(client);
+          return;
+        }
+        connections_++;
+        std::lock_guard<std::mutex> lock(mutex_);
+        clients_.push_back(client);
+        threads_.emplace_back([this, client]() { serve_(client); });
+      }
+    }
+
+    void serve_(Socket client) {
+      std::string input;
+      char buffer[4096];
+      while (true) {
+        size_t end;
+        int count = 1;
+        while ((end = input.find("\r\n\r\n")) == std::string::npos &&
+               (count = recv(client, buffer, sizeof buffer, 0)) > 0) {
+          input.append(buffer, count);
+        }
+        if (count <= 0) break;
+        std::string request = input.substr(0, end);
+        input.erase(0, end + 4);
+        requests_++;
+        if (!respond_(client, request)) break;
+      }
+      // closed under the lock, so the destructor never shuts down a reused descriptor
+      std::lock_guard<std::mutex> lock(mutex_);
+      clients_.erase(std::find(clients_.begin(), clients_.end(), client));
+      closesocket(client);
+    }
+
+    bool respond_(Socket client, std::string const& request) {
+      std::string path;
+      uint64 first = 0, last = max_uint64;
+      bool range = false;
+      size_t pos = 0;
+      for (size_t next; (next = request.find("\r\n", pos)) != std::string::npos || pos < request.size(); pos = next + 2) {
+        if (next == std::string::npos) next = request.size();
+        std::string line = request.substr(pos, next - pos);
+        if (!pos) {
+          size_t start = line.find(' ');
+          size_t stop = line.find(' ', start + 1);
+          if (start == std::string::npos || stop == std::string::npos) return false;
+          path = line.substr(start + 2, stop - start - 2);
+        } else if (istring(line.substr(0, 6)) == istring("Range:")) {
+          unsigned long long a, b;
+          if (sscanf(line.c_str() + 6, " bytes=%llu-%llu", &a, &b) == 2 && a <= b) {
+            range = ranges_;
+            first = a;
+            last = b;
+          }
+        }
+      }
+
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto it = failures_.find(path);
+        if (it != failures_.end() && it->second.count) {
+          it->second.count--;
+          Failure failure = it->second;
+          lock.unlock();
+          std::string header = fmtstring("HTTP/1.1 %u Failed\r\nContent-Length: %u\r\n\r\n", failure.status, failure.size);
+          std::string body(failure.size, 'x');
+          return send_all(client, header.data(), header.size()) && send_all(client, body.data(), body.size());
+        }
+      }
+
+      File file;
+      if (path.find("..") == std::string::npos) {
+        file = File(root_ / path, "rb");
+      }
+      if (!file) {
+        std::string header = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+        return send_all(client, header.data(), header.size());
+      }
+      uint64 size = file.size();
+      std::string header;
+      if (range && first < size) {
+        last = std::min(last, size - 1);
+        header = fmtstring("HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %llu-%llu/%llu\r\n",
+          (unsigned long long) first, (unsigned long long) last, (unsigned long long) size);
+      } else {
+        first = 0;
+        last = size - 1;
+        header = "HTTP/1.1 200 OK\r\n";
+      }
+      std::vector<char> body(size_t(last + 1 - first));
+      file.seek(first);
+      file.read(body.data(), body.size());
+      header += fmtstring("Content-Length: %u\r\n\r\n", (uint32) body.size());
+      return send_all(client, header.data(), header.size()) && send_all(client, body.data(), body.size());
+    }
+  };
+
+  // CDN archives with random contents under root/test/data, as CdnPool(hosts, "test")
+  // expects them; returns the contents by name
+  std::map<std::string, std::vector<uint8>> make_archives(std::string const& root, size_t count, uint32 size) {
+    std::mt19937 random(count * 7919 + size);
+    std::map<std::string, std::vector<uint8>> archives;
+    for (size_t i = 0; i < count; ++i) {
+      std::string name = fmtstring("archive%u", (uint32) i);
+      auto& data = archives[name];
+      data.resize(size + i * 1234);
+      for (auto& byte : data) {
+        byte = (uint8) random();
+      }
+      File(root / "test" / "data" / name, "wb").write(data.data(), data.size());
+    }
+    return archives;
+  }
+
+  // empty directory for a test, created if needed
+  std::string test_dir(std::string const& name) {
+    std::string dir = path::root() / "testdata";
+    create_dir(dir.c_str());
+    dir = dir / name;
+    create_dir(dir.c_str());
+    for (auto const& file : list_files(dir.c_str())) {
+      delete_file((dir / file).c_str());
+    }
+    return dir;
+  }
+
+  // random contents, repeatable for a given seed
+  std::vector<uint8> make_data(uint32 seed, size_t size) {
+    std::mt19937 random(seed);
+    std::vector<uint8> data(size);
+    for (auto& byte : data) {
+      byte = (uint8) random();
+    }
+    return data;
+  }
+
+  // whole body of a response, read through the File interface since HTTP responses
+  // are not always in memory
+  std::vector<uint8> read_all(File file) {
+    std::vector<uint8> data;
+    if (!file) return data;
+    file.seek(0);
+    data.resize((size_t) file.size());
+    data.resize(file.read(data.data(), data.size()));
+    return data;
+  }
+
+}
+
+size_t test_http() {
+  size_t failed = 0;
+  std::string root = test_dir("http");
+  auto data = make_data(1, 300000);
+  File(root / "file.bin", "wb").write(data.data(), data.size());
+  TestServer server(root);
+  CHECK(server);
+  if (!server) return failed;
+  std::string url = server.url("file.bin");
+
+  // consecutive requests share one kept-alive connection
+  for (int i = 0; i < 5; ++i) {
+    CHECK(read_all(HttpRequest::get(url)) == data);
+  }
+  CHECK(server.requests() == 5);
+  CHECK(server.connections() == 1);
+
+  {
+    HttpRequest request(url);
+    request.addHeader("Range", "bytes=1000-1999");
+    CHECK(request.send() && request.status() == 206);
+    CHECK(read_all(request.response()) == std::vector<uint8>(data.begin() + 1000, data.begin() + 2000));
+  }
+  {
+    File output(root / "output.bin", "wb+");
+    HttpRequest request(url);
+    request.setOutput(output);
+    CHECK(request.send() && request.status() == 200);
+    CHECK(read_all(request.response()) == data);
+  }
+  {
+    // a response written after existing data starts where the output was
+    File output(root / "append.bin", "wb+");
+    output.write32(0x12345678);
+    HttpRequest request(url);
+    request.setOutput(output);
+    CHECK(request.send() && request.status() == 200);
+    File response = request.response();
+    std::vector<uint8> body((size_t) response.size() - 4);
+    CHECK(response.tell() == 4 && response.read(body.data(), body.size()) == data.size() && body == data);
+  }
+  {
+    HttpRequest request(server.url("missing.bin"));
+    CHECK(request.send() && request.status() == 404);
+    CHECK(!HttpRequest::get(server.url("missing.bin")));
+  }
+  CHECK(server.connections() == 1);
+
+  // parallel requests each get a connection, and leave them open for later ones
+  const int THREADS = 4;
+  std::atomic<uint32> good{0};
+  std::vector<std::thread> threads;
+  for (int i = 0; i < THREADS; ++i) {
+    threads.emplace_back([&]() {
+      for (int j = 0; j < 3; ++j) {
+        if (read_all(HttpRequest::get(url)) == data) good++;
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  CHECK(good == THREADS * 3);
+  uint32 connections = server.connections();
+  CHECK(connections <= 1 + THREADS);
+  for (int i = 0; i < 5; ++i) {
+    CHECK(read_all(HttpRequest::get(url)) == data);
+  }
+  CHECK(server.connections() == connections);
+  return failed;
+}
+
+size_t test_archive_cache() {
+  size_t failed = 0;
+  std::string cdnRoot = path::root() / "testdata" / "cdn";
+  auto archives = make_archives(cdnRoot, 2, 200000);
+  std::mt19937 random(1);
+
+  // with and without a server that honors Range
+  for (int ranges = 1; ranges >= 0; --ranges) {
+    TestServer server(cdnRoot, ranges != 0);
+    CHECK(server);
+    if (!server) break;
+    NGDP::CdnPool cdn(std::vector<std::string>{server.host()}, "test");
+    std::string root = test_dir(fmtstring("cache%d", ranges));
+    auto archivePath = [](std::string const& name) {
+      return "data/" + name;
+    };
+
+    std::vector<NGDP::ArchiveCache::Range> requests;
+    for (int i = 0; i < 30; ++i) {
+      auto const& archive = *std::next(archives.begin(), random() % archives.size());
+      uint32 size = 1 + random() % 10000;
+      uint32 offset = random() % (archive.second.size() - size);
+      requests.push_back(NGDP::ArchiveCache::Range{archive.first, offset, size});
+    }
+    auto matches = [&](NGDP::ArchiveCache& cache) {
+      for (auto const& range : requests) {
+        File file = cache.read(range.archive, range.offset, range.size);
+        auto const& data = archives[range.archive];
+        if (!file || file.size() != range.size || memcmp(file.data(), data.data() + range.offset, range.size)) {
+          return false;
+        }
+      }
+      return true;
+    };
+
+    {
+      NGDP::ArchiveCache cache(root, cdn, archivePath, 4096, 4);
+      CHECK(cache.fetch(requests));
+      // adjacent and overlapping blocks are merged into fewer requests than ranges
+      uint32 cold = server.requests();
+      CHECK(cold > 0 && cold < requests.size());
+      CHECK(matches(cache));
+      CHECK(server.requests() == cold);
+    }
+    {
+      // a later run finds everything on disk
+      uint32 before = server.requests();
+      NGDP::ArchiveCache cache(root, cdn, archivePath, 4096, 4);
+      CHECK(cache.fetch(requests));
+      CHECK(matches(cache));
+      CHECK(server.requests() == before);
+    }
+    {
+      // read downloads the blocks it is missing by itself, and later reads of them stay local
+      NGDP::ArchiveCache cache(test_dir(fmtstring("cacheread%d", ranges)), cdn, archivePath, 4096, 4);
+      uint32 before = server.requests();
+      CHECK(matches(cache));
+      uint32 cold = server.requests();
+      CHECK(cold > before);
+      CHECK(matches(cache));
+      CHECK(server.requests() == cold);
+    }
+    {
+      // a missing archive fails without storing anything
+      NGDP::ArchiveCache cache(root, cdn, archivePath, 4096, 4);
+      CHECK(!cache.fetch(std::vector<NGDP::ArchiveCache::Range>{NGDP::ArchiveCache::Range{"missing", 0, 100}}));
+      CHECK(!cache.read("missing", 0, 100));
+    }
+  }
+  return failed;
+}
+
+size_t test_cdn_pool() {
+  size_t failed = 0;
+  std::string cdnRoot = path::root() / "testdata" / "cdn";
+  auto data = make_archives(cdnRoot, 1, 50000)["archive0"];
+  // the first host is tried first, and fails with an error page longer than the file
+  TestServer bad(cdnRoot), good(cdnRoot);
+  CHECK(bad && good);
+  if (!bad || !good) return failed;
+  bad.fail("test/data/archive0", 503, 100000);
+  NGDP::CdnPool cdn(std::vector<std::string>{bad.host(), good.host()}, "test");
+  std::string root = test_dir("cdnpool");
+
+  {
+    File output(root / "archive0", "wb+");
+    NGDP::CdnPool::Response response;
+    CHECK(cdn.get("data/archive0", response, "", output));
+    CHECK(response.status == 200);
+    CHECK(output.size() == data.size());
+    CHECK(read_all(output) == data);
+  }
+  auto stats = cdn.stats();
+  CHECK(stats[0].requests == 1 && stats[0].failures == 1);
+  CHECK(stats[1].requests == 1 && stats[1].failures == 0 && stats[1].bytes == data.size());
+
+  {
+    // the failed host is backing off, so later requests go to the other one, over the
+    // connection that is still open
+    MemoryFile output;
+    NGDP::CdnPool::Response response;
+    CHECK(cdn.get("data/archive0", response, "100-199", output));
+    CHECK(response.status == 206);
+    CHECK(read_all(output) == std::vector<uint8>(data.begin() + 100, data.begin() + 200));
+  }
+  CHECK(bad.requests() == 1);
+  CHECK(good.requests() == 2 && good.connections() == 1);
+
+  {
+    // a missing file is not retried on other hosts
+    NGDP::CdnPool::Response response;
+    CHECK(!cdn.get("data/missing", response));
+    CHECK(response.status == 404);
+  }
+  CHECK(bad.requests() == 1);
+  return failed;
+}
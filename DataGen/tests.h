@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+
+// Self-checks run from main() when RUN_TESTS is set. The network code is tested against an
+// HTTP server on a loopback port, serving fixture files generated under testdata/, so no
+// access to the real CDN is needed. Each test returns the number of failed checks, which are
+// also written to the log.
+
+size_t test_http();
+size_t test_cdn_pool();
+size_t test_archive_cache();
@@ -11,6 +11,9 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <errno.h>
 #endif
 #endif
 
@@ -309,6 +312,13 @@ std::string trim(std::string const& str) {
   while (right > left && isspace((unsigned char)str[right - 1])) --right;
   return str.substr(left, right - left);
 }
+StringView trim(StringView str) {
+  char const* left = str.begin();
+  char const* right = str.end();
+  while (left < right && isspace((unsigned char) *left)) ++left;
+  while (right > left && isspace((unsigned char) right[-1])) --right;
+  return StringView(left, right - left);
+}
 
 #ifndef NO_SYSTEM
 size_t file_size(char const* path) {
@@ -334,6 +344,44 @@ void create_dir(char const* path) {
 #endif
 }
 
+FileLock::FileLock(char const* path) {
+#ifdef _MSC_VER
+  handle_ = CreateFile(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+    NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (handle_ != INVALID_HANDLE_VALUE) {
+    OVERLAPPED overlapped;
+    memset(&overlapped, 0, sizeof overlapped);
+    locked_ = (LockFileEx(handle_, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &overlapped) != 0);
+  }
+#else
+  fd_ = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd_ >= 0) {
+    int result;
+    while ((result = flock(fd_, LOCK_EX)) && errno == EINTR) {
+    }
+    locked_ = !result;
+  }
+#endif
+}
+
+FileLock::~FileLock() {
+#ifdef _MSC_VER
+  if (handle_ != INVALID_HANDLE_VALUE) {
+    if (locked_) {
+      OVERLAPPED overlapped;
+      memset(&overlapped, 0, sizeof overlapped);
+      UnlockFileEx(handle_, 0, MAXDWORD, MAXDWORD, &overlapped);
+    }
+    CloseHandle(handle_);
+  }
+#else
+  if (fd_ >= 0) {
+    // closing the descriptor releases the lock
+    close(fd_);
+  }
+#endif
+}
+
 #ifndef _MSC_VER
 #include <time.h>
 static uint64 msec_since_epoch() {
@@ -355,4 +403,30 @@ void rename_file(char const* src, char const* dst) {
 #endif
 }
 
+std::vector<std::string> list_files(char const* path) {
+  std::vector<std::string> names;
+#ifdef _MSC_VER
+  WIN32_FIND_DATA fdata;
+  HANDLE hFind = FindFirstFile((std::string(path) + "\\*").c_str(), &fdata);
+  if (hFind == INVALID_HANDLE_VALUE) return names;
+  do {
+    if (!(fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+      names.push_back(fdata.cFileName);
+    }
+  } while (FindNextFile(hFind, &fdata));
+  FindClose(hFind);
+#else
+  DIR* dir = opendir(path);
+  if (!dir) return names;
+  while (struct dirent* entry = readdir(dir)) {
+    struct stat st;
+    if (!stat((std::string(path) + "/" + entry->d_name).c_str(), &st) && S_ISREG(st.st_mode)) {
+      names.push_back(entry->d_name);
+    }
+  }
+  closedir(dir);
+#endif
+  return names;
+}
+
 #endif
@@ -128,6 +128,76 @@ std::wstring utf8_to_utf16(std::string const& str);
 std::string utf16_to_utf8(std::wstring const& str);
 std::string trim(std::string const& str);
 
+// Non-owning reference to a range of characters (the web build is limited to C++11)
+class StringView {
+public:
+  static const size_t npos = static_cast<size_t>(-1);
+
+  StringView()
+    : data_(nullptr)
+    , size_(0)
+  {}
+  StringView(char const* data, size_t size)
+    : data_(data)
+    , size_(size)
+  {}
+  StringView(std::string const& str)
+    : data_(str.data())
+    , size_(str.size())
+  {}
+
+  char const* data() const {
+    return data_;
+  }
+  size_t size() const {
+    return size_;
+  }
+  bool empty() const {
+    return size_ == 0;
+  }
+  char operator[](size_t i) const {
+    return data_[i];
+  }
+  char const* begin() const {
+    return data_;
+  }
+  char const* end() const {
+    return data_ + size_;
+  }
+
+  size_t find(char chr, size_t pos = 0) const {
+    if (pos >= size_) return npos;
+    void const* ptr = memchr(data_ + pos, chr, size_ - pos);
+    return ptr ? static_cast<char const*>(ptr) - data_ : npos;
+  }
+  StringView substr(size_t pos, size_t count = npos) const {
+    if (pos > size_) pos = size_;
+    if (count > size_ - pos) count = size_ - pos;
+    return StringView(data_ + pos, count);
+  }
+  std::string str() const {
+    return std::string(data_, size_);
+  }
+
+  bool operator==(StringView const& rhs) const {
+    return size_ == rhs.size_ && !memcmp(data_, rhs.data_, size_);
+  }
+  bool operator!=(StringView const& rhs) const {
+    return !(*this == rhs);
+  }
+  bool operator==(char const* rhs) const {
+    return strlen(rhs) == size_ && !memcmp(data_, rhs, size_);
+  }
+  bool operator!=(char const* rhs) const {
+    return !(*this == rhs);
+  }
+
+private:
+  char const* data_;
+  size_t size_;
+};
+StringView trim(StringView str);
+
 template<int TS>
 struct FlipTraits {};
 
@@ -182,6 +252,31 @@ size_t file_size(char const* path);
 void delete_file(char const* path);
 void create_dir(char const* path);
 void rename_file(char const* src, char const* dst);
+// names of the regular files in a directory
+std::vector<std::string> list_files(char const* path);
+
+// Exclusive lock on a file, shared with other processes; blocks until the lock is acquired
+// and holds it until destruction. The file is created if needed.
+class FileLock {
+public:
+  FileLock(char const* path);
+  ~FileLock();
+
+  FileLock(FileLock const&) = delete;
+  FileLock& operator=(FileLock const&) = delete;
+
+  operator bool() const {
+    return locked_;
+  }
+
+private:
+#ifdef _MSC_VER
+  void* handle_;
+#else
+  int fd_;
+#endif
+  bool locked_ = false;
+};
 
 #ifndef _MSC_VER
 uint32 GetTickCount();
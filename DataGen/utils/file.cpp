@@ -1,10 +1,17 @@
 #include "file.h"
 #include "path.h"
+#include "parallel.h"
 #include <set>
 #include <algorithm>
 #include <stdarg.h>
 
 #ifndef NO_SYSTEM
+#ifdef _MSC_VER
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
 class StdFileBuffer : public FileBuffer {
   FILE* file_;
 public:
@@ -35,6 +42,24 @@ public:
   size_t write(void const* ptr, size_t size) {
     return fwrite(ptr, 1, size, file_);
   }
+
+  bool flush() {
+    if (fflush(file_)) return false;
+#ifdef _MSC_VER
+    return !_commit(_fileno(file_));
+#else
+    return !fsync(fileno(file_));
+#endif
+  }
+
+  bool truncate(uint64 size) {
+    if (fflush(file_)) return false;
+#ifdef _MSC_VER
+    return !_chsize_s(_fileno(file_), size);
+#else
+    return !ftruncate(fileno(file_), size);
+#endif
+  }
 };
 
 File::File(char const* name, char const* mode) {
@@ -79,6 +104,26 @@ void File::printf(char const* fmt, ...) {
   }
 }
 bool File::getline(std::string& out) {
+  if (uint8 const* data = file_->data()) {
+    char const* begin = reinterpret_cast<char const*>(data);
+    char const* end = begin + file_->size();
+    char const* ptr = begin + file_->tell();
+    char const* eol = ptr;
+    while (eol < end && *eol != '\n' && *eol != '\r') {
+      ++eol;
+    }
+    out.assign(ptr, eol);
+    if (eol == end) {
+      file_->seek(end - begin, SEEK_SET);
+      return !out.empty();
+    }
+    if (*eol++ == '\r' && eol < end && *eol == '\n') {
+      ++eol;
+    }
+    file_->seek(eol - begin, SEEK_SET);
+    return true;
+  }
+
   out.clear();
   int chr;
   while ((chr = file_->getc()) != EOF) {
@@ -157,6 +202,76 @@ File::LineIterator<std::wstring> File::wend() {
   return LineIterator<std::wstring>();
 }
 
+LineReader::LineReader(File file)
+  : file_(file)
+  , data_(reinterpret_cast<char const*>(file.data()))
+  , pos_(0)
+  , size_(0)
+  , newline_(StringView::npos)
+  , eof_(true)
+{
+  if (data_) {
+    pos_ = file.tell();
+    size_ = file.size();
+  } else if (file) {
+    buffer_.resize(1 << 16);
+    data_ = buffer_.data();
+    eof_ = false;
+  }
+}
+
+void LineReader::fill_() {
+  if (pos_) {
+    memmove(buffer_.data(), buffer_.data() + pos_, size_ - pos_);
+    size_ -= pos_;
+    pos_ = 0;
+  } else if (size_ == buffer_.size()) {
+    buffer_.resize(buffer_.size() * 2);
+  }
+  data_ = buffer_.data();
+  newline_ = StringView::npos;
+  size_t count = file_.read(buffer_.data() + size_, buffer_.size() - size_);
+  size_ += count;
+  eof_ = (count == 0);
+}
+
+bool LineReader::getline(StringView& line) {
+  if (!data_) {
+    return false;
+  }
+  while (true) {
+    // the position of the next \n is kept so that files with \r line endings don't rescan to the end
+    if (newline_ == StringView::npos || newline_ < pos_) {
+      void const* nl = memchr(data_ + pos_, '\n', size_ - pos_);
+      newline_ = (nl ? static_cast<char const*>(nl) - data_ : size_);
+    }
+    void const* cr = memchr(data_ + pos_, '\r', newline_ - pos_);
+    size_t eol = (cr ? static_cast<char const*>(cr) - data_ : newline_);
+    if (eol < size_) {
+      if (data_[eol] == '\r' && eol + 1 == size_ && !eof_) {
+        fill_();
+        continue;
+      }
+      line = StringView(data_ + pos_, eol - pos_);
+      pos_ = eol + 1;
+      if (data_[eol] == '\r' && pos_ < size_ && data_[pos_] == '\n') {
+        ++pos_;
+      }
+      return true;
+    }
+    if (!eof_) {
+      fill_();
+      continue;
+    }
+    if (pos_ >= size_) {
+      return false;
+    }
+    line = StringView(data_ + pos_, size_ - pos_);
+    pos_ = size_;
+    return true;
+  }
+}
+
 class SubFileBuffer : public FileBuffer {
   File file_;
   uint64 start_;
@@ -216,6 +331,11 @@ public:
   size_t write(void const* ptr, size_t size) {
     return 0;
   }
+
+  uint8 const* data() const {
+    uint8 const* data = file_.data();
+    return data ? data + start_ : nullptr;
+  }
 };
 
 File File::subfile(uint64 offset, uint64 size) {
@@ -291,6 +411,14 @@ public:
     data_.resize(size);
   }
 
+  bool truncate(uint64 size) {
+    if (size < data_.size()) {
+      data_.resize((size_t) size);
+      pos_ = std::min(pos_, data_.size());
+    }
+    return true;
+  }
+
   uint8* alloc(size_t size) {
     if (size + pos_ > data_.size()) {
       data_.resize(size + pos_);
@@ -387,12 +515,21 @@ MemoryFile MemoryFile::from(File file) {
   return mem;
 }
 
-uint8 const* MemoryFile::data() const {
-  MemoryBuffer* buffer = dynamic_cast<MemoryBuffer*>(file_.get());
-  if (buffer) return buffer->data();
-  RawMemoryBuffer* rawBuffer = dynamic_cast<RawMemoryBuffer*>(file_.get());
-  return (rawBuffer ? rawBuffer->data() : nullptr);
+ByteReader::ByteReader(File file)
+  : file_(file)
+  , data_(file.data())
+  , pos_(0)
+  , size_(0)
+{
+  if (!file) return;
+  if (!data_) {
+    file_ = MemoryFile::from(file);
+    data_ = file_.data();
+  }
+  size_ = (size_t) file_.size();
+  pos_ = (size_t) file_.tell();
 }
+
 uint8* MemoryFile::alloc(size_t size) {
   MemoryBuffer* buffer = dynamic_cast<MemoryBuffer*>(file_.get());
   return (buffer ? buffer->alloc(size) : nullptr);
@@ -471,25 +608,25 @@ struct ArchiveEntry {
 Archive::Archive(File file) {
   if (!file) return;
   file.seek(0);
-  if (file.read32() != ARCHIVE_SIGNATURE) return;
-  uint32 count = file.read32();
+  ByteReader reader(file);
+  if (reader.read32() != ARCHIVE_SIGNATURE) return;
+  uint32 count = reader.read32();
   for (uint32 i = 0; i < count; ++i) {
-    file.seek(i * sizeof(ArchiveEntry) + 8);
-    auto entry = file.read<ArchiveEntry>();
-    file.seek(entry.offset);
+    reader.seek(i * sizeof(ArchiveEntry) + 8);
+    auto entry = reader.read<ArchiveEntry>();
+    reader.seek(entry.offset);
+    if (reader.left() < std::min(entry.size, entry.usize)) {
+      files_.erase(entry.id);
+      continue;
+    }
     auto& f = files_[entry.id];
     if (entry.size < entry.usize) {
       f.memFile = File();
       f.compression = entry.usize;
-      f.compressed.resize(entry.size);
-      if (file.read(f.compressed.data(), entry.size) != entry.size) {
-        files_.erase(entry.id);
-      }
+      f.compressed.assign(reader.ptr(), reader.ptr() + entry.size);
     } else {
       f.compression = 0;
-      if (file.read(f.memFile.alloc(entry.usize), entry.usize) != entry.usize) {
-        files_.erase(entry.id);
-      }
+      reader.read(f.memFile.alloc(entry.usize), entry.usize);
     }
   }
 }
@@ -542,12 +679,11 @@ void Archive::write(File file) {
 }
 
 void File::copy(File src, uint64 size) {
-  auto mem = dynamic_cast<MemoryBuffer*>(src.file_.get());
-  if (mem) {
-    uint64 pos = mem->tell();
-    size = std::min(size, mem->size() - pos);
-    write(mem->data() + pos, size);
-    mem->seek(size, SEEK_CUR);
+  if (uint8 const* data = src.data()) {
+    uint64 pos = src.tell();
+    size = std::min(size, src.size() - pos);
+    write(data + pos, size);
+    src.seek(size, SEEK_CUR);
   } else {
     uint8 buf[65536];
     while (size_t count = src.read(buf, std::min<size_t>(sizeof buf, size))) {
@@ -558,9 +694,8 @@ void File::copy(File src, uint64 size) {
 }
 #include "checksum.h"
 void File::md5(void* digest) {
-  auto mem = dynamic_cast<MemoryBuffer*>(file_.get());
-  if (mem) {
-    MD5::checksum(mem->data(), mem->size(), digest);
+  if (uint8 const* data = file_->data()) {
+    MD5::checksum(data, file_->size(), digest);
   } else {
     uint64 pos = tell();
     seek(0, SEEK_SET);
@@ -576,26 +711,333 @@ void File::md5(void* digest) {
 
 #ifndef NO_SYSTEM
 #include <sys/stat.h>
+#ifdef _MSC_VER
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 bool File::exists(char const* path) {
   struct stat buffer;
   return (stat(path, &buffer) == 0);
 }
 
+class MappedBuffer : public RawMemoryBuffer {
+#ifdef _MSC_VER
+  HANDLE mapping_;
+#endif
+  void const* view_;
+  size_t size_;
+public:
+#ifdef _MSC_VER
+  MappedBuffer(HANDLE mapping, void const* view, size_t size)
+    : RawMemoryBuffer(view, size)
+    , mapping_(mapping)
+#else
+  MappedBuffer(void const* view, size_t size)
+    : RawMemoryBuffer(view, size)
+#endif
+    , view_(view)
+    , size_(size)
+  {}
+  ~MappedBuffer() {
+#ifdef _MSC_VER
+    if (view_) UnmapViewOfFile(view_);
+    if (mapping_) CloseHandle(mapping_);
+#else
+    if (view_) munmap(const_cast<void*>(view_), size_);
+#endif
+  }
+};
+
+MappedFile::MappedFile(char const* name) {
+#ifdef _MSC_VER
+  HANDLE file = CreateFile(name, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) return;
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size)) {
+    CloseHandle(file);
+    return;
+  }
+  // empty files cannot be mapped
+  HANDLE mapping = (size.QuadPart ? CreateFileMapping(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr);
+  CloseHandle(file);
+  void const* view = (mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr);
+  if (size.QuadPart && !view) {
+    if (mapping) CloseHandle(mapping);
+    return;
+  }
+  file_ = std::make_shared<MappedBuffer>(mapping, view, (size_t) size.QuadPart);
+#else
+  int fd = open(name, O_RDONLY);
+  if (fd < 0) return;
+  struct stat st;
+  if (fstat(fd, &st)) {
+    close(fd);
+    return;
+  }
+  void* view = nullptr;
+  if (st.st_size) {
+    view = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (view == MAP_FAILED) return;
+  file_ = std::make_shared<MappedBuffer>(view, (size_t) st.st_size);
+#endif
+}
+
 File SystemLoader::load(char const* path) {
   return File(root_ / path);
 }
 #endif
 
 void CompositeLoader::add(std::shared_ptr<FileLoader> loader) {
+  std::lock_guard<std::mutex> lock(mutex_);
   loaders_.push_back(loader);
+  generation_ += 1;
+  cache_.clear();
+}
+
+CompositeLoader::Loaders CompositeLoader::children_(uint32& generation) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  generation = generation_;
+  return loaders_;
 }
+
+bool CompositeLoader::cached_(std::string const& path, Entry& entry) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.lookups += 1;
+  auto it = cache_.find(path);
+  if (it == cache_.end()) {
+    return false;
+  }
+  entry = it->second;
+  if (entry.target) {
+    stats_.hits += 1;
+  } else {
+    stats_.negativeHits += 1;
+  }
+  return true;
+}
+
+void CompositeLoader::store_(std::string const& path, Entry const& entry, uint32 generation) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (generation == generation_) {
+    cache_[path] = entry;
+  }
+}
+
+CompositeLoader::Stats CompositeLoader::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
 File CompositeLoader::load(char const* path) {
-  for (auto& loader : loaders_) {
-    File file = loader->load(path);
+  std::string name(path);
+  Entry entry;
+  if (cached_(name, entry)) {
+    if (!entry.target) {
+      return File();
+    }
+    File file = entry.target->load(entry.key.c_str());
+    if (file) {
+      return file;
+    }
+  }
+  // results are only cached while every loader before the current one has ruled the file out
+  uint32 generation;
+  Loaders loaders = children_(generation);
+  bool definite = true;
+  for (size_t i = 0; i < loaders.size(); ++i) {
+    entry.key = name;
+    entry.target = loaders[i]->resolve(entry.key);
+    if (!entry.target) {
+      continue;
+    }
+    File file = entry.target->load(entry.key.c_str());
     if (file) {
+      if (definite) {
+        entry.child = i;
+        store_(name, entry, generation);
+      }
       return file;
     }
+    definite = false;
+  }
+  if (definite) {
+    store_(name, Entry{nullptr, 0, std::string()}, generation);
   }
   return File();
 }
+
+FileLoader* CompositeLoader::resolve(std::string& path) {
+  Entry entry;
+  if (cached_(path, entry)) {
+    if (entry.target) {
+      path = entry.key;
+    }
+    return entry.target;
+  }
+  uint32 generation;
+  for (auto& loader : children_(generation)) {
+    std::string key = path;
+    if (loader->resolve(key)) {
+      return this;
+    }
+  }
+  store_(path, Entry{nullptr, 0, std::string()}, generation);
+  return nullptr;
+}
+
+bool CompositeLoader::contentKey(char const* path, uint8* key) {
+  std::string name(path);
+  Entry entry;
+  if (cached_(name, entry)) {
+    return entry.target && entry.target->contentKey(entry.key.c_str(), key);
+  }
+  // the key comes from the loader that would serve the file
+  uint32 generation;
+  for (auto& loader : children_(generation)) {
+    std::string resolved = name;
+    if (FileLoader* target = loader->resolve(resolved)) {
+      return target->contentKey(resolved.c_str(), key);
+    }
+  }
+  return false;
+}
+
+std::vector<std::future<File>> FileLoader::loadMany(std::vector<std::string> const& paths) {
+  return splitBatch(run_async([this, paths]() {
+    std::vector<File> files;
+    for (auto const& path : paths) {
+      files.push_back(load(path.c_str()));
+    }
+    return files;
+  }), paths.size());
+}
+
+std::vector<std::future<File>> FileLoader::splitBatch(std::future<std::vector<File>> batch, size_t count) {
+  std::shared_future<std::vector<File>> shared = batch.share();
+  std::vector<std::future<File>> result;
+  for (size_t i = 0; i < count; ++i) {
+    result.push_back(std::async(std::launch::deferred, [shared, i]() {
+      return shared.get()[i];
+    }));
+  }
+  return result;
+}
+
+std::vector<std::future<File>> PrefixLoader::loadMany(std::vector<std::string> const& paths) {
+  std::vector<std::string> names;
+  for (auto const& path : paths) {
+    names.push_back(prefix_ + path);
+  }
+  return loader_->loadMany(names);
+}
+
+std::vector<std::future<File>> CompositeLoader::loadMany(std::vector<std::string> const& paths) {
+  // each child gets the whole remaining batch at once, grouped by the loader the paths resolve
+  // to; files it doesn't have fall through to the next one
+  return splitBatch(run_async([this, paths]() {
+    uint32 generation;
+    Loaders loaders = children_(generation);
+    std::vector<File> files(paths.size());
+    std::vector<size_t> pending;
+    std::vector<bool> definite(paths.size(), true);
+    for (size_t i = 0; i < paths.size(); ++i) {
+      Entry entry;
+      if (!cached_(paths[i], entry) || entry.target) {
+        pending.push_back(i);
+      }
+    }
+    for (size_t child = 0; child < loaders.size() && !pending.empty(); ++child) {
+      std::map<FileLoader*, std::vector<size_t>> groups;
+      std::vector<std::string> keys(paths.size());
+      std::vector<size_t> missing;
+      for (size_t i : pending) {
+        keys[i] = paths[i];
+        if (FileLoader* target = loaders[child]->resolve(keys[i])) {
+          groups[target].push_back(i);
+        } else {
+          missing.push_back(i);
+        }
+      }
+      for (auto& group : groups) {
+        std::vector<std::string> names;
+        for (size_t i : group.second) {
+          names.push_back(keys[i]);
+        }
+        auto results = group.first->loadMany(names);
+        for (size_t j = 0; j < group.second.size(); ++j) {
+          size_t i = group.second[j];
+          files[i] = results[j].get();
+          if (!files[i]) {
+            definite[i] = false;
+            missing.push_back(i);
+          } else if (definite[i]) {
+            store_(paths[i], Entry{group.first, child, keys[i]}, generation);
+          }
+        }
+      }
+      pending.swap(missing);
+    }
+    for (size_t i : pending) {
+      if (definite[i]) {
+        store_(paths[i], Entry{nullptr, 0, std::string()}, generation);
+      }
+    }
+    return files;
+  }), paths.size());
+}
+
+PrefetchLoader::PrefetchLoader(FileLoader& loader, std::vector<std::string> const& paths)
+  : loader_(loader)
+{
+  std::vector<std::string> unique;
+  for (auto const& path : paths) {
+    if (!files_.count(path)) {
+      files_[path];
+      unique.push_back(path);
+    }
+  }
+  auto results = loader.loadMany(unique);
+  for (size_t i = 0; i < unique.size(); ++i) {
+    files_[unique[i]].file = results[i].share();
+  }
+}
+
+void PrefetchLoader::wait_() {
+  for (auto& file : files_) {
+    file.second.file.wait();
+  }
+}
+
+File PrefetchLoader::load(char const* path) {
+  auto it = files_.find(path);
+  if (it == files_.end()) {
+    // the batch may still be using the loader
+    wait_();
+    return loader_.load(path);
+  }
+  File file = it->second.file.get();
+  if (!file) {
+    return file;
+  }
+  if (it->second.taken) {
+    // later requests must not share the cursor of the first one
+    if (uint8 const* data = file.data()) {
+      MemoryFile copy;
+      copy.write(data, (size_t) file.size());
+      file = copy;
+    } else {
+      wait_();
+      file = loader_.load(path);
+    }
+  }
+  it->second.taken = true;
+  file.seek(0);
+  return file;
+}
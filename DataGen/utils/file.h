@@ -3,6 +3,9 @@
 #include "common.h"
 #include <string>
 #include <memory>
+#include <future>
+#include <mutex>
+#include <unordered_map>
 
 class FileBuffer {
 public:
@@ -31,6 +34,21 @@ public:
 
   virtual size_t read(void* ptr, size_t size) = 0;
   virtual size_t write(void const* ptr, size_t size) = 0;
+
+  // writes buffered data through to the storage device, if the buffer has one
+  virtual bool flush() {
+    return true;
+  }
+
+  // cuts the buffer down to size bytes; false if it cannot be resized
+  virtual bool truncate(uint64 size) {
+    return false;
+  }
+
+  // contents of the whole buffer, if it is stored contiguously in memory
+  virtual uint8 const* data() const {
+    return nullptr;
+  }
 };
 
 class File {
@@ -152,6 +170,13 @@ public:
     return file_->write(&x, 8) == 8;
   }
 
+  bool flush() {
+    return file_->flush();
+  }
+  bool truncate(uint64 size) {
+    return file_->truncate(size);
+  }
+
   void printf(char const* fmt, ...);
 
   bool getline(std::string& line);
@@ -167,6 +192,10 @@ public:
   LineIterator<std::wstring> wbegin();
   LineIterator<std::wstring> wend();
 
+  uint8 const* data() const {
+    return file_ ? file_->data() : nullptr;
+  }
+
   File subfile(uint64 offset, uint64 size);
 
   void copy(File src, uint64 size = max_uint64);
@@ -194,11 +223,106 @@ public:
 
   static MemoryFile from(File file);
 
-  uint8 const* data() const;
   uint8* alloc(size_t size);
   void resize(size_t size);
 };
 
+#ifndef NO_SYSTEM
+// Read-only memory mapping of a file on disk, so data() is available without reading the
+// whole file. Null if the file could not be opened.
+class MappedFile : public File {
+public:
+  explicit MappedFile(char const* name);
+  explicit MappedFile(std::string const& name)
+    : MappedFile(name.c_str())
+  {}
+};
+#endif
+
+// Cursor over an in-memory file with inline, bounds-checked reads that bypass FileBuffer.
+// Files that are not held in memory are copied once. Reads past the end return zeroes and
+// leave the cursor at the end. The file must not be written to while the reader is in use.
+class ByteReader {
+public:
+  ByteReader(File file);
+
+  size_t tell() const {
+    return pos_;
+  }
+  size_t size() const {
+    return size_;
+  }
+  size_t left() const {
+    return size_ - pos_;
+  }
+  bool eof() const {
+    return pos_ >= size_;
+  }
+  void seek(size_t pos) {
+    pos_ = (pos < size_ ? pos : size_);
+  }
+  void skip(size_t count) {
+    pos_ += (count < size_ - pos_ ? count : size_ - pos_);
+  }
+  uint8 const* ptr() const {
+    return data_ + pos_;
+  }
+
+  size_t read(void* dst, size_t size) {
+    if (size > size_ - pos_) {
+      size = size_ - pos_;
+    }
+    memcpy(dst, data_ + pos_, size);
+    pos_ += size;
+    return size;
+  }
+  template<class T>
+  T read() {
+    T x;
+    if (sizeof(T) <= size_ - pos_) {
+      memcpy(&x, data_ + pos_, sizeof(T));
+      pos_ += sizeof(T);
+    } else {
+      memset(&x, 0, sizeof(T));
+      pos_ = size_;
+    }
+    return x;
+  }
+  uint8 read8() {
+    return pos_ < size_ ? data_[pos_++] : 0;
+  }
+  uint16 read16(bool big = false) {
+    uint16 x = read<uint16>();
+    if (big) flip(x);
+    return x;
+  }
+  uint32 read32(bool big = false) {
+    uint32 x = read<uint32>();
+    if (big) flip(x);
+    return x;
+  }
+  uint64 read64(bool big = false) {
+    uint64 x = read<uint64>();
+    if (big) flip(x);
+    return x;
+  }
+
+  // zero-terminated string; the terminator is skipped but not included
+  StringView readString() {
+    char const* str = reinterpret_cast<char const*>(data_ + pos_);
+    void const* end = memchr(str, 0, size_ - pos_);
+    size_t length = (end ? static_cast<char const*>(end) - str : size_ - pos_);
+    pos_ += (end ? length + 1 : length);
+    return StringView(str, length);
+  }
+
+private:
+  File file_;
+  uint8 const* data_;
+  size_t pos_;
+  size_t size_;
+};
+
 template<class string_t>
 class File::LineIterator {
   friend class File;
@@ -239,6 +363,27 @@ public:
   }
 };
 
+// Splits a file into lines without copying them. Lines of in-memory files point directly
+// into the file data, other files are read through an internal buffer in large blocks.
+// Line endings are the same as in File::getline; a line is valid until the next call.
+class LineReader {
+public:
+  LineReader(File file);
+
+  bool getline(StringView& line);
+
+private:
+  void fill_();
+
+  File file_;
+  std::vector<char> buffer_;
+  char const* data_;
+  size_t pos_;
+  size_t size_;
+  size_t newline_;
+  bool eof_;
+};
+
 class WideFile {
 public:
   WideFile(File const& file)
@@ -302,6 +447,28 @@ public:
   virtual ~FileLoader() {};
 
   virtual File load(char const* path) = 0;
+
+  // Starts loading a batch of files, the results are in the same order as paths. By default
+  // they are loaded one by one on a background thread; loaders that can parallelize or
+  // coalesce reads override this. The loader must outlive the returned futures.
+  virtual std::vector<std::future<File>> loadMany(std::vector<std::string> const& paths);
+
+  // Finds the loader that holds path without reading it, and rewrites path to the name that
+  // loader knows it by. Returns nullptr if the file is known to be missing; loaders that can't
+  // tell cheaply return themselves.
+  virtual FileLoader* resolve(std::string& path) {
+    return this;
+  }
+
+  // Fills the 16 byte key that identifies the contents of path, without reading it: files with
+  // equal keys are identical. Returns false if the loader has no such key for the file.
+  virtual bool contentKey(char const* path, uint8* key) {
+    return false;
+  }
+
+protected:
+  // splits the result of a batch into per-file futures
+  static std::vector<std::future<File>> splitBatch(std::future<std::vector<File>> batch, size_t count);
 };
 
 #ifndef NO_SYSTEM
@@ -330,17 +497,76 @@ public:
   virtual File load(char const* path) override {
     return loader_->load((prefix_ + path).c_str());
   }
+  virtual std::vector<std::future<File>> loadMany(std::vector<std::string> const& paths) override;
+  virtual FileLoader* resolve(std::string& path) override {
+    path.insert(0, prefix_);
+    return loader_->resolve(path);
+  }
+  virtual bool contentKey(char const* path, uint8* key) override {
+    return loader_->contentKey((prefix_ + path).c_str(), key);
+  }
 
 private:
   std::string prefix_;
   std::shared_ptr<FileLoader> loader_;
 };
 
+// Tries each loader in order. Paths are resolved once and cached: hits go straight to the
+// loader that had them, and paths that every child ruled out are remembered as misses.
+// Lookups search a copy of the child list, so loaders can be added while files are loading.
 class CompositeLoader : public FileLoader {
 public:
+  struct Stats {
+    uint64 lookups;
+    uint64 hits;
+    uint64 negativeHits;
+  };
+
   void add(std::shared_ptr<FileLoader> loader);
   virtual File load(char const* path) override;
+  virtual std::vector<std::future<File>> loadMany(std::vector<std::string> const& paths) override;
+  virtual FileLoader* resolve(std::string& path) override;
+  virtual bool contentKey(char const* path, uint8* key) override;
+
+  Stats stats() const;
 
 private:
-  std::vector<std::shared_ptr<FileLoader>> loaders_;
+  struct Entry {
+    FileLoader* target; // nullptr for a known miss
+    size_t child;
+    std::string key;
+  };
+  typedef std::vector<std::shared_ptr<FileLoader>> Loaders;
+  Loaders loaders_;
+  uint32 generation_ = 0; // bumped by add, so that lookups made before it are not cached
+  std::unordered_map<std::string, Entry> cache_;
+  Stats stats_ = {};
+  mutable std::mutex mutex_;
+
+  // copy of the children to search without holding the lock, and the generation it belongs to
+  Loaders children_(uint32& generation) const;
+  bool cached_(std::string const& path, Entry& entry);
+  void store_(std::string const& path, Entry const& entry, uint32 generation);
+};
+
+// Serves a list of files that were requested up front through loadMany, so that they load
+// in the background while the caller works through them. Files outside the list go to the
+// underlying loader once the batch has finished. Each path is fetched once: the first
+// request for it gets the prefetched file, later ones a copy (or a fresh load) with a cursor
+// of their own.
+class PrefetchLoader : public FileLoader {
+public:
+  PrefetchLoader(FileLoader& loader, std::vector<std::string> const& paths);
+
+  virtual File load(char const* path) override;
+
+private:
+  void wait_();
+
+  struct Prefetched {
+    std::shared_future<File> file;
+    bool taken = false;
+  };
+  FileLoader& loader_;
+  std::map<std::string, Prefetched> files_;
 };
@@ -25,6 +25,9 @@
 #include <curl/curl.h>
 #endif
 
+#include <mutex>
+#include <unordered_map>
+
 void HttpRequest::addHeader(std::string const& name, std::string const& value) {
   addHeader(name + ": " + value);
 }
@@ -56,10 +59,50 @@ void HttpRequest::addData(std::string const& key, std::string const& value) {
 
 #pragma comment(lib, "wininet.lib")
 
+// WinINet keeps finished keep-alive connections open for the next request to the same server,
+// but only for as long as the session handle that made them. All requests therefore share one
+// session, and one connect handle per server, which stay open until exit.
+class SessionPool {
+public:
+  static SessionPool& instance() {
+    static SessionPool pool;
+    return pool;
+  }
+
+  HINTERNET connect(std::string const& host, INTERNET_PORT port) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!session_) return nullptr;
+    HINTERNET& connect = connects_[fmtstring("%s:%u", host.c_str(), (uint32) port)];
+    if (!connect) {
+      connect = InternetConnect(session_, host.c_str(), port, NULL, NULL, INTERNET_SERVICE_HTTP, 0, NULL);
+    }
+    return connect;
+  }
+
+  ~SessionPool() {
+    for (auto& kv : connects_) {
+      if (kv.second) InternetCloseHandle(kv.second);
+    }
+    if (session_) InternetCloseHandle(session_);
+  }
+
+private:
+  // parallel requests to one host, as made by ArchiveCache, each need a connection
+  static const DWORD MAX_CONNECTIONS = 16;
+  HINTERNET session_;
+  std::unordered_map<std::string, HINTERNET> connects_;
+  std::mutex mutex_;
+
+  SessionPool() {
+    DWORD connections = MAX_CONNECTIONS;
+    InternetSetOption(NULL, INTERNET_OPTION_MAX_CONNS_PER_SERVER, &connections, sizeof connections);
+    InternetSetOption(NULL, INTERNET_OPTION_MAX_CONNS_PER_1_0_SERVER, &connections, sizeof connections);
+    session_ = InternetOpen("SNOParser", INTERNET_OPEN_TYPE_PRECONFIG, NULL, NULL, 0);
+  }
+};
+
 HttpRequest::SessionHolder::~SessionHolder() {
   if (request) InternetCloseHandle(request);
-  if (connect) InternetCloseHandle(connect);
-  if (session) InternetCloseHandle(session);
 }
 
 HttpRequest::HttpRequest(std::string const& url, RequestType type)
@@ -81,13 +124,13 @@ HttpRequest::HttpRequest(std::string const& url, RequestType type)
   std::string host(urlComp.lpszHostName, urlComp.dwHostNameLength);
   std::string path(urlComp.lpszUrlPath, urlComp.dwUrlPathLength + urlComp.dwExtraInfoLength);
 
-  handles_->session = InternetOpen("SNOParser", INTERNET_OPEN_TYPE_PRECONFIG, NULL, NULL, 0);
-  if (!handles_->session) return;
-  handles_->connect = InternetConnect(handles_->session, host.c_str(), urlComp.nPort, NULL, NULL, INTERNET_SERVICE_HTTP, 0, NULL);
-  if (!handles_->connect) return;
+  HINTERNET connect = SessionPool::instance().connect(host, urlComp.nPort);
+  if (!connect) return;
+  // the connection goes back to the session once the response has been read in full
   handles_->request = HttpOpenRequest(
-    handles_->connect, type == GET ? "GET" : "POST", path.c_str(), "HTTP/1.1", NULL, NULL,
-    (urlComp.nScheme == INTERNET_SCHEME_HTTPS ? INTERNET_FLAG_SECURE : 0) | INTERNET_FLAG_RELOAD, NULL);
+    connect, type == GET ? "GET" : "POST", path.c_str(), "HTTP/1.1", NULL, NULL,
+    (urlComp.nScheme == INTERNET_SCHEME_HTTPS ? INTERNET_FLAG_SECURE : 0) | INTERNET_FLAG_RELOAD |
+    INTERNET_FLAG_KEEP_CONNECTION | INTERNET_FLAG_NO_CACHE_WRITE, NULL);
   if (handles_->request) {
     BOOL value = TRUE;
     InternetSetOption(handles_->request, INTERNET_OPTION_HTTP_DECODING, &value, sizeof value);
@@ -99,6 +142,10 @@ void HttpRequest::addHeader(std::string const& header) {
   headers_.append("\r\n");
 }
 
+void HttpRequest::setOutput(File file) {
+  output_ = file;
+}
+
 bool HttpRequest::send() {
   if (!handles_->request) return false;
   return HttpSendRequest(handles_->request,
@@ -195,6 +242,20 @@ public:
 File HttpRequest::response() {
   if (!handles_->request) return File();
 
+  if (output_) {
+    // the response starts where the output was when it was read
+    uint64 start = output_.tell();
+    DWORD size = 0, read;
+    std::vector<uint8> buffer;
+    while (InternetQueryDataAvailable(handles_->request, &size, 0, 0) && size) {
+      buffer.resize(size);
+      if (!InternetReadFile(handles_->request, buffer.data(), size, &read) || !read) break;
+      output_.write(buffer.data(), read);
+    }
+    output_.seek(start);
+    return output_;
+  }
+
   DWORD contentLength = 0;
   DWORD size = (sizeof contentLength);
   HttpQueryInfo(handles_->request, HTTP_QUERY_CONTENT_LENGTH | HTTP_QUERY_FLAG_NUMBER,
@@ -244,6 +305,71 @@ std::map<std::string, std::string> HttpRequest::headers() {
 
 #else
 
+// Finished handles are kept per host so that the next request to the same server reuses
+// the open connection (and its TLS session) instead of reconnecting. Several requests to
+// one host run in parallel over separate handles, and at most MAX_IDLE handles are kept
+// for each host.
+class ConnectionPool {
+public:
+  static ConnectionPool& instance() {
+    static ConnectionPool pool;
+    return pool;
+  }
+
+  CURL* acquire(std::string const& url) {
+    std::string host = host_(url);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto& idle = idle_[host];
+      if (!idle.empty()) {
+        CURL* curl = idle.back();
+        idle.pop_back();
+        curl_easy_reset(curl);
+        return curl;
+      }
+    }
+    return curl_easy_init();
+  }
+
+  void release(std::string const& url, CURL* curl) {
+    std::string host = host_(url);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto& idle = idle_[host];
+      if (idle.size() < MAX_IDLE) {
+        idle.push_back(curl);
+        return;
+      }
+    }
+    curl_easy_cleanup(curl);
+  }
+
+  ~ConnectionPool() {
+    for (auto& kv : idle_) {
+      for (CURL* curl : kv.second) {
+        curl_easy_cleanup(curl);
+      }
+    }
+    curl_global_cleanup();
+  }
+
+private:
+  static const size_t MAX_IDLE = 8;
+  std::mutex mutex_;
+  std::unordered_map<std::string, std::vector<CURL*>> idle_;
+
+  ConnectionPool() {
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+  }
+
+  // scheme://host:port
+  static std::string host_(std::string const& url) {
+    size_t pos = url.find("://");
+    pos = (pos == std::string::npos ? 0 : pos + 3);
+    return url.substr(0, url.find('/', pos));
+  }
+};
+
 HttpRequest::HttpRequest(std::string const& url, RequestType type)
   : url_(url)
   , response_(new Response)
@@ -269,14 +395,28 @@ size_t string_writer(char* ptr, size_t size, size_t count, void* data) {
 }
 
 size_t file_writer(char* ptr, size_t size, size_t count, void* data) {
-  MemoryFile* file = reinterpret_cast<MemoryFile*>(data);
+  File* file = reinterpret_cast<File*>(data);
   return file->write(ptr, size * count);
 }
 
+void HttpRequest::setOutput(File file) {
+  response_->data = file;
+}
+
 bool HttpRequest::send() {
-  CURL* curl = curl_easy_init();
+  ConnectionPool& pool = ConnectionPool::instance();
+  CURL* curl = pool.acquire(url_);
+  if (!curl) return false;
+  // the response starts where the output was when the request was sent
+  uint64 start = response_->data.tell();
   curl_easy_setopt(curl, CURLOPT_URL, url_.c_str());
-  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0);
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 30L);
+  // give up on transfers that stall, so that the caller can retry them
+  curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+  curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 60L);
   if (response_->request_headers) {
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, response_->request_headers);
   }
@@ -292,13 +432,13 @@ bool HttpRequest::send() {
   if (res == CURLE_OK) {
     curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_->code);
   }
-  curl_easy_cleanup(curl);
-  response_->data.seek(0);
+  pool.release(url_, curl);
+  response_->data.seek(start);
   return res == CURLE_OK;
 }
 
 uint32 HttpRequest::status() {
-  return (response_ ? response_->code : 0);
+  return (response_ ? (uint32) response_->code : 0);
 }
 
 File HttpRequest::response() {
@@ -19,6 +19,8 @@
 #include <string>
 #include "file.h"
 
+// Both backends keep idle keep-alive connections per server, so that consecutive and
+// parallel requests to one host reuse open connections instead of reconnecting.
 class HttpRequest {
 public:
   enum RequestType {GET, POST};
@@ -29,6 +31,10 @@ public:
   void addHeader(std::string const& header);
   void addData(std::string const& key, std::string const& value);
 
+  // Writes the response body to file instead of memory; response() then returns file,
+  // rewound to the start
+  void setOutput(File file);
+
   bool send();
   uint32 status();
   std::map<std::string, std::string> headers();
@@ -39,19 +45,18 @@ public:
 private:
 #ifdef USE_WINHTTP
   struct SessionHolder {
-    HINTERNET session = nullptr;
-    HINTERNET connect = nullptr;
     HINTERNET request = nullptr;
     ~SessionHolder();
   };
   friend class HttpBuffer;
   std::shared_ptr<SessionHolder> handles_;
   std::string headers_;
+  File output_;
 #else
   struct Response {
     std::string headers;
-    MemoryFile data;
-    uint32 code;
+    File data = MemoryFile();
+    long code = 0;
 
     struct curl_slist* request_headers = nullptr;
 
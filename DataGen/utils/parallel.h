@@ -0,0 +1,64 @@
+#pragma once
+
+#include <algorithm>
+#include <exception>
+#include <future>
+#include <vector>
+#ifndef NO_SYSTEM
+#include <atomic>
+#include <mutex>
+#include <thread>
+#endif
+
+// Runs func on a background thread. Without threads (NO_SYSTEM) it runs when the result is requested.
+template<class Func>
+auto run_async(Func func) -> std::future<decltype(func())> {
+#ifdef NO_SYSTEM
+  return std::async(std::launch::deferred, func);
+#else
+  return std::async(std::launch::async, func);
+#endif
+}
+
+// Calls func(i) for every i in [0, count), spread over the available cores.
+// The first exception thrown by func is rethrown once all workers are done.
+template<class Func>
+void parallel_for(size_t count, Func func, size_t maxThreads = 0) {
+#ifndef NO_SYSTEM
+  size_t threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  if (maxThreads) threads = std::min(threads, maxThreads);
+  threads = std::min(threads, count);
+  if (threads > 1) {
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::mutex errorLock;
+    auto worker = [&]() {
+      size_t i;
+      while ((i = next++) < count) {
+        try {
+          func(i);
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(errorLock);
+          if (!error) error = std::current_exception();
+          next = count;
+        }
+      }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < threads; ++i) {
+      workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : workers) {
+      thread.join();
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+    return;
+  }
+#endif
+  for (size_t i = 0; i < count; ++i) {
+    func(i);
+  }
+}
@@ -50,6 +50,8 @@ string path::ext(string const& path) {
 
 #ifdef _MSC_VER
 #include <windows.h>
+#else
+#include <unistd.h>
 #endif
 #ifndef NO_SYSTEM
 string path::root() {
@@ -59,15 +61,21 @@ string path::root() {
 #ifdef _MSC_VER
     GetModuleFileName(GetModuleHandle(NULL), buffer, sizeof buffer);
 #else
-    readlink("/proc/self/exe", buffer, sizeof buffer);
+    ssize_t length = readlink("/proc/self/exe", buffer, sizeof buffer - 1);
+    buffer[length > 0 ? length : 0] = 0;
 #endif
     rp = path(buffer);
     rp = rp / "work";
 //#ifdef _DEBUG
 //    rp = "G:\\rivsoft\\wc3\\DataGen\\work";
 //#endif
+#ifdef _MSC_VER
     rp = "C:\\Projects\\wc3data\\DataGen\\work";
     SetCurrentDirectory(rp.c_str());
+#else
+    create_dir(rp.c_str());
+    chdir(rp.c_str());
+#endif
   }
   return rp;
 }
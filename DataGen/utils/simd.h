@@ -0,0 +1,83 @@
+#pragma once
+
+// Instruction sets available to the vectorized image code.
+//
+// On x86 the vector paths are compiled for their target through SIMD_TARGET and chosen at run
+// time with the Simd::has* checks, so the build itself needs no extra flags. WebAssembly has
+// no run time detection; the wasm paths are used when the module is built with -msimd128.
+// Everything else, and any CPU without the instructions, takes the scalar path.
+
+#if defined(__wasm_simd128__)
+#define SIMD_WASM 1
+#include <wasm_simd128.h>
+#elif defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SIMD_TARGET(isa)
+#endif
+
+namespace Simd {
+
+#ifdef SIMD_X86
+  struct CpuInfo {
+    bool ssse3 = false;
+    bool sse41 = false;
+    bool avx2 = false;
+
+    CpuInfo() {
+#ifdef _MSC_VER
+      int info[4];
+      __cpuid(info, 0);
+      int maxLeaf = info[0];
+      __cpuid(info, 1);
+      ssse3 = (info[2] & (1 << 9)) != 0;
+      sse41 = (info[2] & (1 << 19)) != 0;
+      // AVX state must also be enabled by the OS
+      bool osAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+      if (maxLeaf >= 7 && osAvx) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+      }
+#else
+      __builtin_cpu_init();
+      ssse3 = __builtin_cpu_supports("ssse3");
+      sse41 = __builtin_cpu_supports("sse4.1");
+      avx2 = __builtin_cpu_supports("avx2");
+#endif
+    }
+  };
+  inline CpuInfo const& cpu() {
+    static CpuInfo info;
+    return info;
+  }
+
+  inline bool hasSSSE3() {
+    return cpu().ssse3;
+  }
+  inline bool hasSSE41() {
+    return cpu().sse41;
+  }
+  inline bool hasAVX2() {
+    return cpu().avx2;
+  }
+#else
+  inline bool hasSSSE3() {
+    return false;
+  }
+  inline bool hasSSE41() {
+    return false;
+  }
+  inline bool hasAVX2() {
+    return false;
+  }
+#endif
+
+}
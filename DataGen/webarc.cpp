@@ -53,6 +53,22 @@ extern "C" {
     }
     return 0;
   }
+  // Same, shrunk to fit in width x height; BLP and DDS textures are decoded from the smallest
+  // mip level that covers the thumbnail
+  EMSCRIPTEN_KEEPALIVE int loadThumbnail(uint32 id1, uint32 id2, int width, int height) {
+    Image image(archive->open(mpq::hashTo64(id1, id2)), ImageDecodeOptions(width, height));
+    if (image) {
+      double scale = std::min(double(width) / image.width(), double(height) / image.height());
+      if (scale < 1) {
+        image = image.resize(std::max(1, int(image.width() * scale + 0.5)), std::max(1, int(image.height() * scale + 0.5)));
+      }
+      MemoryFile file;
+      image.write(file);
+      write_output(file.data(), file.size());
+      return 1;
+    }
+    return 0;
+  }
 
   EMSCRIPTEN_KEEPALIVE int loadJASS(void const* options) {
     jass::JASSDo jd(*archive, *(jass::Options*)options);
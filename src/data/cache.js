@@ -1,6 +1,7 @@
 import React from 'react';
 import { Cache } from 'utils';
 import pathHash, { makeUid } from './hash';
+import IconTable from './icons';
 import loadArchive from 'maps/archive';
 import MapParser from 'maps/parser';
 import { notifyMessage } from 'notify';
@@ -168,13 +169,7 @@ export default class AppCache extends Cache {
       proms.push(this.nameStore.json());
     }
     this.ready = Promise.all(proms).then(([images, versions, names]) => {
-      this.icons_ = new Map();
-      const imageList = new Uint32Array(images);
-      for (let i = 0; i < imageList.length; i += 2) {
-        // this will cause precision loss but we have to deal with it
-        const uid = makeUid(imageList.subarray(i, i + 2));
-        this.icons_.set(uid, (i / 2) + 1000 * 256);
-      }
+      this.icons_ = new IconTable(images);
   
       this.versions = versions.versions;
 
@@ -243,18 +238,7 @@ export default class AppCache extends Cache {
   }
 
   icon(id) {
-    const index = this.icons_.get(makeUid(id));
-    if (index) {
-      const col = index % 16;
-      const row = ((index / 16) | 0) % 16;
-      const image = (index / 256) | 0;
-      return {
-        backgroundImage: `url(/api/icons${image}.png)`,
-        backgroundPosition: `-${col * 16}px -${row * 16}px`,
-      };
-    } else {
-      return null;
-    }
+    return this.icons_ ? this.icons_.style(id) : null;
   }
   iconByName(name) {
     return this.icon(pathHash(name));
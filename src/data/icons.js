@@ -0,0 +1,55 @@
+// Icon sheets written by DataGen: images.dat locates every icon by its path hash (see
+// DataGen/icontable.h), and the same cell is used in the sheets of every size.
+export default class IconTable {
+  constructor(buffer) {
+    const head = new Uint32Array(buffer, 0, 5);
+    if (head[0] !== 0x324F4349) {
+      throw new Error("Unknown icon table format");
+    }
+    this.count = head[1];
+    this.columns = head[2];
+    this.rows = head[3];
+    this.sizes = Array.from(new Uint32Array(buffer, 20, head[4])).sort((a, b) => a - b);
+    const offset = 20 + head[4] * 4;
+    this.hashes = new Uint32Array(buffer, offset, this.count * 2);
+    this.cells = new Uint32Array(buffer, offset + this.count * 8, this.count);
+  }
+
+  // binary search over the sorted hashes, stored as [low, high] pairs like pathHash results
+  find(id) {
+    const hashes = this.hashes;
+    let lo = 0, hi = this.count;
+    while (lo < hi) {
+      const mid = (lo + hi) >>> 1;
+      const high = hashes[mid * 2 + 1];
+      if (high < id[1] || (high === id[1] && hashes[mid * 2] < id[0])) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    if (lo >= this.count || hashes[lo * 2] !== id[0] || hashes[lo * 2 + 1] !== id[1]) {
+      return null;
+    }
+    const cell = this.cells[lo];
+    return {sheet: cell >>> 16, row: (cell >>> 8) & 0xFF, column: cell & 0xFF};
+  }
+
+  // CSS background showing an icon at size x size pixels, from the smallest sheet that is
+  // at least that large
+  style(id, size = 16) {
+    const cell = this.find(id);
+    if (!cell) {
+      return null;
+    }
+    const sheetSize = this.sizes.find(s => s >= size) || this.sizes[this.sizes.length - 1];
+    const style = {
+      backgroundImage: `url(/api/icons${cell.sheet}_${sheetSize}.png)`,
+      backgroundPosition: `-${cell.column * size}px -${cell.row * size}px`,
+    };
+    if (sheetSize !== size) {
+      style.backgroundSize = `${this.columns * size}px ${this.rows * size}px`;
+    }
+    return style;
+  }
+}